@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if CONFIG_BENCH_ENABLE
+
+/**
+ * @brief Start the periodic benchmark report.
+ *
+ * Every CONFIG_BENCH_REPORT_INTERVAL_S seconds a single "BENCH" log line is
+ * printed with samples/s, sensor-to-socket latency percentiles, heap use and
+ * allocations per sample. tools/bench.py parses these lines.
+ */
+void bench_init(void);
+
+/**
+ * @brief Count one sensor reading entering the broadcast path.
+ */
+void bench_record_sample(void);
+
+/**
+ * @brief Record the latency of one socket send.
+ *
+ * @param read_us esp_timer_get_time() taken when the reading left the sensor.
+ */
+void bench_record_latency(int64_t read_us);
+
+/**
+ * @brief Record the duration of one broadcast fanout.
+ *
+ * @param start_us esp_timer_get_time() taken before the first send.
+ * @param clients  Number of clients the frame was sent to.
+ */
+void bench_record_fanout(int64_t start_us, int clients);
+
+/**
+ * @brief Record the time taken to render the frames of one reading.
+ *
+ * @param start_us esp_timer_get_time() taken before rendering.
+ */
+void bench_record_render(int64_t start_us);
+
+#else
+
+static inline void bench_init(void) {}
+static inline void bench_record_sample(void) {}
+static inline void bench_record_latency(int64_t read_us) { (void)read_us; }
+static inline void bench_record_fanout(int64_t start_us, int clients) { (void)start_us; (void)clients; }
+static inline void bench_record_render(int64_t start_us) { (void)start_us; }
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,226 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "bench.h"
+#include "sps30_hal_stats.h"
+#include "sensor_events.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <malloc.h>
+#else
+#include "esp_heap_caps.h"
+#include "esp_system.h"
+#endif
+
+static const char *TAG = "bench";
+
+#define BENCH_WINDOW 1024
+#define BENCH_UART_COMMANDS 8
+
+typedef struct
+{
+    int32_t values[BENCH_WINDOW];
+    atomic_uint head;
+} bench_window_t;
+
+static bench_window_t s_latency;
+static bench_window_t s_fanout;
+static bench_window_t s_render;
+static atomic_uint s_samples;
+static atomic_uint s_fanout_clients;
+static atomic_uint s_allocs;
+static int32_t s_sorted[BENCH_WINDOW];
+static esp_timer_handle_t s_timer;
+static int64_t s_last_report_us;
+static size_t s_heap_peak;
+
+static void window_push(bench_window_t *w, int64_t value)
+{
+    unsigned idx = atomic_fetch_add_explicit(&w->head, 1, memory_order_relaxed);
+    w->values[idx % BENCH_WINDOW] = value > INT32_MAX ? INT32_MAX : (int32_t)value;
+}
+
+static int cmp_i32(const void *a, const void *b)
+{
+    int32_t x = *(const int32_t *)a;
+    int32_t y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Copy the window into s_sorted and sort it. Returns the number of entries.
+ */
+static unsigned window_sort(bench_window_t *w)
+{
+    unsigned head = atomic_load_explicit(&w->head, memory_order_relaxed);
+    unsigned n = head < BENCH_WINDOW ? head : BENCH_WINDOW;
+    memcpy(s_sorted, w->values, n * sizeof(int32_t));
+    qsort(s_sorted, n, sizeof(int32_t), cmp_i32);
+    return n;
+}
+
+static int32_t percentile(unsigned n, unsigned pct)
+{
+    if (n == 0)
+        return 0;
+    unsigned idx = (n * pct) / 100;
+    return s_sorted[idx < n ? idx : n - 1];
+}
+
+static size_t heap_used(void)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks;
+#else
+    return heap_caps_get_total_size(MALLOC_CAP_DEFAULT) - heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
+#endif
+}
+
+static void bench_report(void *arg)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t elapsed_us = now - s_last_report_us;
+    s_last_report_us = now;
+
+    unsigned samples = atomic_exchange(&s_samples, 0);
+    unsigned allocs = atomic_exchange(&s_allocs, 0);
+    unsigned fanouts = atomic_load(&s_fanout.head);
+    unsigned fanout_clients = atomic_exchange(&s_fanout_clients, 0);
+
+    unsigned n = window_sort(&s_latency);
+    int32_t p50 = percentile(n, 50);
+    int32_t p90 = percentile(n, 90);
+    int32_t p99 = percentile(n, 99);
+    int32_t lat_max = n ? s_sorted[n - 1] : 0;
+    atomic_store(&s_latency.head, 0);
+
+    unsigned f = window_sort(&s_fanout);
+    int32_t fanout_p50 = percentile(f, 50);
+    int32_t fanout_p99 = percentile(f, 99);
+    atomic_store(&s_fanout.head, 0);
+
+    unsigned r = window_sort(&s_render);
+    int32_t render_p50 = percentile(r, 50);
+    int32_t render_p99 = percentile(r, 99);
+    atomic_store(&s_render.head, 0);
+
+    size_t used = heap_used();
+    if (used > s_heap_peak)
+        s_heap_peak = used;
+
+    // Per SHDLC command: mean and worst request-to-response time, mean response size
+    sps30_hal_command_stats_t cmds[BENCH_UART_COMMANDS];
+    size_t ncmds = sps30_hal_take_command_stats(cmds, BENCH_UART_COMMANDS);
+    char uart[BENCH_UART_COMMANDS * 96] = "";
+    size_t off = 0;
+    for (size_t i = 0; i < ncmds && off < sizeof(uart); i++)
+    {
+        off += snprintf(uart + off, sizeof(uart) - off,
+                        " uart_%02x_us_avg=%lu uart_%02x_us_max=%lu uart_%02x_timeouts=%lu uart_%02x_rx_bytes=%lu",
+                        cmds[i].command, cmds[i].count ? (unsigned long)(cmds[i].total_us / cmds[i].count) : 0UL,
+                        cmds[i].command, (unsigned long)cmds[i].max_us,
+                        cmds[i].command, (unsigned long)cmds[i].timeouts,
+                        cmds[i].command, cmds[i].count ? (unsigned long)(cmds[i].rx_bytes / cmds[i].count) : 0UL);
+    }
+
+    // Sensor clock tracking since boot, over all sensors
+    sensor_sched_report_t sched;
+    sensor_task_get_sched_report(&sched);
+    unsigned long missed = 0, duplicates = 0, jitter_max = 0;
+    for (int i = 0; i < SENSOR_COUNT; i++)
+    {
+        missed += sched.sensors[i].missed;
+        duplicates += sched.sensors[i].duplicates;
+        if (sched.sensors[i].jitter_us_max > jitter_max)
+            jitter_max = sched.sensors[i].jitter_us_max;
+    }
+
+    ESP_LOGI(TAG, "BENCH samples_per_s=%.2f lat_us_p50=%ld lat_us_p90=%ld lat_us_p99=%ld lat_us_max=%ld "
+                  "fanout_us_p50=%ld fanout_us_p99=%ld render_us_p50=%ld render_us_p99=%ld sample_bytes=%u "
+                  "clients=%.1f heap_used=%u heap_peak=%u allocs_per_sample=%.1f "
+                  "sched_missed=%lu sched_duplicates=%lu sched_jitter_us_max=%lu%s",
+             elapsed_us > 0 ? samples * 1e6 / elapsed_us : 0.0,
+             (long)p50, (long)p90, (long)p99, (long)lat_max,
+             (long)fanout_p50, (long)fanout_p99,
+             (long)render_p50, (long)render_p99, (unsigned)sizeof(sensor_sample_t),
+             fanouts ? (double)fanout_clients / fanouts : 0.0,
+             (unsigned)used, (unsigned)s_heap_peak,
+             samples ? (double)allocs / samples : 0.0,
+             missed, duplicates, jitter_max, uart);
+}
+
+void bench_init(void)
+{
+    const esp_timer_create_args_t args =
+    {
+        .callback = bench_report,
+        .name = "bench_report",
+    };
+    if (esp_timer_create(&args, &s_timer) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "failed to create report timer");
+        return;
+    }
+    s_last_report_us = esp_timer_get_time();
+    s_heap_peak = heap_used();
+    esp_timer_start_periodic(s_timer, CONFIG_BENCH_REPORT_INTERVAL_S * 1000000ULL);
+}
+
+void bench_record_sample(void)
+{
+    atomic_fetch_add_explicit(&s_samples, 1, memory_order_relaxed);
+}
+
+void bench_record_latency(int64_t read_us)
+{
+    window_push(&s_latency, esp_timer_get_time() - read_us);
+}
+
+void bench_record_fanout(int64_t start_us, int clients)
+{
+    window_push(&s_fanout, esp_timer_get_time() - start_us);
+    atomic_fetch_add_explicit(&s_fanout_clients, (unsigned)clients, memory_order_relaxed);
+}
+
+void bench_record_render(int64_t start_us)
+{
+    window_push(&s_render, esp_timer_get_time() - start_us);
+}
+
+/*
+ * Allocation counting. On the linux target malloc and friends are wrapped at
+ * link time (see CMakeLists.txt); on the chip the heap component calls the
+ * trace hook when CONFIG_HEAP_USE_HOOKS is set.
+ */
+#if CONFIG_IDF_TARGET_LINUX
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    return __real_realloc(ptr, size);
+}
+#elif CONFIG_HEAP_USE_HOOKS
+void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+}
+#endif
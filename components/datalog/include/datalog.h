@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sensor_events.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * One logged reading as handed to readers. The log holds the valid readings
+ * of sensor 0 only, so records carry no sensor id or status.
+ */
+typedef struct
+{
+    uint32_t t_s;                           // Unix time in seconds
+    float values[SENSOR_CHANNEL_COUNT];
+} datalog_entry_t;
+
+typedef struct
+{
+    uint32_t records_written;   // records committed to flash since boot
+    uint32_t records_dropped;   // records lost because the writer queue was full
+    uint32_t flushes;           // flash write batches
+    uint32_t page_erases;       // pages recycled since boot
+    uint32_t pages;             // pages in the partition
+    uint32_t pages_used;        // pages holding records
+    uint32_t oldest_t_s;        // first record on the oldest page, 0 if empty
+} datalog_stats_t;
+
+/**
+ * Called for every entry by datalog_read(), oldest first.
+ * Return false to stop the iteration.
+ */
+typedef bool (*datalog_read_cb_t)(const datalog_entry_t *entry, void *ctx);
+
+/**
+ * @brief Mount the datalog partition and start the writer task.
+ *
+ * Only the page headers are read to rebuild the page index; the head page is
+ * scanned once to find the append position.
+ */
+esp_err_t datalog_init(void);
+
+/**
+ * @brief Queue one reading for the log. Never blocks; drops and counts the
+ * reading when the writer queue is full. Readings taken before the clock is
+ * set, of sensors other than 0 or with a status other than SENSOR_OK are not
+ * logged.
+ */
+void datalog_append(const sensor_data_t *data);
+
+/**
+ * @brief Iterate the records with from_s <= t_s <= to_s, oldest first.
+ *
+ * The first page is found through the page index. Records are read from
+ * flash in small batches; records still waiting in the writer's page buffer
+ * are not included. A page the writer recycles while it is being read ends
+ * at the last batch read before; its remaining records are gone.
+ *
+ * @return Number of entries passed to the callback.
+ */
+size_t datalog_read(uint32_t from_s, uint32_t to_s, datalog_read_cb_t cb, void *ctx);
+
+/**
+ * @brief Snapshot of the log counters.
+ */
+void datalog_get_stats(datalog_stats_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,500 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "datalog.h"
+#include "datalog_flash.h"
+
+static const char *TAG = "datalog";
+
+/*
+ * Layout: the storage is a circular sequence of DATALOG_PAGE_SIZE pages. Each
+ * page starts with a header carrying a sequence number and the time of its
+ * first record, followed by fixed-size records. Pages are only ever erased
+ * when the log wraps around to them, so every page sees the same number of
+ * erase cycles. Records are written with a CRC; a torn write shows up as a
+ * record with a bad CRC and is skipped.
+ */
+
+#define DATALOG_MAGIC           0x474f4c44  // "DLOG"
+#define DATALOG_READ_BATCH      16
+#define DATALOG_MIN_VALID_TIME  1577836800  // 2020-01-01; older means the clock is not set
+
+typedef struct __attribute__((packed))
+{
+    uint32_t magic;
+    uint32_t seq;           // increases by one for every page opened, never 0
+    uint32_t first_t_s;     // Unix time of the first record on the page
+    uint16_t reserved;
+    uint16_t crc;
+} page_header_t;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t t_s;                           // Unix time in seconds
+    uint16_t v[SENSOR_CHANNEL_COUNT];       // sensor_value_encode() form
+    uint16_t crc;
+} record_t;
+
+#define RECORDS_PER_PAGE ((DATALOG_PAGE_SIZE - sizeof(page_header_t)) / sizeof(record_t))
+
+// Sparse index: one entry per page, rebuilt from the page headers at mount
+typedef struct
+{
+    uint32_t seq;           // 0 = page holds no valid data
+    uint32_t first_t_s;
+} page_index_t;
+
+static page_index_t *s_index;
+static uint32_t s_pages;
+static int32_t s_head = -1;         // page being appended to, -1 while the log is empty
+static uint32_t s_head_used;        // records committed on the head page
+static uint32_t s_next_seq = 1;
+static SemaphoreHandle_t s_lock;    // guards s_index, s_head and s_head_used
+static QueueHandle_t s_queue;
+
+// Writer task only: records waiting for the next flush
+static record_t s_pending[RECORDS_PER_PAGE];
+static size_t s_pending_count;
+
+static atomic_uint s_written;
+static atomic_uint s_dropped;
+static atomic_uint s_flushes;
+static atomic_uint s_erases;
+
+static uint16_t crc16(const void *data, size_t len)
+{
+    const uint8_t *p = data;
+    uint16_t crc = 0xFFFF;
+    while (len--)
+    {
+        crc ^= (uint16_t)*p++ << 8;
+        for (int i = 0; i < 8; i++)
+        {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static size_t page_offset(uint32_t page)
+{
+    return (size_t)page * DATALOG_PAGE_SIZE;
+}
+
+static size_t record_offset(uint32_t page, uint32_t slot)
+{
+    return page_offset(page) + sizeof(page_header_t) + slot * sizeof(record_t);
+}
+
+static bool record_valid(const record_t *r)
+{
+    return r->t_s != UINT32_MAX && r->crc == crc16(r, offsetof(record_t, crc));
+}
+
+static bool record_erased(const record_t *r)
+{
+    const uint8_t *p = (const uint8_t *)r;
+    for (size_t i = 0; i < sizeof(*r); i++)
+    {
+        if (p[i] != 0xFF) return false;
+    }
+    return true;
+}
+
+/**
+ * Erase the page after the head and make it the new head. The index entry is
+ * cleared first so readers skip the page while it is being recycled.
+ */
+static esp_err_t open_page(uint32_t first_t_s)
+{
+    uint32_t page = s_head < 0 ? 0 : (uint32_t)(s_head + 1) % s_pages;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_index[page].seq = 0;
+    xSemaphoreGive(s_lock);
+
+    esp_err_t err = datalog_flash_erase_page(page_offset(page));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "erase of page %u failed: %s", (unsigned)page, esp_err_to_name(err));
+        return err;
+    }
+    atomic_fetch_add(&s_erases, 1);
+
+    page_header_t hdr = {
+        .magic = DATALOG_MAGIC,
+        .seq = s_next_seq,
+        .first_t_s = first_t_s,
+        .reserved = 0xFFFF,
+    };
+    hdr.crc = crc16(&hdr, offsetof(page_header_t, crc));
+    err = datalog_flash_write(page_offset(page), &hdr, sizeof(hdr));
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "header write of page %u failed: %s", (unsigned)page, esp_err_to_name(err));
+        return err;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_index[page].seq = hdr.seq;
+    s_index[page].first_t_s = first_t_s;
+    s_head = page;
+    s_head_used = 0;
+    xSemaphoreGive(s_lock);
+    s_next_seq++;
+    return ESP_OK;
+}
+
+/**
+ * Write all pending records with as few flash writes as possible: one per
+ * page they land on.
+ */
+static void flush(void)
+{
+    size_t done = 0;
+    while (done < s_pending_count)
+    {
+        if (s_head < 0 || s_head_used == RECORDS_PER_PAGE)
+        {
+            if (open_page(s_pending[done].t_s) != ESP_OK)
+            {
+                atomic_fetch_add(&s_dropped, s_pending_count - done);
+                break;
+            }
+        }
+
+        size_t n = s_pending_count - done;
+        if (n > RECORDS_PER_PAGE - s_head_used)
+        {
+            n = RECORDS_PER_PAGE - s_head_used;
+        }
+        esp_err_t err = datalog_flash_write(record_offset(s_head, s_head_used), &s_pending[done], n * sizeof(record_t));
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "record write failed: %s", esp_err_to_name(err));
+            atomic_fetch_add(&s_dropped, n);
+        }
+        else
+        {
+            atomic_fetch_add(&s_written, n);
+        }
+
+        // Slots of a failed write are skipped as well; their CRC will not match
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        s_head_used += n;
+        xSemaphoreGive(s_lock);
+        done += n;
+    }
+    if (s_pending_count > 0)
+    {
+        atomic_fetch_add(&s_flushes, 1);
+    }
+    s_pending_count = 0;
+}
+
+/**
+ * Collects records from the queue and writes them a page at a time: when the
+ * head page would be filled or a page worth of records is pending.
+ * CONFIG_DATALOG_FLUSH_INTERVAL_S only bounds how long a partial page waits.
+ */
+static void writer_task(void *arg)
+{
+    const TickType_t flush_ticks = pdMS_TO_TICKS(CONFIG_DATALOG_FLUSH_INTERVAL_S * 1000);
+    TickType_t last_flush = xTaskGetTickCount();
+    record_t rec;
+
+    for (;;)
+    {
+        TickType_t elapsed = xTaskGetTickCount() - last_flush;
+        TickType_t wait = elapsed >= flush_ticks ? 0 : flush_ticks - elapsed;
+        if (xQueueReceive(s_queue, &rec, wait) == pdTRUE)
+        {
+            s_pending[s_pending_count++] = rec;
+        }
+
+        bool page_filled = s_head >= 0 && s_head_used + s_pending_count >= RECORDS_PER_PAGE;
+        bool buffer_full = s_pending_count == RECORDS_PER_PAGE;
+        if (page_filled || buffer_full || xTaskGetTickCount() - last_flush >= flush_ticks)
+        {
+            flush();
+            last_flush = xTaskGetTickCount();
+        }
+    }
+}
+
+/**
+ * Rebuild the page index from the page headers and find the append position
+ * on the newest page.
+ */
+static void mount(void)
+{
+    uint32_t max_seq = 0;
+
+    for (uint32_t page = 0; page < s_pages; page++)
+    {
+        page_header_t hdr;
+        s_index[page].seq = 0;
+        if (datalog_flash_read(page_offset(page), &hdr, sizeof(hdr)) != ESP_OK)
+        {
+            continue;
+        }
+        if (hdr.magic != DATALOG_MAGIC || hdr.seq == 0 || hdr.crc != crc16(&hdr, offsetof(page_header_t, crc)))
+        {
+            continue;
+        }
+        s_index[page].seq = hdr.seq;
+        s_index[page].first_t_s = hdr.first_t_s;
+        if (hdr.seq > max_seq)
+        {
+            max_seq = hdr.seq;
+            s_head = page;
+        }
+    }
+
+    if (s_head < 0)
+    {
+        ESP_LOGI(TAG, "empty log, %u pages of %u records", (unsigned)s_pages, (unsigned)RECORDS_PER_PAGE);
+        return;
+    }
+    s_next_seq = max_seq + 1;
+
+    // The head page is filled up to the first erased slot
+    record_t batch[DATALOG_READ_BATCH];
+    s_head_used = 0;
+    while (s_head_used < RECORDS_PER_PAGE)
+    {
+        size_t n = RECORDS_PER_PAGE - s_head_used;
+        if (n > DATALOG_READ_BATCH) n = DATALOG_READ_BATCH;
+        if (datalog_flash_read(record_offset(s_head, s_head_used), batch, n * sizeof(record_t)) != ESP_OK)
+        {
+            s_head_used = RECORDS_PER_PAGE;     // start a fresh page
+            break;
+        }
+        size_t i = 0;
+        while (i < n && !record_erased(&batch[i])) i++;
+        s_head_used += i;
+        if (i < n) break;
+    }
+
+    uint32_t used = 0;
+    for (uint32_t page = 0; page < s_pages; page++)
+    {
+        if (s_index[page].seq) used++;
+    }
+    ESP_LOGI(TAG, "mounted: %u of %u pages used, head page %u with %u records",
+             (unsigned)used, (unsigned)s_pages, (unsigned)s_head, (unsigned)s_head_used);
+}
+
+esp_err_t datalog_init(void)
+{
+    if (s_lock)
+    {
+        return ESP_OK;
+    }
+
+    size_t size = 0;
+    esp_err_t err = datalog_flash_open(&size);
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    s_pages = size / DATALOG_PAGE_SIZE;
+    if (s_pages < 2)
+    {
+        ESP_LOGE(TAG, "datalog partition too small");
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    s_index = calloc(s_pages, sizeof(page_index_t));
+    s_lock = xSemaphoreCreateMutex();
+    s_queue = xQueueCreate(CONFIG_DATALOG_QUEUE_LEN, sizeof(record_t));
+    if (!s_index || !s_lock || !s_queue)
+    {
+        ESP_LOGE(TAG, "no memory for datalog");
+        return ESP_ERR_NO_MEM;
+    }
+
+    mount();
+
+    if (xTaskCreate(writer_task, "datalog", 3072, NULL, 3, NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "failed to create writer task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void datalog_append(const sensor_data_t *data)
+{
+    if (!s_queue || data->sensor_id != 0 || data->status != SENSOR_OK)
+    {
+        return;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < DATALOG_MIN_VALID_TIME)
+    {
+        return;
+    }
+    int64_t age_ms = esp_timer_get_time() / 1000 - data->timestamp_ms;
+
+    record_t rec;
+    rec.t_s = (uint32_t)(tv.tv_sec - age_ms / 1000);
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        rec.v[ch] = sensor_value_to_fixed(ch, data->values[ch]);
+    }
+    rec.crc = crc16(&rec, offsetof(record_t, crc));
+
+    if (xQueueSend(s_queue, &rec, 0) != pdTRUE)
+    {
+        atomic_fetch_add(&s_dropped, 1);
+    }
+}
+
+/**
+ * Logical position k (0 = oldest possible page) to page number. The page
+ * after the head is the oldest once the log has wrapped; before that it is
+ * erased and sorts first with key 0, so keys are non-decreasing in k.
+ */
+static uint32_t logical_page(uint32_t k)
+{
+    return ((uint32_t)s_head + 1 + k) % s_pages;
+}
+
+size_t datalog_read(uint32_t from_s, uint32_t to_s, datalog_read_cb_t cb, void *ctx)
+{
+    if (!s_lock)
+    {
+        return 0;
+    }
+
+    // Binary search the index for the last page starting at or before from_s
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_head < 0)
+    {
+        xSemaphoreGive(s_lock);
+        return 0;
+    }
+    uint32_t lo = 0;
+    uint32_t hi = s_pages;
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const page_index_t *e = &s_index[logical_page(mid)];
+        uint32_t key = e->seq ? e->first_t_s : 0;
+        if (key <= from_s)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    uint32_t page = logical_page(lo > 0 ? lo - 1 : 0);
+    xSemaphoreGive(s_lock);
+
+    record_t batch[DATALOG_READ_BATCH];
+    datalog_entry_t entry;
+    uint32_t last_seq = 0;
+    size_t delivered = 0;
+
+    for (uint32_t visited = 0; visited < s_pages; visited++, page = (page + 1) % s_pages)
+    {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        uint32_t seq = s_index[page].seq;
+        bool is_head = (int32_t)page == s_head;
+        uint32_t used = is_head ? s_head_used : RECORDS_PER_PAGE;
+        xSemaphoreGive(s_lock);
+
+        if (seq == 0)
+        {
+            continue;       // erased or being recycled
+        }
+        if (seq < last_seq)
+        {
+            break;          // wrapped around to pages written after we started
+        }
+        last_seq = seq;
+
+        for (uint32_t slot = 0; slot < used; slot += DATALOG_READ_BATCH)
+        {
+            uint32_t n = used - slot < DATALOG_READ_BATCH ? used - slot : DATALOG_READ_BATCH;
+            if (datalog_flash_read(record_offset(page, slot), batch, n * sizeof(record_t)) != ESP_OK)
+            {
+                break;
+            }
+            // open_page() clears the index entry before erasing, so an
+            // unchanged seq means the batch was read before the writer
+            // wrapped onto this page; otherwise its records are gone
+            xSemaphoreTake(s_lock, portMAX_DELAY);
+            bool recycled = s_index[page].seq != seq;
+            xSemaphoreGive(s_lock);
+            if (recycled)
+            {
+                break;
+            }
+            for (uint32_t i = 0; i < n; i++)
+            {
+                if (!record_valid(&batch[i]) || batch[i].t_s < from_s)
+                {
+                    continue;
+                }
+                if (batch[i].t_s > to_s)
+                {
+                    return delivered;
+                }
+                entry.t_s = batch[i].t_s;
+                for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+                {
+                    entry.values[ch] = sensor_value_decode(ch, batch[i].v[ch]);
+                }
+                delivered++;
+                if (!cb(&entry, ctx))
+                {
+                    return delivered;
+                }
+            }
+        }
+
+        if (is_head)
+        {
+            break;
+        }
+    }
+    return delivered;
+}
+
+void datalog_get_stats(datalog_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    out->records_written = atomic_load(&s_written);
+    out->records_dropped = atomic_load(&s_dropped);
+    out->flushes = atomic_load(&s_flushes);
+    out->page_erases = atomic_load(&s_erases);
+    out->pages = s_pages;
+    if (!s_lock)
+    {
+        return;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t oldest_seq = UINT32_MAX;
+    for (uint32_t page = 0; page < s_pages; page++)
+    {
+        if (s_index[page].seq == 0) continue;
+        out->pages_used++;
+        if (s_index[page].seq < oldest_seq)
+        {
+            oldest_seq = s_index[page].seq;
+            out->oldest_t_s = s_index[page].first_t_s;
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+
+/**
+ * Raw access to the storage behind the log: the "datalog" partition on the
+ * target, a file on the host build. Offsets are relative to its start and
+ * erase works on whole DATALOG_PAGE_SIZE pages; erased bytes read as 0xFF.
+ */
+
+#define DATALOG_PAGE_SIZE 4096
+
+esp_err_t datalog_flash_open(size_t *size);
+esp_err_t datalog_flash_read(size_t offset, void *dst, size_t len);
+esp_err_t datalog_flash_write(size_t offset, const void *src, size_t len);
+esp_err_t datalog_flash_erase_page(size_t offset);
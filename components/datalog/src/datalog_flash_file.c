@@ -0,0 +1,85 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "datalog_flash.h"
+
+static const char *TAG = "datalog";
+
+/*
+ * Host build: the partition is a file in the working directory. Writes AND
+ * the new data into the old bytes like NOR flash does, so the log sees the
+ * same behaviour as on the device.
+ */
+
+static int s_fd = -1;
+
+esp_err_t datalog_flash_open(size_t *size)
+{
+    const size_t file_size = (size_t)CONFIG_DATALOG_HOST_SIZE_KB * 1024;
+
+    s_fd = open(CONFIG_DATALOG_HOST_FILE, O_RDWR | O_CREAT, 0644);
+    if (s_fd < 0)
+    {
+        ESP_LOGE(TAG, "cannot open %s: %s", CONFIG_DATALOG_HOST_FILE, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    off_t current = lseek(s_fd, 0, SEEK_END);
+    if (current < (off_t)file_size)
+    {
+        // Extend with erased pages
+        uint8_t page[DATALOG_PAGE_SIZE];
+        memset(page, 0xFF, sizeof(page));
+        for (size_t off = (size_t)current - (size_t)current % DATALOG_PAGE_SIZE; off < file_size; off += DATALOG_PAGE_SIZE)
+        {
+            if (pwrite(s_fd, page, sizeof(page), off) != (ssize_t)sizeof(page))
+            {
+                return ESP_FAIL;
+            }
+        }
+    }
+    *size = file_size;
+    return ESP_OK;
+}
+
+esp_err_t datalog_flash_read(size_t offset, void *dst, size_t len)
+{
+    return pread(s_fd, dst, len, offset) == (ssize_t)len ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t datalog_flash_write(size_t offset, const void *src, size_t len)
+{
+    uint8_t buf[256];
+    const uint8_t *in = src;
+
+    while (len > 0)
+    {
+        size_t n = len < sizeof(buf) ? len : sizeof(buf);
+        if (pread(s_fd, buf, n, offset) != (ssize_t)n)
+        {
+            return ESP_FAIL;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            buf[i] &= in[i];
+        }
+        if (pwrite(s_fd, buf, n, offset) != (ssize_t)n)
+        {
+            return ESP_FAIL;
+        }
+        in += n;
+        offset += n;
+        len -= n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t datalog_flash_erase_page(size_t offset)
+{
+    uint8_t page[DATALOG_PAGE_SIZE];
+    memset(page, 0xFF, sizeof(page));
+    return pwrite(s_fd, page, sizeof(page), offset) == (ssize_t)sizeof(page) ? ESP_OK : ESP_FAIL;
+}
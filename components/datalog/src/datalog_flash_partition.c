@@ -0,0 +1,34 @@
+#include "esp_partition.h"
+#include "esp_log.h"
+#include "datalog_flash.h"
+
+static const char *TAG = "datalog";
+
+static const esp_partition_t *s_partition;
+
+esp_err_t datalog_flash_open(size_t *size)
+{
+    s_partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "datalog");
+    if (!s_partition)
+    {
+        ESP_LOGE(TAG, "no \"datalog\" partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+    *size = s_partition->size;
+    return ESP_OK;
+}
+
+esp_err_t datalog_flash_read(size_t offset, void *dst, size_t len)
+{
+    return esp_partition_read(s_partition, offset, dst, len);
+}
+
+esp_err_t datalog_flash_write(size_t offset, const void *src, size_t len)
+{
+    return esp_partition_write(s_partition, offset, src, len);
+}
+
+esp_err_t datalog_flash_erase_page(size_t offset)
+{
+    return esp_partition_erase_range(s_partition, offset, DATALOG_PAGE_SIZE);
+}
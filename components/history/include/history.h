@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sensor_events.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Resolution tiers of the in-RAM history. Every sensor has its own set of
+ * tiers, each a fixed-size ring;
+ * closing a bucket in one tier folds it into the next, so every tier is
+ * maintained in O(1) per sample and reads never aggregate.
+ */
+typedef enum
+{
+    HISTORY_TIER_SECOND = 0,   // raw 1 s samples
+    HISTORY_TIER_MINUTE,       // 1 min min/mean/max
+    HISTORY_TIER_HOUR,         // 1 h min/mean/max
+    HISTORY_TIER_COUNT
+} history_tier_t;
+
+/**
+ * One history entry as handed to readers. For HISTORY_TIER_SECOND min, mean
+ * and max are the same sample and count is 1.
+ */
+typedef struct
+{
+    uint32_t t_s;                           // bucket start, seconds since boot
+    uint16_t count;                         // samples in the bucket
+    uint8_t sensor_id;
+    float min[SENSOR_CHANNEL_COUNT];
+    float mean[SENSOR_CHANNEL_COUNT];
+    float max[SENSOR_CHANNEL_COUNT];
+    float nowcast_pm2_5;                    // NowCast (µg/m³), mean over the bucket; NAN if none
+    float nowcast_pm10;
+} history_entry_t;
+
+/**
+ * Called for every entry by history_read(), oldest first.
+ * Return false to stop the iteration.
+ */
+typedef bool (*history_read_cb_t)(const history_entry_t *entry, void *ctx);
+
+/**
+ * @brief Allocate the tier rings within CONFIG_HISTORY_MEMORY_BUDGET_KB.
+ *
+ * The budget is split evenly between the sensors. Tiers are shrunk proportionally if the configured lengths do not fit the
+ * budget or the allocation fails. Uses PSRAM when available.
+ */
+esp_err_t history_init(void);
+
+/**
+ * @brief Add one reading to the tiers of its sensor_id, with the NowCasts of
+ * the statistics stage (derived may be NULL). O(1); only successful readings
+ * should be added.
+ */
+void history_append(const sensor_data_t *data, const sensor_derived_t *derived);
+
+/**
+ * @brief Iterate a tier of one sensor from the oldest entry with t_s >= since_s.
+ *
+ * Entries are copied out in small batches so the writer is never held off
+ * for the duration of a network send inside the callback.
+ *
+ * @return Number of entries passed to the callback.
+ */
+size_t history_read(int sensor, history_tier_t tier, uint32_t since_s,
+                    history_read_cb_t cb, void *ctx);
+
+/**
+ * @brief Number of entries a tier of one sensor currently holds.
+ */
+size_t history_count(int sensor, history_tier_t tier);
+
+/**
+ * @brief Bucket width of a tier in seconds.
+ */
+uint32_t history_interval_s(history_tier_t tier);
+
+/**
+ * @brief Convert a history timestamp (seconds since boot) to Unix time in ms.
+ */
+int64_t history_to_unix_ms(uint32_t t_s);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,432 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "history.h"
+
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_heap_caps.h"
+#endif
+
+static const char *TAG = "history";
+
+#define HISTORY_READ_BATCH 16
+// NowCasts are stored like the mc_2p5 and mc_10p0 channels
+#define HISTORY_NOWCAST_COUNT 2
+#define HISTORY_NO_VALUE 0xFFFF
+
+static const int s_nowcast_channel[HISTORY_NOWCAST_COUNT] = { SENSOR_CHANNEL_PM2_5, SENSOR_CHANNEL_PM10 };
+
+// Entries are stored in the fixed-point form of sensor_value_encode()
+typedef struct
+{
+    uint32_t t_s;
+    uint16_t v[SENSOR_CHANNEL_COUNT];
+    uint16_t nowcast[HISTORY_NOWCAST_COUNT];    // HISTORY_NO_VALUE if none
+} history_raw_t;
+
+typedef struct
+{
+    uint32_t t_s;
+    uint16_t count;
+    uint16_t min[SENSOR_CHANNEL_COUNT];
+    uint16_t mean[SENSOR_CHANNEL_COUNT];
+    uint16_t max[SENSOR_CHANNEL_COUNT];
+    uint16_t nowcast[HISTORY_NOWCAST_COUNT];
+} history_rollup_t;
+
+typedef struct
+{
+    uint8_t *entries;
+    size_t entry_size;
+    size_t capacity;
+    uint64_t written;       // entries ever pushed; the newest is at (written - 1) % capacity
+} history_ring_t;
+
+// Open (not yet closed) bucket of a rollup tier
+typedef struct
+{
+    bool open;
+    uint32_t t_s;
+    uint32_t count;
+    float min[SENSOR_CHANNEL_COUNT];
+    float max[SENSOR_CHANNEL_COUNT];
+    float sum[SENSOR_CHANNEL_COUNT];
+    float nowcast_sum[HISTORY_NOWCAST_COUNT];
+    uint32_t nowcast_count[HISTORY_NOWCAST_COUNT];   // samples that had a NowCast
+} history_acc_t;
+
+static const uint32_t s_interval_s[HISTORY_TIER_COUNT] = { 1, 60, 3600 };
+
+static history_ring_t s_rings[SENSOR_COUNT][HISTORY_TIER_COUNT];
+static history_acc_t s_acc[SENSOR_COUNT][HISTORY_TIER_COUNT];
+static SemaphoreHandle_t s_lock;
+
+static void *ring_slot(history_ring_t *ring, uint64_t index)
+{
+    return ring->entries + (size_t)(index % ring->capacity) * ring->entry_size;
+}
+
+static uint64_t ring_oldest(const history_ring_t *ring)
+{
+    return ring->written > ring->capacity ? ring->written - ring->capacity : 0;
+}
+
+static void *ring_push(history_ring_t *ring)
+{
+    void *slot = ring_slot(ring, ring->written);
+    ring->written++;
+    return slot;
+}
+
+static uint16_t encode_nowcast(int i, float value)
+{
+    return isnan(value) ? HISTORY_NO_VALUE : sensor_value_encode(s_nowcast_channel[i], value);
+}
+
+static float decode_nowcast(int i, uint16_t fixed)
+{
+    return fixed == HISTORY_NO_VALUE ? NAN : sensor_value_decode(s_nowcast_channel[i], fixed);
+}
+
+/**
+ * Fold one bucket (or sample) into the open bucket of @p tier. When the
+ * bucket boundary is crossed the open bucket is closed, stored, and cascaded
+ * into the next tier. NowCasts are averaged over the samples that had one.
+ */
+static void fold(int sensor, history_tier_t tier, uint32_t t_s, const float *min,
+                 const float *mean, const float *max, uint32_t count,
+                 const float *nowcast, const uint32_t *nowcast_count)
+{
+    history_acc_t *acc = &s_acc[sensor][tier];
+    uint32_t bucket = t_s - t_s % s_interval_s[tier];
+
+    if (acc->open && acc->t_s != bucket)
+    {
+        float closed_mean[SENSOR_CHANNEL_COUNT];
+        history_rollup_t *r = ring_push(&s_rings[sensor][tier]);
+        r->t_s = acc->t_s;
+        r->count = acc->count > UINT16_MAX ? UINT16_MAX : (uint16_t)acc->count;
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+        {
+            closed_mean[ch] = acc->sum[ch] / acc->count;
+            r->min[ch] = sensor_value_encode(ch, acc->min[ch]);
+            r->mean[ch] = sensor_value_encode(ch, closed_mean[ch]);
+            r->max[ch] = sensor_value_encode(ch, acc->max[ch]);
+        }
+        float closed_nowcast[HISTORY_NOWCAST_COUNT];
+        for (int i = 0; i < HISTORY_NOWCAST_COUNT; i++)
+        {
+            closed_nowcast[i] = acc->nowcast_count[i] ? acc->nowcast_sum[i] / acc->nowcast_count[i] : NAN;
+            r->nowcast[i] = encode_nowcast(i, closed_nowcast[i]);
+        }
+        acc->open = false;
+
+        if (tier + 1 < HISTORY_TIER_COUNT)
+        {
+            fold(sensor, tier + 1, acc->t_s, acc->min, closed_mean, acc->max, acc->count,
+                 closed_nowcast, acc->nowcast_count);
+        }
+    }
+
+    if (!acc->open)
+    {
+        acc->open = true;
+        acc->t_s = bucket;
+        acc->count = 0;
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+        {
+            acc->min[ch] = min[ch];
+            acc->max[ch] = max[ch];
+            acc->sum[ch] = 0.0f;
+        }
+        for (int i = 0; i < HISTORY_NOWCAST_COUNT; i++)
+        {
+            acc->nowcast_sum[i] = 0.0f;
+            acc->nowcast_count[i] = 0;
+        }
+    }
+
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        if (min[ch] < acc->min[ch]) acc->min[ch] = min[ch];
+        if (max[ch] > acc->max[ch]) acc->max[ch] = max[ch];
+        acc->sum[ch] += mean[ch] * count;
+    }
+    acc->count += count;
+    for (int i = 0; i < HISTORY_NOWCAST_COUNT; i++)
+    {
+        if (nowcast_count[i])
+        {
+            acc->nowcast_sum[i] += nowcast[i] * nowcast_count[i];
+            acc->nowcast_count[i] += nowcast_count[i];
+        }
+    }
+}
+
+static void *history_alloc(size_t size)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    return malloc(size);
+#else
+    void *p = NULL;
+#if CONFIG_SPIRAM
+    p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+#endif
+    if (!p)
+    {
+        p = heap_caps_malloc(size, MALLOC_CAP_8BIT);
+    }
+    return p;
+#endif
+}
+
+esp_err_t history_init(void)
+{
+    if (s_lock)
+    {
+        return ESP_OK;
+    }
+
+    size_t capacity[HISTORY_TIER_COUNT] = {
+        CONFIG_HISTORY_SECONDS, CONFIG_HISTORY_MINUTES, CONFIG_HISTORY_HOURS
+    };
+    const size_t entry_size[HISTORY_TIER_COUNT] = {
+        sizeof(history_raw_t), sizeof(history_rollup_t), sizeof(history_rollup_t)
+    };
+    // Every sensor gets the same share of the budget
+    const size_t budget = (size_t)CONFIG_HISTORY_MEMORY_BUDGET_KB * 1024 / SENSOR_COUNT;
+
+    for (;;)
+    {
+        size_t total = 0;
+        for (int t = 0; t < HISTORY_TIER_COUNT; t++)
+        {
+            total += capacity[t] * entry_size[t];
+        }
+        if (total > budget)
+        {
+            // Shrink every tier by the same factor to fit the budget
+            for (int t = 0; t < HISTORY_TIER_COUNT; t++)
+            {
+                capacity[t] = (size_t)((uint64_t)capacity[t] * budget / total);
+                if (capacity[t] < 1) capacity[t] = 1;
+            }
+            ESP_LOGW(TAG, "configured history needs %u KB per sensor, %u KB budget for %d sensor(s), shrinking tiers",
+                     (unsigned)(total / 1024), (unsigned)CONFIG_HISTORY_MEMORY_BUDGET_KB, SENSOR_COUNT);
+            continue;
+        }
+
+        uint8_t *block = history_alloc(total * SENSOR_COUNT);
+        if (block)
+        {
+            for (int s = 0; s < SENSOR_COUNT; s++)
+            {
+                for (int t = 0; t < HISTORY_TIER_COUNT; t++)
+                {
+                    s_rings[s][t].entries = block;
+                    s_rings[s][t].entry_size = entry_size[t];
+                    s_rings[s][t].capacity = capacity[t];
+                    s_rings[s][t].written = 0;
+                    block += capacity[t] * entry_size[t];
+                }
+            }
+            break;
+        }
+
+        if (capacity[HISTORY_TIER_SECOND] <= 60)
+        {
+            ESP_LOGE(TAG, "no memory for history");
+            return ESP_ERR_NO_MEM;
+        }
+        ESP_LOGW(TAG, "history allocation of %u bytes failed, halving",
+                 (unsigned)(total * SENSOR_COUNT));
+        for (int t = 0; t < HISTORY_TIER_COUNT; t++)
+        {
+            capacity[t] = capacity[t] > 1 ? capacity[t] / 2 : 1;
+        }
+    }
+
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "history: %u s, %u min, %u h per sensor, %d sensor(s)",
+             (unsigned)s_rings[0][HISTORY_TIER_SECOND].capacity,
+             (unsigned)s_rings[0][HISTORY_TIER_MINUTE].capacity,
+             (unsigned)s_rings[0][HISTORY_TIER_HOUR].capacity, SENSOR_COUNT);
+    return ESP_OK;
+}
+
+void history_append(const sensor_data_t *data, const sensor_derived_t *derived)
+{
+    if (!s_lock || data->sensor_id >= SENSOR_COUNT)
+    {
+        return;
+    }
+
+    int sensor = data->sensor_id;
+    uint32_t t_s = (uint32_t)(data->timestamp_ms / 1000);
+    float values[SENSOR_CHANNEL_COUNT];
+    float nowcast[HISTORY_NOWCAST_COUNT] = { NAN, NAN };
+    uint32_t nowcast_count[HISTORY_NOWCAST_COUNT];
+
+    if (derived)
+    {
+        nowcast[0] = derived->nowcast_pm2_5;
+        nowcast[1] = derived->nowcast_pm10;
+    }
+    for (int i = 0; i < HISTORY_NOWCAST_COUNT; i++)
+    {
+        nowcast_count[i] = !isnan(nowcast[i]);
+    }
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        values[ch] = sensor_value_to_float(ch, data->values[ch]);
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    history_raw_t *raw = ring_push(&s_rings[sensor][HISTORY_TIER_SECOND]);
+    raw->t_s = t_s;
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        raw->v[ch] = sensor_value_to_fixed(ch, data->values[ch]);
+    }
+    for (int i = 0; i < HISTORY_NOWCAST_COUNT; i++)
+    {
+        raw->nowcast[i] = encode_nowcast(i, nowcast[i]);
+    }
+    fold(sensor, HISTORY_TIER_MINUTE, t_s, values, values, values, 1,
+         nowcast, nowcast_count);
+    xSemaphoreGive(s_lock);
+}
+
+/**
+ * Index of the oldest entry with t_s >= since_s. Entries are in time order,
+ * so this is a binary search over the live part of the ring.
+ */
+static uint64_t ring_find(history_ring_t *ring, uint32_t since_s)
+{
+    uint64_t lo = ring_oldest(ring);
+    uint64_t hi = ring->written;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        uint32_t t_s = *(const uint32_t *)ring_slot(ring, mid);
+        if (t_s < since_s)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void decode_entry(history_tier_t tier, const void *src, history_entry_t *out)
+{
+    if (tier == HISTORY_TIER_SECOND)
+    {
+        const history_raw_t *raw = src;
+        out->t_s = raw->t_s;
+        out->count = 1;
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+        {
+            out->min[ch] = out->mean[ch] = out->max[ch] = sensor_value_decode(ch, raw->v[ch]);
+        }
+        out->nowcast_pm2_5 = decode_nowcast(0, raw->nowcast[0]);
+        out->nowcast_pm10 = decode_nowcast(1, raw->nowcast[1]);
+    }
+    else
+    {
+        const history_rollup_t *r = src;
+        out->t_s = r->t_s;
+        out->count = r->count;
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+        {
+            out->min[ch] = sensor_value_decode(ch, r->min[ch]);
+            out->mean[ch] = sensor_value_decode(ch, r->mean[ch]);
+            out->max[ch] = sensor_value_decode(ch, r->max[ch]);
+        }
+        out->nowcast_pm2_5 = decode_nowcast(0, r->nowcast[0]);
+        out->nowcast_pm10 = decode_nowcast(1, r->nowcast[1]);
+    }
+}
+
+size_t history_read(int sensor, history_tier_t tier, uint32_t since_s,
+                    history_read_cb_t cb, void *ctx)
+{
+    if (!s_lock || sensor < 0 || sensor >= SENSOR_COUNT || tier >= HISTORY_TIER_COUNT)
+    {
+        return 0;
+    }
+
+    history_ring_t *ring = &s_rings[sensor][tier];
+    uint8_t batch[HISTORY_READ_BATCH * sizeof(history_rollup_t)];
+    history_entry_t entry;
+    size_t delivered = 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint64_t pos = ring_find(ring, since_s);
+    uint64_t end = ring->written;
+    xSemaphoreGive(s_lock);
+
+    while (pos < end)
+    {
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        // Entries overwritten since the last batch are gone; skip ahead
+        if (pos < ring_oldest(ring))
+        {
+            pos = ring_oldest(ring);
+        }
+        size_t n = 0;
+        while (n < HISTORY_READ_BATCH && pos + n < end)
+        {
+            memcpy(batch + n * ring->entry_size, ring_slot(ring, pos + n), ring->entry_size);
+            n++;
+        }
+        xSemaphoreGive(s_lock);
+
+        for (size_t i = 0; i < n; i++)
+        {
+            decode_entry(tier, batch + i * ring->entry_size, &entry);
+            entry.sensor_id = (uint8_t)sensor;
+            delivered++;
+            if (!cb(&entry, ctx))
+            {
+                return delivered;
+            }
+        }
+        pos += n;
+    }
+    return delivered;
+}
+
+size_t history_count(int sensor, history_tier_t tier)
+{
+    if (!s_lock || sensor < 0 || sensor >= SENSOR_COUNT || tier >= HISTORY_TIER_COUNT)
+    {
+        return 0;
+    }
+    history_ring_t *ring = &s_rings[sensor][tier];
+    return (size_t)(ring->written - ring_oldest(ring));
+}
+
+uint32_t history_interval_s(history_tier_t tier)
+{
+    return tier < HISTORY_TIER_COUNT ? s_interval_s[tier] : 0;
+}
+
+int64_t history_to_unix_ms(uint32_t t_s)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t unix_now_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    int64_t uptime_now_ms = esp_timer_get_time() / 1000;
+    return (int64_t)t_s * 1000 + (unix_now_ms - uptime_now_ms);
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "sensor_events.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Single-producer, multi-consumer channel for sensor readings. Each entry is
+ * a sensor_sample_t holding the readings of all sensors for one tick.
+ *
+ * The sensor task publishes into a ring of CONFIG_SENSOR_BUS_SLOTS slots and
+ * never blocks or waits for a subscriber. Each subscriber keeps its own read
+ * position and reads slots in place; a subscriber that falls more than a ring
+ * behind loses the oldest readings, which are counted as its overflows.
+ * The newest reading is also kept in a seqlock cell for pollers.
+ */
+typedef struct sensor_bus_sub sensor_bus_sub_t;
+
+typedef struct
+{
+    uint32_t received;      // readings consumed
+    uint32_t overflows;     // readings overwritten before they were consumed
+} sensor_bus_stats_t;
+
+/**
+ * @brief Subscribe the calling task, starting at the next published reading.
+ *
+ * The task is woken with a task notification on every publish; see
+ * sensor_bus_wait().
+ *
+ * @return ESP_OK, or ESP_ERR_NO_MEM when CONFIG_SENSOR_BUS_MAX_SUBSCRIBERS are taken.
+ */
+esp_err_t sensor_bus_subscribe(sensor_bus_sub_t **out);
+
+void sensor_bus_unsubscribe(sensor_bus_sub_t *sub);
+
+/**
+ * @brief Publish a reading. Producer only; wait-free.
+ */
+void sensor_bus_publish(const sensor_sample_t *sample);
+
+/**
+ * @brief Block until a reading is available or the timeout expires.
+ *
+ * @return true if sensor_bus_read_begin() has something to return.
+ */
+bool sensor_bus_wait(sensor_bus_sub_t *sub, TickType_t timeout);
+
+/**
+ * @brief Oldest unconsumed reading, in place in the ring, or NULL.
+ *
+ * The slot may be overwritten while it is being read if the subscriber is a
+ * full ring behind; sensor_bus_read_end() says whether that happened.
+ */
+const sensor_sample_t *sensor_bus_read_begin(sensor_bus_sub_t *sub);
+
+/**
+ * @brief Consume the reading returned by sensor_bus_read_begin().
+ *
+ * @return false if the slot was overwritten during the read, in which case
+ *         whatever was derived from it must be discarded.
+ */
+bool sensor_bus_read_end(sensor_bus_sub_t *sub);
+
+void sensor_bus_get_stats(const sensor_bus_sub_t *sub, sensor_bus_stats_t *out);
+
+/**
+ * @brief Copy of the newest reading. Lock-free; retries only while the
+ * producer is writing it.
+ *
+ * @return false if nothing was published yet.
+ */
+bool sensor_bus_get_latest(sensor_sample_t *out);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+/**
+ * The measurement channels, listed once. Everything that names a channel
+ * expands these tables: the fields of sensor_data_t, the fixed-point
+ * scales, the JSON, CSV and binary serializers, the /metrics names and,
+ * through tools/gen_channels.py at build time, channels.js for the page.
+ * Adding a channel is one row here.
+ *
+ * X(NAME, field, key, group, size, label, unit, decimals, raw_decimals)
+ *   NAME          SENSOR_CHANNEL_<NAME>; the position of the row is the wire
+ *                 index (values[n], bit n of a channel mask)
+ *   field         member of sensor_data_t
+ *   key           JSON key, CSV column and JS property
+ *   group         SENSOR_GROUP_<group>: metric family and chart of the page
+ *   size          size label of the metric, "" for none
+ *   label, unit   shown in the page's table
+ *   decimals      stored fixed point has a resolution of 10^-decimals
+ *   raw_decimals  the SPS30 uint16 output format has 10^-raw_decimals
+ *                 (CONFIG_SENSOR_FIXED_POINT)
+ *
+ * tools/gen_channels.py parses this file: one row per line, string
+ * arguments without commas.
+ */
+#define SENSOR_CHANNELS(X) \
+    X(PM1_0,        pm1_0,        "mc_1p0",                MASS,   "1.0", "Mass Concentration PM1.0",   "µg/m³", 1, 0) \
+    X(PM2_5,        pm2_5,        "mc_2p5",                MASS,   "2.5", "Mass Concentration PM2.5",   "µg/m³", 1, 0) \
+    X(PM4_0,        pm4_0,        "mc_4p0",                MASS,   "4.0", "Mass Concentration PM4.0",   "µg/m³", 1, 0) \
+    X(PM10,         pm10,         "mc_10p0",               MASS,   "10",  "Mass Concentration PM10.0",  "µg/m³", 1, 0) \
+    X(NC0_5,        nc0_5,        "nc_0p5",                NUMBER, "0.5", "Number Concentration PM0.5", "#/cm³", 1, 0) \
+    X(NC1_0,        nc1_0,        "nc_1p0",                NUMBER, "1.0", "Number Concentration PM1.0", "#/cm³", 1, 0) \
+    X(NC2_5,        nc2_5,        "nc_2p5",                NUMBER, "2.5", "Number Concentration PM2.5", "#/cm³", 1, 0) \
+    X(NC4_0,        nc4_0,        "nc_4p0",                NUMBER, "4.0", "Number Concentration PM4.0", "#/cm³", 1, 0) \
+    X(NC10,         nc10,         "nc_10p0",               NUMBER, "10",  "Number Concentration PM10.0", "#/cm³", 1, 0) \
+    X(TYPICAL_SIZE, typical_size, "typical_particle_size", SIZE,   "",    "Typical Particle Size",      "µm",    3, 3)
+
+/**
+ * G(NAME, metric, metric_unit, unit, help): one per group of channels.
+ */
+#define SENSOR_CHANNEL_GROUPS(G) \
+    G(MASS,   "sps30_mass_concentration_micrograms_per_cubic_meter", "micrograms_per_cubic_meter", "µg/m³", "Mass concentration of particles up to 1.0 / 2.5 / 4.0 / 10 µm as given by the size label.") \
+    G(NUMBER, "sps30_number_concentration_per_cubic_centimeter",     "per_cubic_centimeter",       "#/cm³", "Number concentration of particles up to 0.5 / 1.0 / 2.5 / 4.0 / 10 µm as given by the size label.") \
+    G(SIZE,   "sps30_typical_particle_size_micrometers",             "micrometers",                "µm",    "Typical size of the particles.")
+
+// Wire index of each channel
+typedef enum
+{
+#define SENSOR_CHANNEL_INDEX(NAME, ...) SENSOR_CHANNEL_##NAME,
+    SENSOR_CHANNELS(SENSOR_CHANNEL_INDEX)
+#undef SENSOR_CHANNEL_INDEX
+    SENSOR_CHANNEL_COUNT
+} sensor_channel_t;
+
+typedef enum
+{
+#define SENSOR_GROUP_INDEX(NAME, ...) SENSOR_GROUP_##NAME,
+    SENSOR_CHANNEL_GROUPS(SENSOR_GROUP_INDEX)
+#undef SENSOR_GROUP_INDEX
+    SENSOR_GROUP_COUNT
+} sensor_channel_group_t;
+
+// 10^d for the decimals columns, a compile-time constant
+#define SENSOR_POW10(d) ((d) == 0 ? 1u : (d) == 1 ? 10u : (d) == 2 ? 100u : (d) == 3 ? 1000u : 10000u)
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "esp_event.h"
+#include "sdkconfig.h"
+#include "sensor_channels.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Event base declarations
+ESP_EVENT_DECLARE_BASE(SENSOR_EVENT);
+ESP_EVENT_DECLARE_BASE(COMMAND_EVENT);
+
+// Sensor event IDs
+typedef enum 
+{
+    SENSOR_DATA_READY,      // Not posted; readings are published on the sensor bus (sensor_bus.h)
+    SENSOR_STATUS_CHANGE,   // Sensor status changed
+    SENSOR_ERROR,           // Sensor error occurred
+    SENSOR_COMMAND_STATUS   // A submitted command changed state (sensor_command_status_t)
+} sensor_event_id_t;
+
+// Command event IDs, also the commands of sensor_command_submit()
+typedef enum 
+{
+    CMD_FAN_CLEAN,         // Trigger fan cleaning
+    CMD_SLEEP,             // Enter sleep mode
+    CMD_WAKE,              // Exit sleep mode
+    CMD_COUNT
+} command_event_id_t;
+
+// Life cycle of a submitted command
+typedef enum 
+{
+    SENSOR_COMMAND_QUEUED,
+    SENSOR_COMMAND_RUNNING,    // fan cleaning: started, completes by timer
+    SENSOR_COMMAND_DONE,
+    SENSOR_COMMAND_FAILED
+} sensor_command_state_t;
+
+// Identifies a submitted command; never 0
+typedef uint32_t sensor_command_handle_t;
+
+// Posted with SENSOR_COMMAND_STATUS on every state change
+typedef struct 
+{
+    sensor_command_handle_t handle;
+    command_event_id_t command;
+    sensor_command_state_t state;
+    esp_err_t error;           // SENSOR_COMMAND_FAILED only
+} sensor_command_status_t;
+
+// Sensor status enumeration
+typedef enum 
+{
+    SENSOR_OK = 0,
+    SENSOR_COMM_ERROR = 1,
+    SENSOR_NOT_READY = 2,
+    SENSOR_FAN_CLEANING = 3,
+    SENSOR_SLEEPING = 4
+} sensor_status_t;
+
+// Number of SPS30 units, each on its own UART
+#define SENSOR_COUNT CONFIG_SPS30_COUNT
+
+#if CONFIG_SENSOR_FIXED_POINT
+// SPS30 uint16 output format: µg/m³ and #/cm³ as integers, typical size in nm
+typedef uint16_t sensor_value_t;
+#else
+typedef float sensor_value_t;
+#endif
+
+// Reading of one sensor
+typedef struct 
+{
+    union
+    {
+        struct
+        {
+            // One member per row of SENSOR_CHANNELS, e.g. pm2_5 (µg/m³) and
+            // typical_size (µm; nm when fixed point)
+#define SENSOR_CHANNEL_FIELD(NAME, field, ...) sensor_value_t field;
+            SENSOR_CHANNELS(SENSOR_CHANNEL_FIELD)
+#undef SENSOR_CHANNEL_FIELD
+        };
+        sensor_value_t values[SENSOR_CHANNEL_COUNT];  // Same channels, in wire order
+    };
+    int64_t timestamp_ms;     // Timestamp when read (esp_timer_get_time() / 1000)
+    sensor_status_t status;   // Current sensor status
+    uint8_t sensor_id;        // Index of the sensor, 0..SENSOR_COUNT-1
+} sensor_data_t;
+
+// Rolling windows of the statistics stage (sensor_stats.h)
+typedef enum
+{
+    SENSOR_WINDOW_1MIN = 0,
+    SENSOR_WINDOW_15MIN,
+    SENSOR_WINDOW_1H,
+    SENSOR_WINDOW_24H,
+    SENSOR_WINDOW_COUNT
+} sensor_window_t;
+
+/**
+ * What the statistics stage derived from one sensor's readings up to this
+ * tick. Values without data yet are NAN, AQIs -1.
+ */
+typedef struct
+{
+    float mean[SENSOR_WINDOW_COUNT][SENSOR_CHANNEL_COUNT];  // rolling means, wire order
+    float ewma[SENSOR_CHANNEL_COUNT];
+    float nowcast_pm2_5;      // US EPA NowCast of mc_2p5 (µg/m³)
+    float nowcast_pm10;       // US EPA NowCast of mc_10p0 (µg/m³)
+    int16_t aqi_pm2_5;        // US AQI of the NowCasts
+    int16_t aqi_pm10;
+} sensor_derived_t;
+
+/**
+ * One tick of the sensor task: the readings of all sensors gathered for the
+ * same second. A sensor that did not answer in time carries a status other
+ * than SENSOR_OK and stale values.
+ */
+typedef struct
+{
+    int64_t timestamp_ms;     // When the tick started (esp_timer_get_time() / 1000)
+    uint8_t count;            // Always SENSOR_COUNT
+    sensor_data_t sensors[SENSOR_COUNT];
+    sensor_derived_t derived[SENSOR_COUNT];   // of sensors[i], by the statistics stage
+} sensor_sample_t;
+
+/**
+ * Fixed-point form used wherever readings are stored (history, data log):
+ * mass and number concentrations in 0.1 units, typical particle size in nm.
+ * Values are clamped to 0..65535.
+ */
+uint16_t sensor_value_encode(int channel, float value);
+float sensor_value_decode(int channel, uint16_t fixed);
+
+/**
+ * Conversions of a sensor_value_t. With CONFIG_SENSOR_FIXED_POINT the stored
+ * form is an integer scaling and formatting uses no floating point.
+ */
+float sensor_value_to_float(int channel, sensor_value_t value);
+sensor_value_t sensor_value_from_float(int channel, float value);
+uint16_t sensor_value_to_fixed(int channel, sensor_value_t value);   // as sensor_value_encode()
+
+/**
+ * @brief Format a value as a JSON number in the channel's unit (µm for the
+ *        typical particle size): %g for floats, digits only for fixed point.
+ *
+ * @return Length written, 0 if it did not fit.
+ */
+size_t sensor_value_format(char *out, size_t cap, int channel, sensor_value_t value);
+
+// Sampling profiles, switchable at runtime (sensor_task_set_profile)
+typedef enum
+{
+    SENSOR_PROFILE_LIVE = 0,      // every reading the sensor takes, 1 Hz
+    SENSOR_PROFILE_AVERAGED,      // mean of period_s readings, every period_s
+    SENSOR_PROFILE_DUTY_CYCLE,    // sleep between measuring windows of awake_s
+    SENSOR_PROFILE_COUNT
+} sensor_profile_mode_t;
+
+// Limits of a profile, as the Kconfig ranges
+#define SENSOR_PROFILE_MAX_PERIOD_S 86400
+#define SENSOR_PROFILE_MAX_AWAKE_S  3600
+
+typedef struct
+{
+    sensor_profile_mode_t mode;
+    uint32_t period_s;        // publish interval; 1 for SENSOR_PROFILE_LIVE
+    uint32_t awake_s;         // DUTY_CYCLE only: measuring time per period, warm-up included
+} sensor_profile_t;
+
+// Sampling statistics of one sensor
+typedef struct
+{
+    uint32_t samples;         // new readings taken from the sensor
+    uint32_t missed;          // readings the sensor produced that were never picked up
+    uint32_t duplicates;      // readings reported new within half a second of the previous one
+    uint32_t not_ready;       // polls answered without new data
+    uint32_t jitter_us_last;  // pick-up time against the sensor's 1 s cadence
+    uint32_t jitter_us_avg;
+    uint32_t jitter_us_max;
+    sensor_status_t status;   // current status, also while nothing is published
+} sensor_sched_stats_t;
+
+typedef struct
+{
+    sensor_profile_t profile;
+    uint32_t published;               // samples put on the sensor bus
+    uint32_t publish_jitter_us_avg;   // publish interval against profile.period_s
+    uint32_t publish_jitter_us_max;
+    sensor_sched_stats_t sensors[SENSOR_COUNT];
+} sensor_sched_report_t;
+
+// Command data structures
+typedef struct 
+{
+    bool enabled;  // true = sleep, false = wake
+} sleep_command_t;
+
+// Initialize the event loop and the SPS30 UART counters; call once at startup
+esp_err_t sensor_events_init(void);
+
+/**
+ * Queue a command for the sensor task; never blocks
+ * Commands run one at a time between sensor reads. Progress is posted as
+ * SENSOR_COMMAND_STATUS events. Posting CMD_FAN_CLEAN, CMD_SLEEP or CMD_WAKE
+ * to COMMAND_EVENT submits the same way without a handle.
+ * Returns ESP_ERR_INVALID_ARG for an unknown command, ESP_ERR_NO_MEM when
+ * the queue is full and ESP_ERR_INVALID_STATE before sensor_task_start()
+ */
+esp_err_t sensor_command_submit(command_event_id_t command, sensor_command_handle_t *out_handle);
+
+/**
+ * Last known state of one of the recently submitted commands
+ * Returns ESP_ERR_NOT_FOUND once the command has aged out
+ */
+esp_err_t sensor_command_get_status(sensor_command_handle_t handle, sensor_command_status_t *out);
+
+/**
+ * Name of a command or command state as used on the WebSocket
+ */
+const char *sensor_command_name(command_event_id_t command);
+const char *sensor_command_state_name(sensor_command_state_t state);
+
+/**
+ * Start the sensor reading tasks
+ * Starts one reader task per SPS30, locked to the sensor's own 1 s
+ * measurement clock, and a task that publishes their readings as one
+ * sensor_sample_t per profile period
+ */
+esp_err_t sensor_task_start(void);
+
+/**
+ * Switch the sampling profile; takes effect within one sensor reading
+ * Returns ESP_ERR_INVALID_ARG for an unknown mode or out-of-range periods and
+ * ESP_ERR_INVALID_STATE before sensor_task_start()
+ */
+esp_err_t sensor_task_set_profile(const sensor_profile_t *profile);
+
+/**
+ * Current profile and sampling statistics
+ */
+void sensor_task_get_sched_report(sensor_sched_report_t *out);
+
+/**
+ * Name of a profile mode as used by the REST API ("live", "averaged", "duty")
+ * and the reverse lookup; returns SENSOR_PROFILE_COUNT for an unknown name
+ */
+const char *sensor_profile_name(sensor_profile_mode_t mode);
+sensor_profile_mode_t sensor_profile_from_name(const char *name);
+
+/**
+ * Get the last reading of sensor 0 (for REST API queries)
+ * Lock-free copy of the newest sample on the sensor bus; all zero before the first
+ */
+esp_err_t sensor_task_get_latest(sensor_data_t *out_data);
+
+/**
+ * Get the last readings of all sensors
+ * Same as sensor_task_get_latest() for the whole sample
+ */
+esp_err_t sensor_task_get_latest_sample(sensor_sample_t *out_sample);
\ No newline at end of file
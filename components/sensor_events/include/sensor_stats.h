@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "sensor_events.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Incremental statistics of every sensor, updated by the sensor task with
+ * each new reading before the sample is published.
+ *
+ * Each rolling window (1 min, 15 min, 1 h, 24 h) is a ring of
+ * CONFIG_SENSOR_STATS_BUCKETS time-aligned buckets holding fixed-point sums,
+ * counts and min/max per channel. The window mean comes from running totals
+ * and min/max from monotonic deques of bucket slots, so a reading costs O(1)
+ * whatever the window length. A window covers its span to within one bucket.
+ *
+ * The NowCast follows the US EPA method over the last 12 clock hours since
+ * boot; the AQI uses the 2024 EPA breakpoints.
+ */
+
+typedef struct
+{
+    uint32_t span_s;
+    uint32_t bucket_s;
+    uint32_t samples;                       // readings in the window
+    float mean[SENSOR_CHANNEL_COUNT];       // NAN without readings
+    float min[SENSOR_CHANNEL_COUNT];
+    float max[SENSOR_CHANNEL_COUNT];
+} sensor_stats_window_t;
+
+typedef struct
+{
+    sensor_stats_window_t windows[SENSOR_WINDOW_COUNT];
+    float ewma[SENSOR_CHANNEL_COUNT];
+    float nowcast_pm2_5;
+    float nowcast_pm10;
+    int16_t aqi_pm2_5;
+    int16_t aqi_pm10;
+    uint32_t hours;                         // complete hours in the NowCast (0..12)
+} sensor_stats_t;
+
+/**
+ * @brief Create the lock; called by sensor_task_start().
+ */
+esp_err_t sensor_stats_init(void);
+
+/**
+ * @brief Add a new SENSOR_OK reading of data->sensor_id.
+ */
+void sensor_stats_update(const sensor_data_t *data);
+
+/**
+ * @brief Derived values of a sensor as of timestamp_ms (esp_timer ms), for
+ *        the sample published at that time. Windows age even without readings.
+ */
+void sensor_stats_derive(int sensor, int64_t timestamp_ms, sensor_derived_t *out);
+
+/**
+ * @brief Current windows including min/max, for /api/stats. Any task.
+ */
+esp_err_t sensor_stats_get(int sensor, sensor_stats_t *out);
+
+// "1m", "15m", "1h", "24h"
+const char *sensor_window_name(sensor_window_t window);
+
+/**
+ * @brief US AQI of a PM2.5 / PM10 concentration (µg/m³), 0..500; -1 for NAN.
+ */
+int sensor_aqi_pm2_5(float concentration);
+int sensor_aqi_pm10(float concentration);
+
+#ifdef __cplusplus
+}
+#endif
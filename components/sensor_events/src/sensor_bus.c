@@ -0,0 +1,187 @@
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sensor_bus.h"
+
+/*
+ * Readings are numbered from 1. Slot n % SLOTS holds reading n once its seq
+ * equals n; the producer zeroes seq before rewriting a slot and stores the
+ * new number after, so a reader that sees the number it expects both before
+ * and after reading knows the data was not torn. s_head is the number of the
+ * newest complete reading. The counters wrap after 136 years at 1 Hz.
+ */
+
+#define SLOTS CONFIG_SENSOR_BUS_SLOTS
+#define LATEST_SPINS 8
+
+enum { SUB_FREE, SUB_CLAIMED, SUB_ACTIVE };
+
+typedef struct
+{
+    atomic_uint seq;
+    sensor_sample_t data;
+} bus_slot_t;
+
+struct sensor_bus_sub
+{
+    atomic_int state;
+    TaskHandle_t task;
+    uint32_t next;          // number of the next reading to consume
+    uint32_t received;
+    uint32_t overflows;
+};
+
+static bus_slot_t s_slots[SLOTS];
+static atomic_uint s_head;
+static sensor_bus_sub_t s_subs[CONFIG_SENSOR_BUS_MAX_SUBSCRIBERS];
+
+// Seqlock cell: odd while the producer is writing
+static atomic_uint s_latest_seq;
+static sensor_sample_t s_latest;
+
+esp_err_t sensor_bus_subscribe(sensor_bus_sub_t **out)
+{
+    for (int i = 0; i < CONFIG_SENSOR_BUS_MAX_SUBSCRIBERS; i++)
+    {
+        sensor_bus_sub_t *sub = &s_subs[i];
+        int expected = SUB_FREE;
+        if (atomic_compare_exchange_strong(&sub->state, &expected, SUB_CLAIMED))
+        {
+            sub->task = xTaskGetCurrentTaskHandle();
+            sub->next = atomic_load(&s_head) + 1;
+            sub->received = 0;
+            sub->overflows = 0;
+            atomic_store(&sub->state, SUB_ACTIVE);
+            *out = sub;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+void sensor_bus_unsubscribe(sensor_bus_sub_t *sub)
+{
+    atomic_store(&sub->state, SUB_FREE);
+}
+
+void sensor_bus_publish(const sensor_sample_t *data)
+{
+    uint32_t n = atomic_load_explicit(&s_head, memory_order_relaxed) + 1;
+    bus_slot_t *slot = &s_slots[n % SLOTS];
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->data = *data;
+    atomic_store_explicit(&slot->seq, n, memory_order_release);
+
+    uint32_t ls = atomic_load_explicit(&s_latest_seq, memory_order_relaxed);
+    atomic_store_explicit(&s_latest_seq, ls + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s_latest = *data;
+    atomic_store_explicit(&s_latest_seq, ls + 2, memory_order_release);
+
+    atomic_store_explicit(&s_head, n, memory_order_release);
+
+    for (int i = 0; i < CONFIG_SENSOR_BUS_MAX_SUBSCRIBERS; i++)
+    {
+        if (atomic_load(&s_subs[i].state) == SUB_ACTIVE)
+        {
+            xTaskNotifyGive(s_subs[i].task);
+        }
+    }
+}
+
+static bool has_data(const sensor_bus_sub_t *sub)
+{
+    return (int32_t)(atomic_load_explicit(&s_head, memory_order_acquire) - sub->next) >= 0;
+}
+
+bool sensor_bus_wait(sensor_bus_sub_t *sub, TickType_t timeout)
+{
+    if (has_data(sub))
+    {
+        return true;
+    }
+    ulTaskNotifyTake(pdTRUE, timeout);
+    return has_data(sub);
+}
+
+const sensor_sample_t *sensor_bus_read_begin(sensor_bus_sub_t *sub)
+{
+    uint32_t head = atomic_load_explicit(&s_head, memory_order_acquire);
+
+    while ((int32_t)(head - sub->next) >= 0)
+    {
+        // More than a ring behind: the oldest readings are gone
+        if (head - sub->next >= SLOTS)
+        {
+            uint32_t oldest = head - SLOTS + 1;
+            sub->overflows += oldest - sub->next;
+            sub->next = oldest;
+        }
+
+        bus_slot_t *slot = &s_slots[sub->next % SLOTS];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) == sub->next)
+        {
+            return &slot->data;
+        }
+
+        // Being overwritten by a reading newer than head; skip it rather than
+        // wait for a producer that may be preempted by this task
+        sub->overflows++;
+        sub->next++;
+        head = atomic_load_explicit(&s_head, memory_order_acquire);
+    }
+    return NULL;
+}
+
+bool sensor_bus_read_end(sensor_bus_sub_t *sub)
+{
+    bus_slot_t *slot = &s_slots[sub->next % SLOTS];
+
+    atomic_thread_fence(memory_order_acquire);
+    bool intact = atomic_load_explicit(&slot->seq, memory_order_relaxed) == sub->next;
+    if (intact)
+    {
+        sub->received++;
+    }
+    else
+    {
+        sub->overflows++;
+    }
+    sub->next++;
+    return intact;
+}
+
+void sensor_bus_get_stats(const sensor_bus_sub_t *sub, sensor_bus_stats_t *out)
+{
+    out->received = sub->received;
+    out->overflows = sub->overflows;
+}
+
+bool sensor_bus_get_latest(sensor_sample_t *out)
+{
+    for (int spins = 0;; spins++)
+    {
+        uint32_t s1 = atomic_load_explicit(&s_latest_seq, memory_order_acquire);
+        if (s1 == 0)
+        {
+            return false;
+        }
+        if ((s1 & 1) == 0)
+        {
+            *out = s_latest;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&s_latest_seq, memory_order_relaxed) == s1)
+            {
+                return true;
+            }
+        }
+        // The producer may be a lower priority task on this core
+        if (spins >= LATEST_SPINS)
+        {
+            vTaskDelay(1);
+        }
+    }
+}
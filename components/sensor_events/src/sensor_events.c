@@ -0,0 +1,1249 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "sensor_events.h"
+#include "sensor_bus.h"
+#include "sensor_stats.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sensirion_common.h"
+#include "sensirion_uart_hal.h"
+#include "sps30_hal_stats.h"
+#include "sps30_uart.h"
+#include "trace.h"
+
+static const char *TAG = "sensor_events";
+
+// Define event bases
+ESP_EVENT_DEFINE_BASE(SENSOR_EVENT);
+ESP_EVENT_DEFINE_BASE(COMMAND_EVENT);
+
+// Overall status: the first sensor that is not OK
+static sensor_status_t current_status = SENSOR_NOT_READY;
+
+#define SENSOR_INIT_RETRY_MS 5000
+// The SPS30 takes a new measurement every second on its own clock
+#define SENSOR_SAMPLE_PERIOD_US 1000000LL
+// First poll for the next reading this long before it is due, then every step
+#define SENSOR_POLL_GUARD_US 30000
+#define SENSOR_POLL_STEP_US 20000
+// How often the sensor task looks for sensors that stopped delivering
+#define SENSOR_PUBLISH_CHECK_MS 250
+// The SPS30 runs its fan at full speed for 10 s when cleaning
+#define SENSOR_FAN_CLEAN_US (10 * 1000000LL)
+#define COMMAND_QUEUE_LEN 8
+
+#if CONFIG_SENSOR_FIXED_POINT
+// 20 data bytes per reading instead of 40; averaged windows sum exactly
+#define SENSOR_OUTPUT_FORMAT SPS30_OUTPUT_FORMAT_OUTPUT_FORMAT_UINT16
+typedef uint32_t sensor_sum_t;
+#else
+#define SENSOR_OUTPUT_FORMAT SPS30_OUTPUT_FORMAT_OUTPUT_FORMAT_FLOAT
+typedef float sensor_sum_t;
+#endif
+// Recent commands whose state sensor_command_get_status() still knows
+#define COMMAND_RECENT 8
+
+/*
+ * Every SPS30 has a reader task that owns its UART port. The reader phase
+ * locks to the sensor: "read measured values" answers with an empty frame
+ * until the sensor has a new reading, so after each new reading the reader
+ * sleeps until just before the next one is due and then polls in short steps
+ * until it is there. Nothing is read twice, and nothing is lost to the two
+ * clocks drifting apart.
+ *
+ * Readings are collected into a window per the sampling profile (one reading
+ * live, period_s readings averaged, the readings after warm-up of a duty
+ * cycle) and the closed window is handed to the sensor task. The sensor task
+ * publishes one sensor_sample_t whenever the first working sensor closes a
+ * window, with the newest window of every other sensor.
+ *
+ * The Sensirion driver builds frames in a shared buffer and the HAL keeps the
+ * selected port in a global, so a whole transaction (select, request,
+ * response) runs under driver_lock.
+ */
+typedef struct
+{
+    uint8_t id;
+    TaskHandle_t task;
+    bool initialized;
+    bool asleep;                // put to sleep by the duty cycle
+    volatile sensor_status_t status;    // result of the last poll
+    uint32_t generation;        // profile the open window belongs to
+    int64_t last_new_us;        // when the last new reading was picked up, 0 after a (re)start
+    int64_t next_poll_us;
+    int64_t awake_since_us;
+    int64_t window_start_us;
+    int64_t cycle_start_us;
+    uint32_t window_count;
+    sensor_sum_t window_sum[SENSOR_CHANNEL_COUNT];
+    // Under state_lock
+    sensor_data_t window;       // last closed window
+    uint32_t window_seq;
+    sensor_sched_stats_t stats;
+} sensor_reader_t;
+
+typedef enum
+{
+    POLL_NEW,
+    POLL_NOT_READY,
+    POLL_ERROR
+} poll_result_t;
+
+static sensor_reader_t readers[SENSOR_COUNT];
+// Set while a command (fan cleaning, sleep) has taken a sensor over
+static volatile sensor_status_t command_status[SENSOR_COUNT];
+static SemaphoreHandle_t driver_lock;
+static SemaphoreHandle_t state_lock;    // profile, closed windows and statistics
+static TaskHandle_t sensor_task_handle;
+
+static sensor_profile_t profile = 
+{
+#if CONFIG_SENSOR_PROFILE_AVERAGED
+    .mode = SENSOR_PROFILE_AVERAGED,
+    .period_s = CONFIG_SENSOR_AVERAGE_PERIOD_S,
+#elif CONFIG_SENSOR_PROFILE_DUTY_CYCLE
+    .mode = SENSOR_PROFILE_DUTY_CYCLE,
+    .period_s = CONFIG_SENSOR_DUTY_PERIOD_S,
+    .awake_s = CONFIG_SENSOR_DUTY_AWAKE_S,
+#else
+    .mode = SENSOR_PROFILE_LIVE,
+    .period_s = 1,
+#endif
+};
+static uint32_t profile_generation;
+static uint32_t published;
+static uint32_t publish_jitter_us_avg;
+static uint32_t publish_jitter_us_max;
+
+static const char *profile_names[SENSOR_PROFILE_COUNT] = { "live", "averaged", "duty" };
+
+/*
+ * Commands are queued to the sensor task, which runs them between reads: a
+ * command takes a sensor over through command_status so its reader stays
+ * away, and every transaction still goes through driver_lock. Fan cleaning
+ * completes from a one-shot timer instead of a 10 s wait, so neither the
+ * sensor task nor the event loop that delivered the command ever blocks.
+ */
+typedef struct
+{
+    sensor_command_handle_t handle;
+    command_event_id_t command;
+    bool completion;            // fan cleaning timer expired
+} command_request_t;
+
+static QueueHandle_t command_queue;
+static esp_timer_handle_t fan_clean_timer;
+static sensor_command_handle_t fan_clean_running;  // 0 when no cleaning is in progress
+static sensor_command_handle_t next_handle = 1;
+static portMUX_TYPE handle_mux = portMUX_INITIALIZER_UNLOCKED;
+static sensor_command_status_t recent[COMMAND_RECENT];   // under state_lock
+
+static const char *command_names[CMD_COUNT] = { "fan_clean", "sleep", "wake" };
+static const char *command_state_names[] = { "queued", "running", "done", "failed" };
+
+// Fixed-point resolution of each channel (see sensor_value_encode)
+static const float channel_resolution[SENSOR_CHANNEL_COUNT] = 
+{
+#define CHANNEL_RESOLUTION(NAME, field, key, group, size, label, unit, decimals, raw_decimals) \
+    [SENSOR_CHANNEL_##NAME] = 1.0f / SENSOR_POW10(decimals),
+    SENSOR_CHANNELS(CHANNEL_RESOLUTION)
+#undef CHANNEL_RESOLUTION
+};
+
+uint16_t sensor_value_encode(int channel, float value)
+{
+    float q = value / channel_resolution[channel] + 0.5f;
+    if (q <= 0.0f) return 0;
+    if (q >= 65535.0f) return 65535;
+    return (uint16_t)q;
+}
+
+float sensor_value_decode(int channel, uint16_t fixed)
+{
+    return fixed * channel_resolution[channel];
+}
+
+#if CONFIG_SENSOR_FIXED_POINT
+// Per channel: units of the SPS30 uint16 format per unit of the channel, and
+// stored fixed-point steps per unit of the uint16 format
+typedef struct
+{
+    uint16_t divisor;
+    uint16_t fixed_scale;
+    uint8_t decimals;
+} channel_raw_t;
+
+static const channel_raw_t channel_raw[SENSOR_CHANNEL_COUNT] = 
+{
+#define CHANNEL_RAW(NAME, field, key, group, size, label, unit, decimals, raw_decimals) \
+    [SENSOR_CHANNEL_##NAME] = { SENSOR_POW10(raw_decimals), SENSOR_POW10((decimals) - (raw_decimals)), raw_decimals },
+    SENSOR_CHANNELS(CHANNEL_RAW)
+#undef CHANNEL_RAW
+};
+
+float sensor_value_to_float(int channel, sensor_value_t value)
+{
+    return (float)value / channel_raw[channel].divisor;
+}
+
+sensor_value_t sensor_value_from_float(int channel, float value)
+{
+    float q = value * channel_raw[channel].divisor + 0.5f;
+    if (q <= 0.0f) return 0;
+    if (q >= 65535.0f) return 65535;
+    return (sensor_value_t)q;
+}
+
+uint16_t sensor_value_to_fixed(int channel, sensor_value_t value)
+{
+    uint32_t fixed = (uint32_t)value * channel_raw[channel].fixed_scale;
+    return fixed > UINT16_MAX ? UINT16_MAX : (uint16_t)fixed;
+}
+
+// Decimal digits of v; no NUL
+static size_t format_u32(char *out, size_t cap, uint32_t v)
+{
+    char digits[10];
+    size_t n = 0;
+
+    do
+    {
+        digits[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (n > cap)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        out[i] = digits[n - 1 - i];
+    }
+    return n;
+}
+
+size_t sensor_value_format(char *out, size_t cap, int channel, sensor_value_t value)
+{
+    const channel_raw_t *raw = &channel_raw[channel];
+    size_t n = format_u32(out, cap, value / raw->divisor);
+    if (n == 0)
+    {
+        return 0;
+    }
+    // e.g. nm as µm: the decimals of the channel, trailing zeros dropped like %g does
+    unsigned frac = value % raw->divisor;
+    if (frac)
+    {
+        char decimals[5] = { '.' };
+        size_t m = 1 + raw->decimals;
+        for (size_t i = m - 1; i > 0; i--)
+        {
+            decimals[i] = (char)('0' + frac % 10);
+            frac /= 10;
+        }
+        while (decimals[m - 1] == '0')
+        {
+            m--;
+        }
+        if (n + m > cap)
+        {
+            return 0;
+        }
+        memcpy(out + n, decimals, m);
+        n += m;
+    }
+    if (n >= cap)
+    {
+        return 0;
+    }
+    out[n] = '\0';
+    return n;
+}
+#else
+float sensor_value_to_float(int channel, sensor_value_t value)
+{
+    return value;
+}
+
+sensor_value_t sensor_value_from_float(int channel, float value)
+{
+    return value;
+}
+
+uint16_t sensor_value_to_fixed(int channel, sensor_value_t value)
+{
+    return sensor_value_encode(channel, value);
+}
+
+size_t sensor_value_format(char *out, size_t cap, int channel, sensor_value_t value)
+{
+    int n = snprintf(out, cap, "%g", value);
+    return n < 0 || (size_t)n >= cap ? 0 : (size_t)n;
+}
+#endif
+
+esp_err_t sensor_events_init(void) 
+{
+    ESP_LOGI(TAG, "Initializing sensor event loop");
+
+    esp_err_t ret = sps30_hal_stats_init();
+    if (ret != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "Failed to create UART stats lock");
+        return ret;
+    }
+
+    // Create default event loop if not already created
+    ret = esp_event_loop_create_default();
+    if (ret == ESP_ERR_INVALID_STATE) 
+    {
+        // Already created, this is fine
+        ESP_LOGI(TAG, "Event loop already exists");
+        return ESP_OK;
+    }
+
+    if (ret != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "Failed to create event loop: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ESP_LOGI(TAG, "Event loop created successfully");
+    return ESP_OK;
+}
+
+/**
+ * Start a driver transaction on the given sensor's port
+ */
+static void driver_begin(uint8_t id) 
+{
+    xSemaphoreTake(driver_lock, portMAX_DELAY);
+    sensirion_uart_hal_select_port(id);
+}
+
+static void driver_end(void) 
+{
+    xSemaphoreGive(driver_lock);
+}
+
+static sensor_status_t sensor_status(int id) 
+{
+    return command_status[id] != SENSOR_OK ? command_status[id] : readers[id].status;
+}
+
+/**
+ * Recompute the overall status and publish it if it changed
+ */
+static void update_status(void) 
+{
+    sensor_status_t overall = SENSOR_OK;
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        if (sensor_status(i) != SENSOR_OK) 
+        {
+            overall = sensor_status(i);
+            break;
+        }
+    }
+
+    if (overall != current_status) 
+    {
+        current_status = overall;
+        esp_event_post(SENSOR_EVENT, SENSOR_STATUS_CHANGE,
+                      &current_status, sizeof(current_status), 0);
+    }
+}
+
+/**
+ * Initialize one SPS30 sensor
+ */
+static esp_err_t init_sensor(uint8_t id) 
+{
+    ESP_LOGI(TAG, "Initializing SPS30 sensor %d", id);
+
+    driver_begin(id);
+    int16_t ret = sensirion_uart_hal_init(0);
+    if (ret != NO_ERROR) 
+    {
+        driver_end();
+        ESP_LOGE(TAG, "Sensor %d: UART init failed: %d", id, ret);
+        return ESP_FAIL;
+    }
+
+    // Probe: the sensor answers with its serial number once it is up
+    int8_t serial_number[32] = {0};
+    sps30_stop_measurement();
+    ret = sps30_read_serial_number(serial_number, sizeof(serial_number));
+    if (ret != 0) 
+    {
+        driver_end();
+        ESP_LOGE(TAG, "Sensor %d: SPS30 probe failed: %d", id, ret);
+        return ESP_FAIL;
+    }
+
+    ret = sps30_start_measurement(SENSOR_OUTPUT_FORMAT);
+    driver_end();
+    ESP_LOGI(TAG, "Sensor %d: SPS30 serial number: %s", id, (const char *)serial_number);
+    if (ret != 0) 
+    {
+        ESP_LOGE(TAG, "Sensor %d: failed to start measurement: %d", id, ret);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Sensor %d: initialized and measurement started", id);
+    return ESP_OK;
+}
+
+/**
+ * Sleep until t_us or until the profile changes
+ */
+static void wait_until(int64_t t_us) 
+{
+    int64_t delta_us = t_us - esp_timer_get_time();
+    if (delta_us <= 0) 
+    {
+        return;
+    }
+    TickType_t ticks = pdMS_TO_TICKS((delta_us + 999) / 1000);
+    ulTaskNotifyTake(pdTRUE, ticks > 0 ? ticks : 1);
+}
+
+/**
+ * Ask one sensor for a new reading
+ */
+static poll_result_t poll_sensor(sensor_reader_t *reader, sensor_value_t *v) 
+{
+    sps30_hal_response_t response;
+
+    driver_begin(reader->id);
+    TRACE_BEGIN("sps30_read");
+#if CONFIG_SENSOR_FIXED_POINT
+    int16_t ret = sps30_read_measurement_values_uint16(
+        &v[SENSOR_CHANNEL_PM1_0], &v[SENSOR_CHANNEL_PM2_5], &v[SENSOR_CHANNEL_PM4_0], &v[SENSOR_CHANNEL_PM10],
+        &v[SENSOR_CHANNEL_NC0_5], &v[SENSOR_CHANNEL_NC1_0], &v[SENSOR_CHANNEL_NC2_5], &v[SENSOR_CHANNEL_NC4_0],
+        &v[SENSOR_CHANNEL_NC10], &v[SENSOR_CHANNEL_TYPICAL_SIZE]);
+#else
+    int16_t ret = sps30_read_measurement_values_float(
+        &v[SENSOR_CHANNEL_PM1_0], &v[SENSOR_CHANNEL_PM2_5], &v[SENSOR_CHANNEL_PM4_0], &v[SENSOR_CHANNEL_PM10],
+        &v[SENSOR_CHANNEL_NC0_5], &v[SENSOR_CHANNEL_NC1_0], &v[SENSOR_CHANNEL_NC2_5], &v[SENSOR_CHANNEL_NC4_0],
+        &v[SENSOR_CHANNEL_NC10], &v[SENSOR_CHANNEL_TYPICAL_SIZE]);
+#endif
+    TRACE_END("sps30_read");
+    bool answered = sps30_hal_last_response(reader->id, &response);
+    driver_end();
+
+    // No data in the response: the next measurement is not done yet
+    if (answered && response.state == 0 && response.data_len == 0) 
+    {
+        return POLL_NOT_READY;
+    }
+    if (ret != NO_ERROR) 
+    {
+        ESP_LOGW(TAG, "Sensor %d: failed to read measurement: %d", reader->id, ret);
+        return POLL_ERROR;
+    }
+    return POLL_NEW;
+}
+
+/**
+ * Book a new reading against the sensor's 1 s cadence
+ */
+static void account_new_reading(sensor_reader_t *reader, int64_t now_us) 
+{
+    sensor_sched_stats_t *st = &reader->stats;
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    st->samples++;
+    if (reader->last_new_us != 0) 
+    {
+        int64_t interval_us = now_us - reader->last_new_us;
+        int64_t periods = (interval_us + SENSOR_SAMPLE_PERIOD_US / 2) / SENSOR_SAMPLE_PERIOD_US;
+        if (periods == 0) 
+        {
+            st->duplicates++;
+        }
+        else 
+        {
+            int64_t deviation_us = interval_us - periods * SENSOR_SAMPLE_PERIOD_US;
+            uint32_t jitter_us = (uint32_t)(deviation_us < 0 ? -deviation_us : deviation_us);
+            st->missed += (uint32_t)(periods - 1);
+            st->jitter_us_last = jitter_us;
+            // avg += (x - avg) / 8, seeded with the first interval
+            st->jitter_us_avg = st->samples == 2 ? jitter_us
+                : (uint32_t)((int64_t)st->jitter_us_avg + ((int64_t)jitter_us - st->jitter_us_avg) / 8);
+            if (jitter_us > st->jitter_us_max) 
+            {
+                st->jitter_us_max = jitter_us;
+            }
+        }
+    }
+    xSemaphoreGive(state_lock);
+    reader->last_new_us = now_us;
+}
+
+static void reset_window(sensor_reader_t *reader, int64_t now_us) 
+{
+    reader->window_count = 0;
+    memset(reader->window_sum, 0, sizeof(reader->window_sum));
+    reader->window_start_us = now_us;
+}
+
+/**
+ * Hand the mean of the open window to the sensor task
+ */
+static void close_window(sensor_reader_t *reader, int64_t now_us) 
+{
+    if (reader->window_count == 0) 
+    {
+        return;
+    }
+
+    sensor_data_t data = 
+    {
+        .timestamp_ms = now_us / 1000,
+        .status = SENSOR_OK,
+        .sensor_id = reader->id
+    };
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) 
+    {
+#if CONFIG_SENSOR_FIXED_POINT
+        data.values[ch] = (sensor_value_t)((reader->window_sum[ch] + reader->window_count / 2) / reader->window_count);
+#else
+        data.values[ch] = reader->window_sum[ch] / reader->window_count;
+#endif
+    }
+    reset_window(reader, now_us);
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    reader->window = data;
+    reader->window_seq++;
+    xSemaphoreGive(state_lock);
+    xTaskNotifyGive(sensor_task_handle);
+}
+
+/**
+ * Duty cycle: stop measuring and put the sensor to sleep
+ */
+static void duty_sleep(sensor_reader_t *reader) 
+{
+    driver_begin(reader->id);
+    sps30_stop_measurement();
+    int16_t ret = sps30_sleep();
+    driver_end();
+    if (ret != 0) 
+    {
+        ESP_LOGW(TAG, "Sensor %d: sleep failed: %d", reader->id, ret);
+    }
+    // Also when sleep failed; waking up an idle sensor is harmless
+    reader->asleep = true;
+    reader->status = SENSOR_SLEEPING;
+}
+
+/**
+ * Duty cycle: wake the sensor and start measuring
+ */
+static bool duty_wake(sensor_reader_t *reader, int64_t now_us) 
+{
+    driver_begin(reader->id);
+    sps30_wake_up_sequence();
+    int16_t ret = sps30_start_measurement(SENSOR_OUTPUT_FORMAT);
+    driver_end();
+    if (ret != 0) 
+    {
+        ESP_LOGW(TAG, "Sensor %d: wake up failed: %d", reader->id, ret);
+        reader->status = SENSOR_COMM_ERROR;
+        return false;
+    }
+
+    // A new measurement runs on a new phase
+    reader->asleep = false;
+    reader->status = SENSOR_OK;
+    reader->awake_since_us = now_us;
+    reader->last_new_us = 0;
+    reader->next_poll_us = 0;
+    return true;
+}
+
+/**
+ * Reader task: owns one sensor and follows its measurement clock
+ */
+static void reader_task(void *pvParameters) 
+{
+    sensor_reader_t *reader = (sensor_reader_t *)pvParameters;
+    sensor_value_t values[SENSOR_CHANNEL_COUNT];
+
+    while (1) 
+    {
+        int64_t now = esp_timer_get_time();
+
+        if (!reader->initialized) 
+        {
+            reader->initialized = init_sensor(reader->id) == ESP_OK;
+            if (!reader->initialized) 
+            {
+                // Other sensors keep going meanwhile
+                reader->status = SENSOR_NOT_READY;
+                wait_until(now + SENSOR_INIT_RETRY_MS * 1000LL);
+                continue;
+            }
+            reader->status = SENSOR_OK;
+            reader->awake_since_us = now;
+            reader->last_new_us = 0;
+            reader->next_poll_us = 0;
+        }
+
+        // Fan cleaning and the sleep command take the sensor over for a while
+        if (command_status[reader->id] != SENSOR_OK) 
+        {
+            reader->last_new_us = 0;
+            wait_until(now + 100000);
+            continue;
+        }
+
+        sensor_profile_t p;
+        xSemaphoreTake(state_lock, portMAX_DELAY);
+        p = profile;
+        uint32_t generation = profile_generation;
+        xSemaphoreGive(state_lock);
+
+        if (generation != reader->generation) 
+        {
+            // New profile: start over with an empty window
+            reader->generation = generation;
+            reset_window(reader, now);
+            reader->cycle_start_us = now;
+        }
+
+        if (p.mode == SENSOR_PROFILE_DUTY_CYCLE) 
+        {
+            int64_t period_us = p.period_s * 1000000LL;
+            if (now >= reader->cycle_start_us + period_us) 
+            {
+                // Skip whole cycles if the reader was held up
+                reader->cycle_start_us += (now - reader->cycle_start_us) / period_us * period_us;
+            }
+            if (now >= reader->cycle_start_us + p.awake_s * 1000000LL) 
+            {
+                if (!reader->asleep) 
+                {
+                    close_window(reader, now);
+                    duty_sleep(reader);
+                }
+                wait_until(reader->cycle_start_us + period_us);
+                continue;
+            }
+        }
+        if (reader->asleep && !duty_wake(reader, now)) 
+        {
+            wait_until(now + SENSOR_SAMPLE_PERIOD_US);
+            continue;
+        }
+
+        if (now < reader->next_poll_us) 
+        {
+            wait_until(reader->next_poll_us);
+            continue;
+        }
+
+        poll_result_t result = poll_sensor(reader, values);
+        now = esp_timer_get_time();
+        if (result == POLL_NOT_READY) 
+        {
+            xSemaphoreTake(state_lock, portMAX_DELAY);
+            reader->stats.not_ready++;
+            xSemaphoreGive(state_lock);
+            reader->status = SENSOR_OK;
+            reader->next_poll_us = now + SENSOR_POLL_STEP_US;
+            continue;
+        }
+        if (result == POLL_ERROR) 
+        {
+            reader->status = SENSOR_COMM_ERROR;
+            reader->next_poll_us = now + SENSOR_SAMPLE_PERIOD_US;
+            continue;
+        }
+
+        reader->status = SENSOR_OK;
+        account_new_reading(reader, now);
+        reader->next_poll_us = now + SENSOR_SAMPLE_PERIOD_US - SENSOR_POLL_GUARD_US;
+
+        if (p.mode == SENSOR_PROFILE_DUTY_CYCLE && 
+            now - reader->awake_since_us < CONFIG_SENSOR_DUTY_WARMUP_S * 1000000LL) 
+        {
+            continue;   // readings settle after start-up
+        }
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++) 
+        {
+            reader->window_sum[ch] += values[ch];
+        }
+        reader->window_count++;
+
+        if (p.mode == SENSOR_PROFILE_LIVE || 
+            (p.mode == SENSOR_PROFILE_AVERAGED && 
+             now - reader->window_start_us >= p.period_s * 1000000LL - SENSOR_SAMPLE_PERIOD_US / 2)) 
+        {
+            close_window(reader, now);
+        }
+    }
+}
+
+/**
+ * Record a command state change and post it for the WebSocket
+ */
+static void command_set_state(sensor_command_handle_t handle, command_event_id_t command, 
+                              sensor_command_state_t state, esp_err_t error) 
+{
+    sensor_command_status_t status = 
+    {
+        .handle = handle,
+        .command = command,
+        .state = state,
+        .error = error
+    };
+
+    // Commands without a handle came in as COMMAND_EVENT and nobody tracks
+    // them; storing them would evict the status of a tracked command
+    if (handle == 0) 
+    {
+        return;
+    }
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    recent[handle % COMMAND_RECENT] = status;
+    xSemaphoreGive(state_lock);
+
+    esp_event_post(SENSOR_EVENT, SENSOR_COMMAND_STATUS, &status, sizeof(status), 0);
+}
+
+static void fan_clean_timer_cb(void *arg) 
+{
+    command_request_t request = 
+    {
+        .handle = fan_clean_running,
+        .command = CMD_FAN_CLEAN,
+        .completion = true
+    };
+    // The queue has room for at most COMMAND_QUEUE_LEN submissions; if it is
+    // full the completion is retried shortly
+    if (xQueueSend(command_queue, &request, 0) != pdTRUE) 
+    {
+        esp_timer_start_once(fan_clean_timer, 100000);
+        return;
+    }
+    xTaskNotifyGive(sensor_task_handle);
+}
+
+/**
+ * Start fan cleaning on every sensor; completes from fan_clean_timer
+ */
+static esp_err_t run_fan_clean(sensor_command_handle_t handle) 
+{
+    if (fan_clean_running) 
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        if (command_status[i] == SENSOR_SLEEPING) 
+        {
+            return ESP_ERR_INVALID_STATE;   // wake the sensors first
+        }
+    }
+
+    ESP_LOGI(TAG, "Starting fan cleaning");
+    bool any_started = false;
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        // Readers stay away from a sensor a command has taken over
+        command_status[i] = SENSOR_FAN_CLEANING;
+        driver_begin(i);
+        if (readers[i].asleep)
+        {
+            // Duty cycle sleep: the sensor cleans only while measuring
+            driver_end();
+            command_status[i] = SENSOR_OK;
+            continue;
+        }
+        int16_t ret = sps30_start_fan_cleaning();
+        driver_end();
+        if (ret != 0) 
+        {
+            ESP_LOGE(TAG, "Sensor %d: failed to start fan cleaning: %d", i, ret);
+            command_status[i] = SENSOR_OK;
+            readers[i].status = SENSOR_COMM_ERROR;
+        }
+        else 
+        {
+            any_started = true;
+        }
+    }
+    update_status();
+    if (!any_started) 
+    {
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Fan cleaning started (takes ~10 seconds)");
+    fan_clean_running = handle ? handle : UINT32_MAX;
+    esp_timer_start_once(fan_clean_timer, SENSOR_FAN_CLEAN_US);
+    return ESP_OK;
+}
+
+static void finish_fan_clean(void) 
+{
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        if (command_status[i] == SENSOR_FAN_CLEANING) 
+        {
+            command_status[i] = SENSOR_OK;
+        }
+    }
+    fan_clean_running = 0;
+    update_status();
+    ESP_LOGI(TAG, "Fan cleaning done");
+}
+
+/**
+ * Sleep or wake every sensor
+ */
+static esp_err_t run_sleep(bool enabled) 
+{
+    if (fan_clean_running) 
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    ESP_LOGI(TAG, enabled ? "Entering sleep mode" : "Waking from sleep");
+    esp_err_t err = ESP_OK;
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        int16_t ret;
+        if (enabled) 
+        {
+            command_status[i] = SENSOR_SLEEPING;
+        }
+        driver_begin(i);
+        if (enabled) 
+        {
+            // The SPS30 only sleeps from idle
+            sps30_stop_measurement();
+            ret = sps30_sleep();
+        } else 
+        {
+            sps30_wake_up_sequence();
+            ret = sps30_start_measurement(SENSOR_OUTPUT_FORMAT);
+        }
+        driver_end();
+        if (ret != 0) 
+        {
+            ESP_LOGE(TAG, "Sensor %d: %s failed: %d", i, enabled ? "sleep" : "wake up", ret);
+            err = ESP_FAIL;
+        }
+        if (!enabled) 
+        {
+            readers[i].asleep = false;
+            command_status[i] = SENSOR_OK;
+        }
+    }
+
+    update_status();
+    return err;
+}
+
+/**
+ * Run one queued command on the sensor task
+ */
+static void run_command(const command_request_t *request) 
+{
+    if (request->completion) 
+    {
+        finish_fan_clean();
+        command_set_state(request->handle == UINT32_MAX ? 0 : request->handle, 
+                          CMD_FAN_CLEAN, SENSOR_COMMAND_DONE, ESP_OK);
+        return;
+    }
+
+    esp_err_t err;
+    switch (request->command) 
+    {
+    case CMD_FAN_CLEAN:
+        err = run_fan_clean(request->handle);
+        if (err == ESP_OK) 
+        {
+            command_set_state(request->handle, request->command, SENSOR_COMMAND_RUNNING, ESP_OK);
+            return;
+        }
+        break;
+    case CMD_SLEEP:
+    case CMD_WAKE:
+        err = run_sleep(request->command == CMD_SLEEP);
+        break;
+    default:
+        err = ESP_ERR_INVALID_ARG;
+        break;
+    }
+    command_set_state(request->handle, request->command, 
+                      err == ESP_OK ? SENSOR_COMMAND_DONE : SENSOR_COMMAND_FAILED, err);
+}
+
+/**
+ * COMMAND_EVENT handlers only queue; they run on the shared event loop
+ */
+static void handle_command_event(void *arg, esp_event_base_t base, int32_t id, void *event_data) 
+{
+    command_event_id_t command = (command_event_id_t)id;
+    if (id == CMD_SLEEP && event_data != NULL && !((sleep_command_t *)event_data)->enabled) 
+    {
+        command = CMD_WAKE;
+    }
+
+    command_request_t request = { .handle = 0, .command = command };
+    if (xQueueSend(command_queue, &request, 0) != pdTRUE) 
+    {
+        ESP_LOGW(TAG, "Command queue full, %s dropped", sensor_command_name(command));
+        return;
+    }
+    xTaskNotifyGive(sensor_task_handle);
+}
+
+/**
+ * Main sensor task: publishes the readers' windows as one sample
+ */
+static void sensor_task(void *pvParameters) 
+{
+    uint32_t published_seq[SENSOR_COUNT] = {0};
+    int64_t last_publish_us = 0;
+
+    ESP_LOGI(TAG, "Sensor task started with %d sensor(s), profile %s",
+             SENSOR_COUNT, profile_names[profile.mode]);
+
+    // Register command handlers
+    esp_event_handler_register(COMMAND_EVENT, CMD_FAN_CLEAN, handle_command_event, NULL);
+    esp_event_handler_register(COMMAND_EVENT, CMD_SLEEP, handle_command_event, NULL);
+    esp_event_handler_register(COMMAND_EVENT, CMD_WAKE, handle_command_event, NULL);
+
+    while (1) 
+    {
+        command_request_t request;
+
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SENSOR_PUBLISH_CHECK_MS));
+        while (xQueueReceive(command_queue, &request, 0) == pdTRUE) 
+        {
+            run_command(&request);
+        }
+        update_status();
+
+        int64_t now = esp_timer_get_time();
+        sensor_sample_t sample = 
+        {
+            .timestamp_ms = now / 1000,
+            .count = SENSOR_COUNT,
+        };
+
+        xSemaphoreTake(state_lock, portMAX_DELAY);
+        int64_t period_us = profile.period_s * 1000000LL;
+
+        // Pace on the first working sensor; publish on the others' windows
+        // only if that one has gone quiet
+        int pace = -1;
+        bool any_new = false;
+        for (int i = 0; i < SENSOR_COUNT; i++) 
+        {
+            sensor_status_t st = readers[i].status;
+            any_new |= readers[i].window_seq != published_seq[i];
+            if (pace < 0 && (st == SENSOR_OK || st == SENSOR_SLEEPING)) 
+            {
+                pace = i;
+            }
+        }
+        bool due = pace >= 0 && readers[pace].window_seq != published_seq[pace];
+        if (!due && any_new && (pace < 0 || now - last_publish_us > period_us * 3 / 2)) 
+        {
+            due = true;
+        }
+        if (!due) 
+        {
+            xSemaphoreGive(state_lock);
+            continue;
+        }
+
+        for (int i = 0; i < SENSOR_COUNT; i++) 
+        {
+            sensor_data_t *data = &sample.sensors[i];
+            if (readers[i].window_seq != published_seq[i]) 
+            {
+                *data = readers[i].window;
+                published_seq[i] = readers[i].window_seq;
+            }
+            else 
+            {
+                // Nothing new from this one in this period
+                sensor_status_t st = sensor_status(i);
+                data->status = st == SENSOR_OK ? SENSOR_NOT_READY : st;
+                data->timestamp_ms = sample.timestamp_ms;
+            }
+            data->sensor_id = i;
+        }
+
+        if (last_publish_us != 0) 
+        {
+            int64_t deviation_us = now - last_publish_us - period_us;
+            uint32_t jitter_us = (uint32_t)(deviation_us < 0 ? -deviation_us : deviation_us);
+            // avg += (x - avg) / 8, seeded with the first interval
+            publish_jitter_us_avg = published == 1 ? jitter_us
+                : (uint32_t)((int64_t)publish_jitter_us_avg + ((int64_t)jitter_us - publish_jitter_us_avg) / 8);
+            if (jitter_us > publish_jitter_us_max) 
+            {
+                publish_jitter_us_max = jitter_us;
+            }
+        }
+        last_publish_us = now;
+        published++;
+        xSemaphoreGive(state_lock);
+
+        // Statistics stage: the derived values travel with the readings
+        for (int i = 0; i < SENSOR_COUNT; i++) 
+        {
+            if (sample.sensors[i].status == SENSOR_OK) 
+            {
+                sensor_stats_update(&sample.sensors[i]);
+            }
+            sensor_stats_derive(i, sample.timestamp_ms, &sample.derived[i]);
+        }
+
+        // Never blocks; subscribers that fall behind lose the oldest samples
+        sensor_bus_publish(&sample);
+    }
+}
+
+esp_err_t sensor_command_submit(command_event_id_t command, sensor_command_handle_t *out_handle) 
+{
+    if (command >= CMD_COUNT) 
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (command_queue == NULL) 
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    command_request_t request = { .command = command };
+    taskENTER_CRITICAL(&handle_mux);
+    request.handle = next_handle++;
+    if (next_handle == 0 || next_handle == UINT32_MAX) 
+    {
+        next_handle = 1;
+    }
+    taskEXIT_CRITICAL(&handle_mux);
+
+    if (xQueueSend(command_queue, &request, 0) != pdTRUE) 
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    command_set_state(request.handle, command, SENSOR_COMMAND_QUEUED, ESP_OK);
+    xTaskNotifyGive(sensor_task_handle);
+
+    if (out_handle) 
+    {
+        *out_handle = request.handle;
+    }
+    return ESP_OK;
+}
+
+esp_err_t sensor_command_get_status(sensor_command_handle_t handle, sensor_command_status_t *out) 
+{
+    if (state_lock == NULL || handle == 0) 
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    *out = recent[handle % COMMAND_RECENT];
+    xSemaphoreGive(state_lock);
+    return out->handle == handle ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+const char *sensor_command_name(command_event_id_t command) 
+{
+    return command < CMD_COUNT ? command_names[command] : "unknown";
+}
+
+const char *sensor_command_state_name(sensor_command_state_t state) 
+{
+    return state <= SENSOR_COMMAND_FAILED ? command_state_names[state] : "unknown";
+}
+
+const char *sensor_profile_name(sensor_profile_mode_t mode) 
+{
+    return mode < SENSOR_PROFILE_COUNT ? profile_names[mode] : "unknown";
+}
+
+sensor_profile_mode_t sensor_profile_from_name(const char *name) 
+{
+    for (int i = 0; i < SENSOR_PROFILE_COUNT; i++) 
+    {
+        if (strcmp(name, profile_names[i]) == 0) 
+        {
+            return (sensor_profile_mode_t)i;
+        }
+    }
+    return SENSOR_PROFILE_COUNT;
+}
+
+esp_err_t sensor_task_set_profile(const sensor_profile_t *new_profile) 
+{
+    sensor_profile_t p = *new_profile;
+
+    switch (p.mode) 
+    {
+    case SENSOR_PROFILE_LIVE:
+        p.period_s = 1;
+        p.awake_s = 0;
+        break;
+    case SENSOR_PROFILE_AVERAGED:
+        if (p.period_s < 2 || p.period_s > SENSOR_PROFILE_MAX_PERIOD_S) 
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        p.awake_s = 0;
+        break;
+    case SENSOR_PROFILE_DUTY_CYCLE:
+        // Awake long enough for one reading after warm-up, asleep for a while
+        if (p.awake_s <= CONFIG_SENSOR_DUTY_WARMUP_S || p.awake_s >= p.period_s || 
+            p.awake_s > SENSOR_PROFILE_MAX_AWAKE_S || p.period_s > SENSOR_PROFILE_MAX_PERIOD_S) 
+        {
+            return ESP_ERR_INVALID_ARG;
+        }
+        break;
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (state_lock == NULL) 
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    profile = p;
+    profile_generation++;
+    xSemaphoreGive(state_lock);
+
+    ESP_LOGI(TAG, "Sampling profile %s, period %" PRIu32 " s, awake %" PRIu32 " s",
+             profile_names[p.mode], p.period_s, p.awake_s);
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        if (readers[i].task) 
+        {
+            xTaskNotifyGive(readers[i].task);
+        }
+    }
+    return ESP_OK;
+}
+
+void sensor_task_get_sched_report(sensor_sched_report_t *out) 
+{
+    if (state_lock == NULL) 
+    {
+        memset(out, 0, sizeof(*out));
+        out->profile = profile;
+        return;
+    }
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    out->profile = profile;
+    out->published = published;
+    out->publish_jitter_us_avg = publish_jitter_us_avg;
+    out->publish_jitter_us_max = publish_jitter_us_max;
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        out->sensors[i] = readers[i].stats;
+        out->sensors[i].status = sensor_status(i);
+    }
+    xSemaphoreGive(state_lock);
+}
+
+esp_err_t sensor_task_start(void) 
+{
+    driver_lock = xSemaphoreCreateMutex();
+    state_lock = xSemaphoreCreateMutex();
+    command_queue = xQueueCreate(COMMAND_QUEUE_LEN + 1, sizeof(command_request_t));
+    if (driver_lock == NULL || state_lock == NULL || command_queue == NULL || sensor_stats_init() != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "Failed to create locks");
+        return ESP_ERR_NO_MEM;
+    }
+
+    const esp_timer_create_args_t fan_clean_timer_args = 
+    {
+        .callback = fan_clean_timer_cb,
+        .name = "fan_clean"
+    };
+    if (esp_timer_create(&fan_clean_timer_args, &fan_clean_timer) != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "Failed to create fan cleaning timer");
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        readers[i].id = i;
+        readers[i].status = SENSOR_NOT_READY;
+        command_status[i] = SENSOR_OK;
+    }
+
+    // Create sensor task (8KB stack, priority 5) first; readers notify it
+    BaseType_t ret = xTaskCreate(sensor_task, "sensor_task", 8192, NULL, 5, &sensor_task_handle);
+    if (ret != pdPASS) 
+    {
+        ESP_LOGE(TAG, "Failed to create sensor task");
+        return ESP_FAIL;
+    }
+
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        char name[16];
+        snprintf(name, sizeof(name), "sps30_%d", i);
+
+        // Reader tasks (4KB stack, priority 6 so a poll is not held up by the publisher)
+        if (xTaskCreate(reader_task, name, 4096, &readers[i], 6, &readers[i].task) != pdPASS) 
+        {
+            ESP_LOGE(TAG, "Failed to create reader task %d", i);
+            return ESP_FAIL;
+        }
+    }
+
+    ESP_LOGI(TAG, "Sensor task created");
+    return ESP_OK;
+}
+
+esp_err_t sensor_task_get_latest_sample(sensor_sample_t *out_sample) 
+{
+    if (out_sample == NULL) 
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!sensor_bus_get_latest(out_sample)) 
+    {
+        memset(out_sample, 0, sizeof(*out_sample));
+    }
+    return ESP_OK;
+}
+
+esp_err_t sensor_task_get_latest(sensor_data_t *out_data) 
+{
+    if (out_data == NULL) 
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sensor_sample_t sample;
+    sensor_task_get_latest_sample(&sample);
+    *out_data = sample.sensors[0];
+    return ESP_OK;
+}
\ No newline at end of file
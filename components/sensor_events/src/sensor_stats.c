@@ -0,0 +1,533 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "sensor_stats.h"
+
+static const char *TAG = "sensor_stats";
+
+#define STATS_BUCKETS CONFIG_SENSOR_STATS_BUCKETS
+// Hours the NowCast looks back over
+#define NOWCAST_HOURS 12
+
+static_assert(STATS_BUCKETS <= 255, "bucket slots are uint8_t");
+
+static const uint32_t window_span_s[SENSOR_WINDOW_COUNT] = { 60, 15 * 60, 3600, 24 * 3600 };
+static const char *const window_names[SENSOR_WINDOW_COUNT] = { "1m", "15m", "1h", "24h" };
+
+// Bucket slots in time order; values at the back are never worse than those in front
+typedef struct
+{
+    uint8_t slot[STATS_BUCKETS];
+    uint8_t head;
+    uint8_t len;
+} slot_deque_t;
+
+/*
+ * One rolling window. Values are the fixed-point form of
+ * sensor_value_encode(), so sums are exact and totals can be kept running:
+ * a closed bucket is added once and subtracted when its slot is reused.
+ */
+typedef struct
+{
+    uint32_t bucket_s;
+    bool started;
+    uint32_t open_id;                                   // timestamp / bucket_s of the open bucket
+    uint32_t open_count;
+    uint32_t open_sum[SENSOR_CHANNEL_COUNT];
+    uint16_t open_min[SENSOR_CHANNEL_COUNT];
+    uint16_t open_max[SENSOR_CHANNEL_COUNT];
+
+    uint8_t next;                                       // slot the next closed bucket goes to
+    uint8_t filled;
+    uint16_t count[STATS_BUCKETS];
+    uint32_t sum[STATS_BUCKETS][SENSOR_CHANNEL_COUNT];
+    uint16_t min[STATS_BUCKETS][SENSOR_CHANNEL_COUNT];
+    uint16_t max[STATS_BUCKETS][SENSOR_CHANNEL_COUNT];
+    uint32_t total_count;                               // over the closed buckets
+    uint64_t total_sum[SENSOR_CHANNEL_COUNT];
+    slot_deque_t min_dq[SENSOR_CHANNEL_COUNT];          // ascending minima
+    slot_deque_t max_dq[SENSOR_CHANNEL_COUNT];          // descending maxima
+} stats_window_t;
+
+typedef struct
+{
+    stats_window_t windows[SENSOR_WINDOW_COUNT];
+
+    bool ewma_started;
+    int64_t ewma_ms;
+    float ewma[SENSOR_CHANNEL_COUNT];
+
+    // Clock hours since boot: the open one and the last NOWCAST_HOURS means
+    bool hour_started;
+    uint32_t hour_id;
+    uint32_t hour_count;
+    uint32_t hour_sum[2];                               // fixed point: mc_2p5, mc_10p0
+    float hourly[NOWCAST_HOURS][2];                     // NAN for hours without readings
+    uint8_t hour_next;
+    uint8_t hour_filled;
+    float nowcast[2];
+} sensor_stats_state_t;
+
+// Channels of the NowCast in wire order
+static const int nowcast_channel[2] = { SENSOR_CHANNEL_PM2_5, SENSOR_CHANNEL_PM10 };
+
+static sensor_stats_state_t s_state[SENSOR_COUNT];
+static SemaphoreHandle_t s_lock;
+
+/*
+ * US EPA AQI breakpoints (2024 PM NAAQS revision). Concentrations are
+ * truncated to the breakpoint resolution (0.1 µg/m³ for PM2.5, 1 µg/m³ for
+ * PM10) before the lookup.
+ */
+typedef struct
+{
+    float c_lo;
+    float c_hi;
+    int16_t i_lo;
+    int16_t i_hi;
+} aqi_breakpoint_t;
+
+static const aqi_breakpoint_t pm2_5_breakpoints[] =
+{
+    { 0.0f, 9.0f, 0, 50 },
+    { 9.1f, 35.4f, 51, 100 },
+    { 35.5f, 55.4f, 101, 150 },
+    { 55.5f, 125.4f, 151, 200 },
+    { 125.5f, 225.4f, 201, 300 },
+    { 225.5f, 325.4f, 301, 500 },
+};
+
+static const aqi_breakpoint_t pm10_breakpoints[] =
+{
+    { 0.0f, 54.0f, 0, 50 },
+    { 55.0f, 154.0f, 51, 100 },
+    { 155.0f, 254.0f, 101, 150 },
+    { 255.0f, 354.0f, 151, 200 },
+    { 355.0f, 424.0f, 201, 300 },
+    { 425.0f, 604.0f, 301, 500 },
+};
+
+static int aqi(const aqi_breakpoint_t *bp, size_t n, float c)
+{
+    if (isnan(c))
+    {
+        return -1;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        // A small tolerance so that 35.4 truncated from 35.45 still matches
+        if (c <= bp[i].c_hi + 0.001f)
+        {
+            float index = (bp[i].i_hi - bp[i].i_lo) / (bp[i].c_hi - bp[i].c_lo) * (c - bp[i].c_lo) + bp[i].i_lo;
+            return index < 0 ? 0 : (int)lroundf(index);
+        }
+    }
+    return 500;
+}
+
+int sensor_aqi_pm2_5(float concentration)
+{
+    return aqi(pm2_5_breakpoints, sizeof(pm2_5_breakpoints) / sizeof(pm2_5_breakpoints[0]),
+               floorf(concentration * 10.0f + 0.001f) / 10.0f);
+}
+
+int sensor_aqi_pm10(float concentration)
+{
+    return aqi(pm10_breakpoints, sizeof(pm10_breakpoints) / sizeof(pm10_breakpoints[0]),
+               floorf(concentration + 0.001f));
+}
+
+const char *sensor_window_name(sensor_window_t window)
+{
+    return window < SENSOR_WINDOW_COUNT ? window_names[window] : "unknown";
+}
+
+esp_err_t sensor_stats_init(void)
+{
+    s_lock = xSemaphoreCreateMutex();
+    if (s_lock == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    memset(s_state, 0, sizeof(s_state));
+    for (int s = 0; s < SENSOR_COUNT; s++)
+    {
+        for (int w = 0; w < SENSOR_WINDOW_COUNT; w++)
+        {
+            uint32_t bucket_s = window_span_s[w] / STATS_BUCKETS;
+            s_state[s].windows[w].bucket_s = bucket_s ? bucket_s : 1;
+        }
+        s_state[s].nowcast[0] = s_state[s].nowcast[1] = NAN;
+    }
+    ESP_LOGI(TAG, "%d buckets per window, %u bytes", STATS_BUCKETS, (unsigned)sizeof(s_state));
+    return ESP_OK;
+}
+
+static void deque_push(slot_deque_t *dq, const uint16_t (*v)[SENSOR_CHANNEL_COUNT], int ch, uint8_t slot, bool minimum)
+{
+    uint16_t x = v[slot][ch];
+    while (dq->len)
+    {
+        uint16_t back = v[dq->slot[(dq->head + dq->len - 1) % STATS_BUCKETS]][ch];
+        if (minimum ? back < x : back > x)
+        {
+            break;
+        }
+        dq->len--;
+    }
+    dq->slot[(dq->head + dq->len) % STATS_BUCKETS] = slot;
+    dq->len++;
+}
+
+// The oldest slot is about to be reused; it can only be at the front
+static void deque_expire(slot_deque_t *dq, uint8_t slot)
+{
+    if (dq->len && dq->slot[dq->head] == slot)
+    {
+        dq->head = (dq->head + 1) % STATS_BUCKETS;
+        dq->len--;
+    }
+}
+
+// Move the open bucket into the ring; called again with it empty for gaps
+static void close_bucket(stats_window_t *w)
+{
+    uint8_t slot = w->next;
+
+    if (w->filled == STATS_BUCKETS)
+    {
+        w->total_count -= w->count[slot];
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+        {
+            w->total_sum[ch] -= w->sum[slot][ch];
+            deque_expire(&w->min_dq[ch], slot);
+            deque_expire(&w->max_dq[ch], slot);
+        }
+    }
+    else
+    {
+        w->filled++;
+    }
+
+    w->count[slot] = (uint16_t)w->open_count;
+    w->total_count += w->open_count;
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        w->sum[slot][ch] = w->open_sum[ch];
+        w->min[slot][ch] = w->open_min[ch];
+        w->max[slot][ch] = w->open_max[ch];
+        w->total_sum[ch] += w->open_sum[ch];
+        if (w->open_count)
+        {
+            deque_push(&w->min_dq[ch], w->min, ch, slot, true);
+            deque_push(&w->max_dq[ch], w->max, ch, slot, false);
+        }
+        w->open_sum[ch] = 0;
+    }
+    w->open_count = 0;
+    w->next = (slot + 1) % STATS_BUCKETS;
+}
+
+// Close buckets up to the one holding t_s; a gap of a whole ring empties it
+static void window_advance(stats_window_t *w, uint32_t t_s)
+{
+    uint32_t id = t_s / w->bucket_s;
+
+    if (!w->started)
+    {
+        w->started = true;
+        w->open_id = id;
+        return;
+    }
+    if (id == w->open_id)
+    {
+        return;
+    }
+    // A clock going backwards only closes the open bucket
+    uint32_t steps = id > w->open_id ? id - w->open_id : 1;
+    for (uint32_t i = 0; i < steps && i <= STATS_BUCKETS; i++)
+    {
+        close_bucket(w);
+    }
+    w->open_id = id;
+}
+
+static void window_add(stats_window_t *w, uint32_t t_s, const uint16_t *v)
+{
+    window_advance(w, t_s);
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        if (w->open_count == 0 || v[ch] < w->open_min[ch])
+        {
+            w->open_min[ch] = v[ch];
+        }
+        if (w->open_count == 0 || v[ch] > w->open_max[ch])
+        {
+            w->open_max[ch] = v[ch];
+        }
+        w->open_sum[ch] += v[ch];
+    }
+    w->open_count++;
+}
+
+static void window_get(const stats_window_t *w, sensor_stats_window_t *out)
+{
+    uint32_t n = w->total_count + w->open_count;
+
+    out->bucket_s = w->bucket_s;
+    out->samples = n;
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        if (n == 0)
+        {
+            out->mean[ch] = out->min[ch] = out->max[ch] = NAN;
+            continue;
+        }
+        // The decoded value of 1 is the channel's resolution
+        float resolution = sensor_value_decode(ch, 1);
+        out->mean[ch] = resolution * (float)((double)(w->total_sum[ch] + w->open_sum[ch]) / n);
+
+        const slot_deque_t *lo = &w->min_dq[ch];
+        const slot_deque_t *hi = &w->max_dq[ch];
+        uint32_t min = UINT32_MAX, max = 0;
+        if (lo->len)
+        {
+            min = w->min[lo->slot[lo->head]][ch];
+        }
+        if (hi->len)
+        {
+            max = w->max[hi->slot[hi->head]][ch];
+        }
+        if (w->open_count)
+        {
+            min = w->open_min[ch] < min ? w->open_min[ch] : min;
+            max = w->open_max[ch] > max ? w->open_max[ch] : max;
+        }
+        out->min[ch] = sensor_value_decode(ch, (uint16_t)min);
+        out->max[ch] = sensor_value_decode(ch, (uint16_t)max);
+    }
+}
+
+// Hourly mean i hours back, 0 = the last complete hour
+static float hour_mean(const sensor_stats_state_t *s, int i, int pollutant)
+{
+    if (i >= s->hour_filled)
+    {
+        return NAN;
+    }
+    return s->hourly[(s->hour_next + NOWCAST_HOURS - 1 - i) % NOWCAST_HOURS][pollutant];
+}
+
+/*
+ * EPA NowCast: weight w = min/max of the last 12 hourly means, at least 0.5;
+ * the NowCast is sum(w^i * c_i) / sum(w^i) over the hours with data. Needs
+ * two of the last three hours.
+ */
+static float nowcast(const sensor_stats_state_t *s, int pollutant)
+{
+    int recent = 0;
+    float cmin = INFINITY, cmax = 0.0f;
+
+    for (int i = 0; i < NOWCAST_HOURS; i++)
+    {
+        float c = hour_mean(s, i, pollutant);
+        if (isnan(c))
+        {
+            continue;
+        }
+        recent += i < 3;
+        cmin = c < cmin ? c : cmin;
+        cmax = c > cmax ? c : cmax;
+    }
+    if (recent < 2)
+    {
+        return NAN;
+    }
+
+    float w = cmax > 0.0f ? cmin / cmax : 1.0f;
+    w = w < 0.5f ? 0.5f : w;
+    float num = 0.0f, den = 0.0f, wi = 1.0f;
+    for (int i = 0; i < NOWCAST_HOURS; i++, wi *= w)
+    {
+        float c = hour_mean(s, i, pollutant);
+        if (!isnan(c))
+        {
+            num += wi * c;
+            den += wi;
+        }
+    }
+    return num / den;
+}
+
+static void close_hour(sensor_stats_state_t *s)
+{
+    for (int p = 0; p < 2; p++)
+    {
+        s->hourly[s->hour_next][p] = s->hour_count
+            ? sensor_value_decode(nowcast_channel[p], 1) * ((float)s->hour_sum[p] / s->hour_count) : NAN;
+        s->hour_sum[p] = 0;
+    }
+    s->hour_count = 0;
+    s->hour_next = (s->hour_next + 1) % NOWCAST_HOURS;
+    if (s->hour_filled < NOWCAST_HOURS)
+    {
+        s->hour_filled++;
+    }
+}
+
+static void hour_advance(sensor_stats_state_t *s, uint32_t t_s)
+{
+    uint32_t id = t_s / 3600;
+
+    if (!s->hour_started)
+    {
+        s->hour_started = true;
+        s->hour_id = id;
+        return;
+    }
+    if (id == s->hour_id)
+    {
+        return;
+    }
+    uint32_t steps = id > s->hour_id ? id - s->hour_id : 1;
+    for (uint32_t i = 0; i < steps && i <= NOWCAST_HOURS; i++)
+    {
+        close_hour(s);
+    }
+    s->hour_id = id;
+    s->nowcast[0] = nowcast(s, 0);
+    s->nowcast[1] = nowcast(s, 1);
+}
+
+void sensor_stats_update(const sensor_data_t *data)
+{
+    if (s_lock == NULL || data->sensor_id >= SENSOR_COUNT)
+    {
+        return;
+    }
+    sensor_stats_state_t *s = &s_state[data->sensor_id];
+    uint32_t t_s = (uint32_t)(data->timestamp_ms / 1000);
+    uint16_t v[SENSOR_CHANNEL_COUNT];
+
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        v[ch] = sensor_value_to_fixed(ch, data->values[ch]);
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int w = 0; w < SENSOR_WINDOW_COUNT; w++)
+    {
+        window_add(&s->windows[w], t_s, v);
+    }
+
+    // alpha = dt / (tau + dt) keeps the time constant when readings are irregular
+    if (!s->ewma_started)
+    {
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+        {
+            s->ewma[ch] = sensor_value_to_float(ch, data->values[ch]);
+        }
+        s->ewma_started = true;
+    }
+    else
+    {
+        float dt = (data->timestamp_ms - s->ewma_ms) / 1000.0f;
+        float alpha = dt > 0.0f ? dt / (CONFIG_SENSOR_STATS_EWMA_TAU_S + dt) : 0.0f;
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+        {
+            s->ewma[ch] += alpha * (sensor_value_to_float(ch, data->values[ch]) - s->ewma[ch]);
+        }
+    }
+    s->ewma_ms = data->timestamp_ms;
+
+    hour_advance(s, t_s);
+    s->hour_sum[0] += v[nowcast_channel[0]];
+    s->hour_sum[1] += v[nowcast_channel[1]];
+    s->hour_count++;
+    xSemaphoreGive(s_lock);
+}
+
+// Under s_lock
+static void advance(sensor_stats_state_t *s, int64_t timestamp_ms)
+{
+    uint32_t t_s = (uint32_t)(timestamp_ms / 1000);
+    for (int w = 0; w < SENSOR_WINDOW_COUNT; w++)
+    {
+        if (s->windows[w].started)
+        {
+            window_advance(&s->windows[w], t_s);
+        }
+    }
+    if (s->hour_started)
+    {
+        hour_advance(s, t_s);
+    }
+}
+
+void sensor_stats_derive(int sensor, int64_t timestamp_ms, sensor_derived_t *out)
+{
+    if (s_lock == NULL || sensor < 0 || sensor >= SENSOR_COUNT)
+    {
+        return;
+    }
+    sensor_stats_state_t *s = &s_state[sensor];
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    advance(s, timestamp_ms);
+    for (int w = 0; w < SENSOR_WINDOW_COUNT; w++)
+    {
+        const stats_window_t *win = &s->windows[w];
+        uint32_t n = win->total_count + win->open_count;
+        for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+        {
+            out->mean[w][ch] = n ? sensor_value_decode(ch, 1)
+                * (float)((double)(win->total_sum[ch] + win->open_sum[ch]) / n) : NAN;
+        }
+    }
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        out->ewma[ch] = s->ewma_started ? s->ewma[ch] : NAN;
+    }
+    out->nowcast_pm2_5 = s->nowcast[0];
+    out->nowcast_pm10 = s->nowcast[1];
+    xSemaphoreGive(s_lock);
+
+    out->aqi_pm2_5 = (int16_t)sensor_aqi_pm2_5(out->nowcast_pm2_5);
+    out->aqi_pm10 = (int16_t)sensor_aqi_pm10(out->nowcast_pm10);
+}
+
+esp_err_t sensor_stats_get(int sensor, sensor_stats_t *out)
+{
+    if (out == NULL || sensor < 0 || sensor >= SENSOR_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s_lock == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const sensor_stats_state_t *s = &s_state[sensor];
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int w = 0; w < SENSOR_WINDOW_COUNT; w++)
+    {
+        window_get(&s->windows[w], &out->windows[w]);
+        out->windows[w].span_s = window_span_s[w];
+    }
+    for (int ch = 0; ch < SENSOR_CHANNEL_COUNT; ch++)
+    {
+        out->ewma[ch] = s->ewma_started ? s->ewma[ch] : NAN;
+    }
+    out->nowcast_pm2_5 = s->nowcast[0];
+    out->nowcast_pm10 = s->nowcast[1];
+    out->hours = s->hour_filled;
+    xSemaphoreGive(s_lock);
+
+    out->aqi_pm2_5 = (int16_t)sensor_aqi_pm2_5(out->nowcast_pm2_5);
+    out->aqi_pm10 = (int16_t)sensor_aqi_pm10(out->nowcast_pm10);
+    return ESP_OK;
+}
@@ -32,6 +32,7 @@
 #ifndef SENSIRION_UART_HAL_H
 #define SENSIRION_UART_HAL_H
 
+#include "sdkconfig.h"
 #include "sensirion_config.h"
 #include "sensirion_uart_portdescriptor.h"
 
@@ -39,6 +40,22 @@
 extern "C" {
 #endif
 
+// One port per SPS30; port 0 is used until another one is selected
+#define SENSIRION_UART_HAL_PORTS CONFIG_SPS30_COUNT
+
+/**
+ * sensirion_uart_hal_select_port() - select the sensor the following calls
+ *                                talk to
+ *
+ * @port:       index of the sensor, below SENSIRION_UART_HAL_PORTS
+ *
+ * The driver shares one command buffer, so callers serialise whole
+ * transactions including this call.
+ *
+ * Return:      0 on success, an error code otherwise
+ */
+int16_t sensirion_uart_hal_select_port(uint8_t port);
+
 /**
  * sensirion_uart_hal_init() - initialize UART
  *
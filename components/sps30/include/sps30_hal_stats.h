@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Request-to-response latency of one SHDLC command as seen by the UART HAL.
+ */
+typedef struct
+{
+    uint8_t command;        // SHDLC command byte, e.g. 0x03 read measured values
+    uint32_t count;         // complete responses
+    uint32_t timeouts;      // requests without a complete response
+    uint32_t errors;        // complete responses with a non-zero state byte
+    uint32_t max_us;
+    uint64_t total_us;      // sum over count, for the mean
+    uint64_t rx_bytes;      // response bytes on the wire over count, stuffing included
+} sps30_hal_command_stats_t;
+
+/**
+ * Header of an SHDLC response as received by the UART HAL.
+ */
+typedef struct
+{
+    uint8_t command;
+    uint8_t state;          // MISO state byte, 0 = no error
+    uint8_t data_len;       // e.g. 0 for read measured values without new data
+} sps30_hal_response_t;
+
+/**
+ * @brief Create the lock behind the counters. Call once at startup, before
+ * the HAL is used or the counters are read; sensor_events_init() does.
+ */
+esp_err_t sps30_hal_stats_init(void);
+
+/**
+ * @brief Header of the last response on a port.
+ *
+ * The Sensirion driver does not tell an empty "read measured values"
+ * response (no new data yet) from a full one; this does. Only meaningful
+ * within the transaction that produced the response.
+ *
+ * @return false if the last request on the port got no complete response.
+ */
+bool sps30_hal_last_response(uint8_t port, sps30_hal_response_t *out);
+
+/**
+ * @brief Copy out and reset the per-command counters.
+ *
+ * @return Number of commands written to out.
+ */
+size_t sps30_hal_take_command_stats(sps30_hal_command_stats_t *out, size_t max);
+
+/**
+ * @brief Copy out the per-command counters since boot, all ports together.
+ *
+ * Unlike sps30_hal_take_command_stats() nothing is reset, so the counts
+ * only ever grow; max_us is the worst response since boot.
+ *
+ * @return Number of commands written to out.
+ */
+size_t sps30_hal_get_command_totals(sps30_hal_command_stats_t *out, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
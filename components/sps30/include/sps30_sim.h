@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Start the simulated SPS30 on one end of a byte stream.
+ *
+ * Only available on the linux target. The simulator runs in its own pthread,
+ * decodes SHDLC MOSI frames written to @p fd and answers with MISO frames the
+ * way the real sensor does (start/stop measurement, read values, sleep/wake,
+ * fan cleaning, device information, version, status register and reset).
+ * There is one independent simulator per configured sensor.
+ *
+ * @param index Sensor index, below CONFIG_SPS30_COUNT.
+ * @param fd Socket or pty the host UART HAL talks to.
+ * @return 0 on success, -1 if the simulator thread could not be started.
+ */
+int sps30_sim_start(int index, int fd);
+
+/**
+ * @brief Stop the simulator thread and close its end of the stream.
+ */
+void sps30_sim_stop(int index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -33,16 +33,43 @@
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "esp_log.h"
 #include "sensirion_uart_hal.h"
 #include "sensirion_common.h"
 #include "sensirion_config.h"
 #include "sensirion_uart_portdescriptor.h"
+#include "shdlc_frame.h"
 
 static const char *READ_TAG = "SPS30_HAL_READ";
 static const char *WRITE_TAG = "SPS30_HAL_WRITE";
-#define SPS30_UART_PORT   UART_NUM_2
 #define SPS30_BAUD_RATE   115200
+#define SPS30_RX_BUF_SIZE 256
+#define SPS30_EVENT_QUEUE_LEN 16
+#define SPS30_RX_TIMEOUT  pdMS_TO_TICKS(100)
+
+typedef struct
+{
+    uart_port_t uart;
+    int tx_gpio;
+    int rx_gpio;
+    bool installed;
+    QueueHandle_t queue;
+    shdlc_assembler_t rx;
+} sps30_port_t;
+
+// One entry per sensor, wired up in Kconfig
+static sps30_port_t s_ports[SENSIRION_UART_HAL_PORTS] = 
+{
+    { .uart = CONFIG_SPS30_UART_NUM, .tx_gpio = CONFIG_UART_TX_GPIO, .rx_gpio = CONFIG_UART_RX_GPIO },
+#if CONFIG_SPS30_COUNT >= 2
+    { .uart = CONFIG_SPS30_1_UART_NUM, .tx_gpio = CONFIG_SPS30_1_TX_GPIO, .rx_gpio = CONFIG_SPS30_1_RX_GPIO },
+#endif
+#if CONFIG_SPS30_COUNT >= 3
+    { .uart = CONFIG_SPS30_2_UART_NUM, .tx_gpio = CONFIG_SPS30_2_TX_GPIO, .rx_gpio = CONFIG_SPS30_2_RX_GPIO },
+#endif
+};
+static uint8_t s_current;
 
 // static void hexdump(const char* tag, const uint8_t *buf, size_t len) 
 // {
@@ -63,24 +90,36 @@ static const char *WRITE_TAG = "SPS30_HAL_WRITE";
  */
 
 /**
- * sensirion_uart_hal_select_port() - select the UART port index to use
- *                                THE IMPLEMENTATION IS OPTIONAL ON SINGLE-PORT
- *                                SETUPS (only one SPS30)
+ * sensirion_uart_hal_select_port() - select the sensor the following calls
+ *                                talk to. The driver shares one command
+ *                                buffer, so callers serialise whole
+ *                                transactions including this call.
  *
  * Return:      0 on success, an error code otherwise
  */
 int16_t sensirion_uart_hal_select_port(uint8_t port) {
-    /* TODO: implement */
-    return NOT_IMPLEMENTED_ERROR;
+    if (port >= SENSIRION_UART_HAL_PORTS)
+    {
+        return -1;
+    }
+    s_current = port;
+    return NO_ERROR;
 }
 
 /**
- * sensirion_uart_hal_init() - initialize UART
+ * sensirion_uart_hal_init() - initialize the UART of the selected port.
+ *                             Calling it again for the same port is a no-op.
  *
  * Return:      0 on success, an error code otherwise
  */
-int16_t sensirion_uart_hal_init(UartDescr port) 
+int16_t sensirion_uart_hal_init(UartDescr descr) 
 {
+    sps30_port_t *port = &s_ports[s_current];
+    if (port->installed)
+    {
+        return NO_ERROR;
+    }
+
     const uart_config_t uart_config = 
     {
         .baud_rate = SPS30_BAUD_RATE,
@@ -89,10 +128,16 @@ int16_t sensirion_uart_hal_init(UartDescr port)
         .stop_bits = UART_STOP_BITS_1,
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
     };
-    ESP_ERROR_CHECK(uart_param_config(SPS30_UART_PORT, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(SPS30_UART_PORT, CONFIG_UART_TX_GPIO, CONFIG_UART_RX_GPIO,
+    ESP_ERROR_CHECK(uart_param_config(port->uart, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(port->uart, port->tx_gpio, port->rx_gpio,
                  UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
-    ESP_ERROR_CHECK(uart_driver_install(SPS30_UART_PORT, 256, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_driver_install(port->uart, SPS30_RX_BUF_SIZE, 0,
+                                        SPS30_EVENT_QUEUE_LEN, &port->queue, 0));
+    // Interrupt on every frame delimiter instead of waiting for the RX FIFO
+    // threshold or the idle timeout, so a response is seen as soon as it ends
+    ESP_ERROR_CHECK(uart_enable_pattern_det_baud_intr(port->uart, SHDLC_DELIMITER, 1, 9, 0, 0));
+    ESP_ERROR_CHECK(uart_pattern_queue_reset(port->uart, SPS30_EVENT_QUEUE_LEN));
+    port->installed = true;
 
     return ESP_OK;
 }
@@ -117,14 +162,52 @@ int16_t sensirion_uart_hal_free()
  */
 int16_t sensirion_uart_hal_tx(uint16_t data_len, const uint8_t* data) 
 {
+    sps30_port_t *port = &s_ports[s_current];
     int numBytes = 0;
-    numBytes = uart_write_bytes(SPS30_UART_PORT, (const char*)data, data_len);
+
+    // Whatever is left over belongs to an earlier, abandoned transaction
+    uart_flush_input(port->uart);
+    xQueueReset(port->queue);
+    uart_pattern_queue_reset(port->uart, SPS30_EVENT_QUEUE_LEN);
+    shdlc_assembler_reset(&port->rx);
+    shdlc_stats_request(s_current, data, data_len);
+
+    numBytes = uart_write_bytes(port->uart, (const char*)data, data_len);
     //hexdump(WRITE_TAG, data, data_len);
     return numBytes;
 }
 
 /**
- * sensirion_uart_hal_rx() - receive data over UART
+ * Feed everything the driver has buffered through the frame assembler.
+ *
+ * Return:      Length of the frame copied to data, 0 if none is complete yet
+ */
+static uint16_t rx_drain(sps30_port_t *port, uint16_t max_data_len, uint8_t* data)
+{
+    uint8_t chunk[64];
+    size_t buffered = 0;
+    uint16_t len = 0;
+
+    uart_get_buffered_data_len(port->uart, &buffered);
+    while (buffered > 0 && len == 0)
+    {
+        int n = uart_read_bytes(port->uart, chunk,
+                                buffered < sizeof(chunk) ? buffered : sizeof(chunk), 0);
+        if (n <= 0)
+        {
+            break;
+        }
+        buffered -= n;
+        len = shdlc_assembler_feed(&port->rx, chunk, (uint16_t)n, data, max_data_len);
+    }
+    return len;
+}
+
+/**
+ * sensirion_uart_hal_rx() - receive one SHDLC frame over UART
+ *
+ * Waits on the UART event queue and returns as soon as the closing frame
+ * delimiter arrived, or after 100 ms without a complete frame.
  *
  * @data_len:   max number of bytes to receive
  * @data:       Memory where received data is stored
@@ -132,22 +215,47 @@ int16_t sensirion_uart_hal_tx(uint16_t data_len, const uint8_t* data)
  */
 int16_t sensirion_uart_hal_rx(uint16_t max_data_len, uint8_t* data) 
 {
-    int length = 0;
-    ESP_ERROR_CHECK(uart_get_buffered_data_len(SPS30_UART_PORT, (size_t*)&length));
-    //ESP_LOGI(READ_TAG, "rx buffer len: %d", length);
+    sps30_port_t *port = &s_ports[s_current];
+    TickType_t start = xTaskGetTickCount();
+    uart_event_t event;
 
-    int len = uart_read_bytes(SPS30_UART_PORT, data, max_data_len, pdMS_TO_TICKS(100));
-    if(len > 0)
-    {
-        //uart_flush(SPS30_UART_PORT);
-        //hexdump(READ_TAG, data, len);
-        return len;
-    }
-    else
+    for (;;)
     {
-        ESP_LOGI(READ_TAG, "No data read");
-        return -1;
+        uint16_t len = rx_drain(port, max_data_len, data);
+        if (len > 0)
+        {
+            shdlc_stats_response(s_current, data, len);
+            return len;
+        }
+
+        TickType_t waited = xTaskGetTickCount() - start;
+        if (waited >= SPS30_RX_TIMEOUT ||
+            xQueueReceive(port->queue, &event, SPS30_RX_TIMEOUT - waited) != pdTRUE)
+        {
+            break;
+        }
+
+        switch (event.type)
+        {
+        case UART_PATTERN_DET:
+            // Positions are not needed, the assembler finds the delimiters
+            uart_pattern_pop_pos(port->uart);
+            break;
+        case UART_FIFO_OVF:
+        case UART_BUFFER_FULL:
+            ESP_LOGW(READ_TAG, "RX overflow, dropping frame");
+            uart_flush_input(port->uart);
+            xQueueReset(port->queue);
+            shdlc_assembler_reset(&port->rx);
+            break;
+        default:
+            break;
+        }
     }
+
+    shdlc_stats_response(s_current, NULL, 0);
+    ESP_LOGD(READ_TAG, "No frame within 100 ms");
+    return -1;
 }
 
 /**
@@ -0,0 +1,166 @@
+/*
+ * UART HAL for the linux target.
+ *
+ * Replaces sensirion_uart_hal.c on host builds. Instead of a UART peripheral
+ * the driver talks to the simulated SPS30 (sps30_sim.c) over a socketpair.
+ * Receive semantics follow the ESP32 HAL: a call returns as soon as the
+ * closing delimiter of an SHDLC frame arrived, or after 100 ms without one.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sensirion_uart_hal.h"
+#include "sensirion_common.h"
+#include "sensirion_config.h"
+#include "sensirion_uart_portdescriptor.h"
+#include "sps30_sim.h"
+#include "shdlc_frame.h"
+
+static const char *READ_TAG = "SPS30_HAL_READ";
+#define SPS30_RX_TIMEOUT_US (100 * 1000)
+
+typedef struct
+{
+    int fd;
+    shdlc_assembler_t rx;
+} sps30_port_t;
+
+// Every port talks to its own simulated sensor
+static sps30_port_t s_ports[SENSIRION_UART_HAL_PORTS] = 
+{
+    [0 ... SENSIRION_UART_HAL_PORTS - 1] = { .fd = -1 }
+};
+static uint8_t s_current;
+
+/**
+ * sensirion_uart_hal_select_port() - select the sensor the following calls
+ *                                talk to. Callers serialise transactions.
+ *
+ * Return:      0 on success, an error code otherwise
+ */
+int16_t sensirion_uart_hal_select_port(uint8_t port) {
+    if (port >= SENSIRION_UART_HAL_PORTS)
+    {
+        return -1;
+    }
+    s_current = port;
+    return NO_ERROR;
+}
+
+/**
+ * sensirion_uart_hal_init() - connect the selected port to a simulated sensor
+ *
+ * Return:      0 on success, an error code otherwise
+ */
+int16_t sensirion_uart_hal_init(UartDescr descr)
+{
+    sps30_port_t *port = &s_ports[s_current];
+    if (port->fd >= 0)
+    {
+        return NO_ERROR;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    {
+        ESP_LOGE(READ_TAG, "socketpair failed: %d", errno);
+        return -1;
+    }
+    if (sps30_sim_start(s_current, fds[1]) != 0)
+    {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    port->fd = fds[0];
+    return NO_ERROR;
+}
+
+/**
+ * sensirion_uart_hal_free() - disconnect from the simulated sensor
+ *
+ * Return:      0 on success, an error code otherwise
+ */
+int16_t sensirion_uart_hal_free()
+{
+    sps30_port_t *port = &s_ports[s_current];
+    if (port->fd < 0)
+    {
+        return NO_ERROR;
+    }
+    close(port->fd);
+    port->fd = -1;
+    sps30_sim_stop(s_current);
+    return NO_ERROR;
+}
+
+int16_t sensirion_uart_hal_tx(uint16_t data_len, const uint8_t* data)
+{
+    sps30_port_t *port = &s_ports[s_current];
+    size_t off = 0;
+
+    // Whatever is left over belongs to an earlier, abandoned transaction
+    shdlc_assembler_reset(&port->rx);
+    shdlc_stats_request(s_current, data, data_len);
+    while (off < data_len)
+    {
+        ssize_t n = write(port->fd, data + off, data_len - off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        off += (size_t)n;
+    }
+    return (int16_t)data_len;
+}
+
+int16_t sensirion_uart_hal_rx(uint16_t max_data_len, uint8_t* data)
+{
+    sps30_port_t *port = &s_ports[s_current];
+    int64_t deadline = esp_timer_get_time() + SPS30_RX_TIMEOUT_US;
+    uint8_t chunk[64];
+
+    for (;;)
+    {
+        int64_t remaining_us = deadline - esp_timer_get_time();
+        if (remaining_us <= 0)
+            break;
+
+        struct pollfd pfd = { .fd = port->fd, .events = POLLIN };
+        int pr = poll(&pfd, 1, (int)((remaining_us + 999) / 1000));
+        if (pr < 0 && errno != EINTR)
+            break;
+        if (pr <= 0)
+            continue;
+
+        ssize_t n = read(port->fd, chunk, sizeof(chunk));
+        if (n > 0)
+        {
+            uint16_t len = shdlc_assembler_feed(&port->rx, chunk, (uint16_t)n, data, max_data_len);
+            if (len > 0)
+            {
+                shdlc_stats_response(s_current, data, len);
+                return (int16_t)len;
+            }
+        }
+        else if (n == 0 || errno != EINTR)
+            break;
+    }
+
+    shdlc_stats_response(s_current, NULL, 0);
+    ESP_LOGD(READ_TAG, "No frame within %d ms", SPS30_RX_TIMEOUT_US / 1000);
+    return -1;
+}
+
+void sensirion_uart_hal_sleep_usec(uint32_t useconds)
+{
+    vTaskDelay(pdMS_TO_TICKS(useconds / 1000));
+}
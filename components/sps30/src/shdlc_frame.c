@@ -0,0 +1,168 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "shdlc_frame.h"
+#include "sensirion_uart_hal.h"
+#include "sps30_hal_stats.h"
+
+// Distinct commands tracked; the SPS30 has eleven
+#define STATS_COMMANDS 16
+
+static sps30_hal_command_stats_t s_stats[STATS_COMMANDS];
+static size_t s_stats_count;
+// Same counters since boot, never reset
+static sps30_hal_command_stats_t s_totals[STATS_COMMANDS];
+static size_t s_totals_count;
+static SemaphoreHandle_t s_stats_lock;   // created by sps30_hal_stats_init()
+// Command byte awaiting its response on each port, or -1
+static int s_pending[SENSIRION_UART_HAL_PORTS] = { [0 ... SENSIRION_UART_HAL_PORTS - 1] = -1 };
+static int64_t s_pending_since_us[SENSIRION_UART_HAL_PORTS];
+// Header of the last complete response on each port
+static sps30_hal_response_t s_last[SENSIRION_UART_HAL_PORTS];
+static bool s_last_valid[SENSIRION_UART_HAL_PORTS];
+
+uint16_t shdlc_assembler_feed(shdlc_assembler_t *a, const uint8_t *data, uint16_t len,
+                              uint8_t *out, uint16_t max_len)
+{
+    uint16_t copied = 0;
+    bool done = false;
+
+    for (uint16_t i = 0; i < len; i++)
+    {
+        if (!shdlc_assembler_push(a, data[i]))
+        {
+            continue;
+        }
+        // A second response in one chunk is stale; only the first is returned
+        if (!done)
+        {
+            copied = a->len < max_len ? a->len : max_len;
+            memcpy(out, a->frame, copied);
+            done = true;
+        }
+        a->len = 0;
+    }
+    return copied;
+}
+
+/**
+ * Unstuff ADR, CMD, STATE and LEN of a MISO frame.
+ */
+static bool parse_header(const uint8_t *frame, uint16_t len, uint8_t header[4])
+{
+    int n = 0;
+    for (uint16_t i = 1; i + 1 < len && n < 4; i++)
+    {
+        uint8_t b = frame[i];
+        if (b == 0x7D)
+        {
+            if (++i + 1 >= len)
+            {
+                return false;
+            }
+            b = frame[i] ^ 0x20;
+        }
+        header[n++] = b;
+    }
+    return n == 4;
+}
+
+static void count_response(sps30_hal_command_stats_t *stats, size_t *count, int command,
+                           bool complete, bool error, uint32_t us, uint16_t len)
+{
+    size_t i = 0;
+    while (i < *count && stats[i].command != command) i++;
+    if (i == *count && *count < STATS_COMMANDS)
+    {
+        memset(&stats[i], 0, sizeof(stats[i]));
+        stats[i].command = (uint8_t)command;
+        (*count)++;
+    }
+    if (i < *count)
+    {
+        sps30_hal_command_stats_t *st = &stats[i];
+        if (complete)
+        {
+            st->count++;
+            st->total_us += us;
+            st->rx_bytes += len;
+            if (us > st->max_us) st->max_us = us;
+            if (error) st->errors++;
+        }
+        else
+        {
+            st->timeouts++;
+        }
+    }
+}
+
+esp_err_t sps30_hal_stats_init(void)
+{
+    s_stats_lock = xSemaphoreCreateMutex();
+    return s_stats_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void shdlc_stats_request(int port, const uint8_t *frame, uint16_t len)
+{
+    // 0x7E, address, command, ...
+    s_pending[port] = len > 2 ? frame[2] : -1;
+    s_pending_since_us[port] = esp_timer_get_time();
+}
+
+void shdlc_stats_response(int port, const uint8_t *frame, uint16_t len)
+{
+    bool complete = frame != NULL;
+    uint8_t header[4];
+
+    s_last_valid[port] = complete && parse_header(frame, len, header);
+    if (s_last_valid[port])
+    {
+        s_last[port].command = header[1];
+        s_last[port].state = header[2];
+        s_last[port].data_len = header[3];
+    }
+
+    int command = s_pending[port];
+    if (command < 0)
+    {
+        return;
+    }
+    uint32_t us = (uint32_t)(esp_timer_get_time() - s_pending_since_us[port]);
+    bool error = s_last_valid[port] && s_last[port].state != 0;
+
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    count_response(s_stats, &s_stats_count, command, complete, error, us, len);
+    count_response(s_totals, &s_totals_count, command, complete, error, us, len);
+    xSemaphoreGive(s_stats_lock);
+    s_pending[port] = -1;
+}
+
+bool sps30_hal_last_response(uint8_t port, sps30_hal_response_t *out)
+{
+    if (port >= SENSIRION_UART_HAL_PORTS || !s_last_valid[port])
+    {
+        return false;
+    }
+    *out = s_last[port];
+    return true;
+}
+
+size_t sps30_hal_take_command_stats(sps30_hal_command_stats_t *out, size_t max)
+{
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    size_t n = s_stats_count < max ? s_stats_count : max;
+    memcpy(out, s_stats, n * sizeof(*out));
+    s_stats_count = 0;
+    xSemaphoreGive(s_stats_lock);
+    return n;
+}
+
+size_t sps30_hal_get_command_totals(sps30_hal_command_stats_t *out, size_t max)
+{
+    xSemaphoreTake(s_stats_lock, portMAX_DELAY);
+    size_t n = s_totals_count < max ? s_totals_count : max;
+    memcpy(out, s_totals, n * sizeof(*out));
+    xSemaphoreGive(s_stats_lock);
+    return n;
+}
@@ -0,0 +1,70 @@
+/*
+ * Incremental SHDLC frame assembler shared by the UART HALs.
+ *
+ * The Sensirion driver asks the HAL for the largest possible (fully stuffed)
+ * frame, so a HAL that waits for max_data_len bytes always runs into its
+ * timeout. Feeding received bytes through the assembler lets the HAL return
+ * as soon as the closing 0x7E of the response has arrived.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SHDLC_DELIMITER     0x7E
+#define SHDLC_FRAME_MAX     (2 + (5 + 255) * 2)
+
+typedef struct
+{
+    uint8_t frame[SHDLC_FRAME_MAX];
+    uint16_t len;       // bytes of the open frame, opening delimiter included
+} shdlc_assembler_t;
+
+static inline void shdlc_assembler_reset(shdlc_assembler_t *a)
+{
+    a->len = 0;
+}
+
+/**
+ * Add one received byte. Bytes outside a frame are skipped and an overlong
+ * frame is dropped, so the assembler resynchronises on the next delimiter.
+ *
+ * @return true when the byte closed a frame; frame[0..len) then holds it,
+ *         both delimiters included, until the next push.
+ */
+static inline bool shdlc_assembler_push(shdlc_assembler_t *a, uint8_t byte)
+{
+    if (a->len == 0 || a->len == SHDLC_FRAME_MAX)
+    {
+        a->len = 0;
+        if (byte == SHDLC_DELIMITER)
+        {
+            a->frame[a->len++] = byte;
+        }
+        return false;
+    }
+    if (byte == SHDLC_DELIMITER && a->len == 1)
+    {
+        return false;   // two delimiters in a row: the second one opens the frame
+    }
+    a->frame[a->len++] = byte;
+    return byte == SHDLC_DELIMITER;
+}
+
+/**
+ * Push a received chunk. The first frame completed is copied to out (cut to
+ * max_len); bytes after it start the next frame.
+ *
+ * @return Length copied to out, or 0 if no frame was completed.
+ */
+uint16_t shdlc_assembler_feed(shdlc_assembler_t *a, const uint8_t *data, uint16_t len,
+                              uint8_t *out, uint16_t max_len);
+
+/**
+ * Per-command latency bookkeeping behind sps30_hal_take_command_stats() and
+ * sps30_hal_last_response(). Called by the HAL when a request was written and
+ * with the complete response frame, or NULL when it timed out.
+ */
+void shdlc_stats_request(int port, const uint8_t *frame, uint16_t len);
+void shdlc_stats_response(int port, const uint8_t *frame, uint16_t len);
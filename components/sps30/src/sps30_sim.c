@@ -0,0 +1,476 @@
+/*
+ * Simulated SPS30 for the linux target.
+ *
+ * Speaks SHDLC over a byte stream: frames are delimited by 0x7E, byte stuffed
+ * with 0x7D and protected by the inverted 8-bit sum checksum described in the
+ * SPS30 datasheet. Measurement values follow a seeded random walk so runs are
+ * reproducible. Like the real sensor, a new reading is available once per
+ * second of the sensor's own clock and reading values in between returns an
+ * empty response.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "sdkconfig.h"
+#include "sps30_sim.h"
+
+#define SHDLC_START         0x7E
+#define SHDLC_ESCAPE        0x7D
+#define SHDLC_XOR           0x20
+#define SHDLC_MAX_DATA      255
+#define SHDLC_MAX_FRAME     (2 + (5 + SHDLC_MAX_DATA) * 2)
+
+#define SIM_UART_BYTE_NS    (10ULL * 1000000000ULL / 115200ULL)
+
+// SHDLC commands understood by the SPS30
+#define CMD_START_MEASUREMENT   0x00
+#define CMD_STOP_MEASUREMENT    0x01
+#define CMD_READ_VALUES         0x03
+#define CMD_SLEEP               0x10
+#define CMD_WAKE_UP             0x11
+#define CMD_FAN_CLEANING        0x56
+#define CMD_AUTO_CLEAN_INTERVAL 0x80
+#define CMD_DEVICE_INFO         0xD0
+#define CMD_READ_VERSION        0xD1
+#define CMD_STATUS_REGISTER     0xD2
+#define CMD_RESET               0xD3
+
+// MISO state byte
+#define STATE_OK                0x00
+#define STATE_WRONG_LENGTH      0x01
+#define STATE_UNKNOWN_COMMAND   0x02
+#define STATE_ILLEGAL_PARAMETER 0x04
+#define STATE_NOT_ALLOWED       0x43
+
+#define FORMAT_FLOAT  0x03
+#define FORMAT_UINT16 0x05
+
+#define SIM_CHANNELS 10
+
+typedef enum
+{
+    SIM_IDLE,
+    SIM_MEASURING,
+    SIM_SLEEPING
+} sim_mode_t;
+
+typedef struct
+{
+    int fd;
+    pthread_t thread;
+    atomic_bool running;    // cleared by sps30_sim_stop(), polled by the simulator thread
+
+    sim_mode_t mode;
+    uint8_t format;
+    int64_t measure_start_ns;
+    int64_t fan_clean_until_ns;
+    uint32_t auto_clean_interval_s;
+    uint32_t rng;
+    float values[SIM_CHANNELS];
+    int64_t values_second;
+    int64_t read_second;        // values_second of the last read; no new data until it advances
+    char serial[32];
+} sps30_sim_t;
+
+static sps30_sim_t s_sims[CONFIG_SPS30_COUNT] = { [0 ... CONFIG_SPS30_COUNT - 1] = { .fd = -1 } };
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_ns(int64_t ns)
+{
+    if (ns <= 0)
+        return;
+    struct timespec ts = { .tv_sec = ns / 1000000000LL, .tv_nsec = ns % 1000000000LL };
+    while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+    {
+    }
+}
+
+static uint32_t sim_rand(sps30_sim_t *sim)
+{
+    // xorshift32
+    uint32_t x = sim->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim->rng = x;
+    return x;
+}
+
+static float sim_noise(sps30_sim_t *sim, float amplitude)
+{
+    return ((float)(sim_rand(sim) & 0xFFFF) / 32768.0f - 1.0f) * amplitude;
+}
+
+/**
+ * Advance the random walk to the current measurement second. The sensor
+ * produces one new reading per second while measuring.
+ */
+static void sim_update_values(sps30_sim_t *sim)
+{
+    int64_t elapsed_ns = now_ns() - sim->measure_start_ns;
+    int64_t second = (elapsed_ns + elapsed_ns / 1000000 * CONFIG_SPS30_SIM_CLOCK_PPM) / 1000000000LL;
+    while (sim->values_second < second)
+    {
+        sim->values_second++;
+
+        float pm2_5 = sim->values[1] + sim_noise(sim, 0.6f);
+        if (pm2_5 < 0.5f) pm2_5 = 0.5f;
+        if (pm2_5 > 400.0f) pm2_5 = 400.0f;
+
+        // Mass concentrations are cumulative (PM1.0 <= PM2.5 <= PM4.0 <= PM10)
+        sim->values[0] = pm2_5 * 0.92f;
+        sim->values[1] = pm2_5;
+        sim->values[2] = pm2_5 * 1.04f;
+        sim->values[3] = pm2_5 * 1.06f;
+        // Number concentrations, also cumulative
+        sim->values[4] = pm2_5 * 6.1f;
+        sim->values[5] = pm2_5 * 7.0f;
+        sim->values[6] = pm2_5 * 7.2f;
+        sim->values[7] = pm2_5 * 7.21f;
+        sim->values[8] = pm2_5 * 7.22f;
+        sim->values[9] = 0.55f + sim_noise(sim, 0.05f);
+    }
+}
+
+static void put_be32(uint8_t *dst, uint32_t v)
+{
+    dst[0] = (uint8_t)(v >> 24);
+    dst[1] = (uint8_t)(v >> 16);
+    dst[2] = (uint8_t)(v >> 8);
+    dst[3] = (uint8_t)v;
+}
+
+static size_t stuff_byte(uint8_t *dst, uint8_t b)
+{
+    if (b == SHDLC_START || b == SHDLC_ESCAPE || b == 0x11 || b == 0x13)
+    {
+        dst[0] = SHDLC_ESCAPE;
+        dst[1] = b ^ SHDLC_XOR;
+        return 2;
+    }
+    dst[0] = b;
+    return 1;
+}
+
+/**
+ * Encode and send a MISO frame, holding it back for the time the bytes would
+ * take on a 115200 baud line.
+ */
+static void sim_respond(sps30_sim_t *sim, size_t request_len, uint8_t cmd, uint8_t state,
+                        const uint8_t *data, uint8_t len)
+{
+    uint8_t frame[SHDLC_MAX_FRAME];
+    size_t n = 0;
+    uint8_t sum = 0;
+
+    frame[n++] = SHDLC_START;
+    const uint8_t header[4] = { 0x00, cmd, state, len };
+    for (int i = 0; i < 4; i++)
+    {
+        sum += header[i];
+        n += stuff_byte(&frame[n], header[i]);
+    }
+    for (int i = 0; i < len; i++)
+    {
+        sum += data[i];
+        n += stuff_byte(&frame[n], data[i]);
+    }
+    n += stuff_byte(&frame[n], (uint8_t)~sum);
+    frame[n++] = SHDLC_START;
+
+#if CONFIG_SPS30_SIM_UART_TIMING
+    sleep_ns((int64_t)(request_len + n) * SIM_UART_BYTE_NS + CONFIG_SPS30_SIM_RESPONSE_US * 1000LL);
+#endif
+
+    size_t off = 0;
+    while (off < n)
+    {
+        ssize_t w = write(sim->fd, frame + off, n - off);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        off += (size_t)w;
+    }
+}
+
+static void sim_handle(sps30_sim_t *sim, size_t request_len, uint8_t cmd, const uint8_t *data, uint8_t len)
+{
+    uint8_t out[64];
+    uint8_t out_len = 0;
+    uint8_t state = STATE_OK;
+
+    // A sleeping sensor only reacts to the wake-up command
+    if (sim->mode == SIM_SLEEPING && cmd != CMD_WAKE_UP)
+        return;
+
+    switch (cmd)
+    {
+    case CMD_START_MEASUREMENT:
+        if (len != 2 || data[0] != 0x01)
+            state = STATE_WRONG_LENGTH;
+        else if (data[1] != FORMAT_FLOAT && data[1] != FORMAT_UINT16)
+            state = STATE_ILLEGAL_PARAMETER;
+        else if (sim->mode != SIM_IDLE)
+            state = STATE_NOT_ALLOWED;
+        else
+        {
+            sim->mode = SIM_MEASURING;
+            sim->format = data[1];
+            sim->measure_start_ns = now_ns();
+            sim->values_second = 0;
+            sim->read_second = 0;
+        }
+        break;
+
+    case CMD_STOP_MEASUREMENT:
+        if (sim->mode == SIM_MEASURING)
+            sim->mode = SIM_IDLE;
+        break;
+
+    case CMD_READ_VALUES:
+        if (sim->mode != SIM_MEASURING)
+        {
+            state = STATE_NOT_ALLOWED;
+            break;
+        }
+        sim_update_values(sim);
+        // Like the real sensor: an empty response until the next second's values exist
+        if (sim->values_second == sim->read_second)
+            break;
+        sim->read_second = sim->values_second;
+        for (int i = 0; i < SIM_CHANNELS; i++)
+        {
+            if (sim->format == FORMAT_FLOAT)
+            {
+                uint32_t bits;
+                memcpy(&bits, &sim->values[i], sizeof(bits));
+                put_be32(&out[out_len], bits);
+                out_len += 4;
+            }
+            else
+            {
+                // uint16 format: typical particle size is reported in nm
+                float v = (i == SIM_CHANNELS - 1) ? sim->values[i] * 1000.0f : sim->values[i];
+                uint16_t u = (uint16_t)(v + 0.5f);
+                out[out_len++] = (uint8_t)(u >> 8);
+                out[out_len++] = (uint8_t)u;
+            }
+        }
+        break;
+
+    case CMD_SLEEP:
+        if (sim->mode != SIM_IDLE)
+            state = STATE_NOT_ALLOWED;
+        else
+            sim->mode = SIM_SLEEPING;
+        break;
+
+    case CMD_WAKE_UP:
+        if (sim->mode == SIM_SLEEPING)
+            sim->mode = SIM_IDLE;
+        break;
+
+    case CMD_FAN_CLEANING:
+        if (sim->mode != SIM_MEASURING)
+            state = STATE_NOT_ALLOWED;
+        else
+            sim->fan_clean_until_ns = now_ns() + 10LL * 1000000000LL;
+        break;
+
+    case CMD_AUTO_CLEAN_INTERVAL:
+        if (len == 1 && data[0] == 0x00)
+        {
+            put_be32(out, sim->auto_clean_interval_s);
+            out_len = 4;
+        }
+        else if (len == 5 && data[0] == 0x00)
+        {
+            sim->auto_clean_interval_s = ((uint32_t)data[1] << 24) | ((uint32_t)data[2] << 16) |
+                                         ((uint32_t)data[3] << 8) | data[4];
+        }
+        else
+            state = STATE_WRONG_LENGTH;
+        break;
+
+    case CMD_DEVICE_INFO:
+    {
+        const char *info = NULL;
+        if (len == 1 && data[0] == 0x00)
+            info = "00080000";
+        else if (len == 1 && data[0] == 0x03)
+            info = sim->serial;
+        if (info == NULL)
+        {
+            state = STATE_ILLEGAL_PARAMETER;
+            break;
+        }
+        out_len = (uint8_t)strnlen(info, 31) + 1;
+        memcpy(out, info, out_len);
+        break;
+    }
+
+    case CMD_READ_VERSION:
+    {
+        const uint8_t version[7] = { 2, 2, 0, 7, 0, 2, 0 };
+        memcpy(out, version, sizeof(version));
+        out_len = sizeof(version);
+        break;
+    }
+
+    case CMD_STATUS_REGISTER:
+    {
+        // bit 19: fan speed warning, set while cleaning spins the fan up
+        uint32_t reg = (now_ns() < sim->fan_clean_until_ns) ? (1UL << 19) : 0;
+        put_be32(out, reg);
+        out[4] = 0;
+        out_len = 5;
+        break;
+    }
+
+    case CMD_RESET:
+        sim->mode = SIM_IDLE;
+        break;
+
+    default:
+        state = STATE_UNKNOWN_COMMAND;
+        break;
+    }
+
+    sim_respond(sim, request_len, cmd, state, out, out_len);
+}
+
+static void *sim_thread(void *arg)
+{
+    sps30_sim_t *sim = (sps30_sim_t *)arg;
+    uint8_t raw[256];
+    uint8_t frame[4 + SHDLC_MAX_DATA + 1];
+    size_t frame_len = 0;
+    size_t wire_len = 0;
+    bool in_frame = false;
+    bool escape = false;
+
+    while (atomic_load(&sim->running))
+    {
+        struct pollfd pfd = { .fd = sim->fd, .events = POLLIN };
+        int pr = poll(&pfd, 1, 100);
+        if (pr <= 0)
+            continue;
+
+        ssize_t n = read(sim->fd, raw, sizeof(raw));
+        if (n == 0)
+            break;
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            break;
+        }
+
+        for (ssize_t i = 0; i < n; i++)
+        {
+            uint8_t b = raw[i];
+            if (b == SHDLC_START)
+            {
+                wire_len++;
+                // A closing delimiter with at least ADR, CMD, LEN and CHK completes the frame
+                if (in_frame && frame_len >= 4)
+                {
+                    uint8_t sum = 0;
+                    for (size_t k = 0; k < frame_len - 1; k++)
+                        sum += frame[k];
+                    uint8_t chk = (uint8_t)~sum;
+                    uint8_t len = frame[2];
+                    if (chk == frame[frame_len - 1] && (size_t)len + 4 == frame_len)
+                        sim_handle(sim, wire_len, frame[1], &frame[3], len);
+                    in_frame = false;
+                }
+                else
+                {
+                    in_frame = true;
+                }
+                frame_len = 0;
+                wire_len = in_frame ? 1 : 0;
+                escape = false;
+                continue;
+            }
+            if (!in_frame)
+                continue;
+
+            wire_len++;
+            if (b == SHDLC_ESCAPE)
+            {
+                escape = true;
+                continue;
+            }
+            if (escape)
+            {
+                b ^= SHDLC_XOR;
+                escape = false;
+            }
+            if (frame_len < sizeof(frame))
+                frame[frame_len++] = b;
+            else
+                in_frame = false;
+        }
+    }
+    return NULL;
+}
+
+int sps30_sim_start(int index, int fd)
+{
+    if (index < 0 || index >= CONFIG_SPS30_COUNT)
+        return -1;
+    sps30_sim_t *sim = &s_sims[index];
+    if (atomic_load(&sim->running))
+        return -1;
+
+    sim->fd = fd;
+    sim->mode = SIM_IDLE;
+    sim->format = FORMAT_FLOAT;
+    sim->auto_clean_interval_s = 604800;
+    // Every unit walks its own path from a slightly different start
+    uint32_t seed = (uint32_t)CONFIG_SPS30_SIM_SEED + (uint32_t)index;
+    sim->rng = seed ? seed : 1;
+    sim->values[1] = 8.0f + 2.0f * index;
+    // Same serial number with the last character bumped by the index
+    strncpy(sim->serial, CONFIG_SPS30_SIM_SERIAL, sizeof(sim->serial) - 1);
+    size_t len = strlen(sim->serial);
+    if (len > 0)
+        sim->serial[len - 1] = (char)(sim->serial[len - 1] + index);
+    atomic_store(&sim->running, true);
+
+    if (pthread_create(&sim->thread, NULL, sim_thread, sim) != 0)
+    {
+        atomic_store(&sim->running, false);
+        return -1;
+    }
+    return 0;
+}
+
+void sps30_sim_stop(int index)
+{
+    if (index < 0 || index >= CONFIG_SPS30_COUNT)
+        return;
+    sps30_sim_t *sim = &s_sims[index];
+    if (!atomic_load(&sim->running))
+        return;
+    atomic_store(&sim->running, false);
+    pthread_join(sim->thread, NULL);
+    close(sim->fd);
+    sim->fd = -1;
+}
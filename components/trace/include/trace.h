@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Begin/end trace points on the hot path, exported by GET /api/trace as
+ * Chrome Trace Event JSON (opens in Perfetto or chrome://tracing).
+ *
+ * Events go into a ring per core with esp_timer_get_time() stamps; writers
+ * never lock or wait and the oldest events are overwritten. With
+ * CONFIG_TRACE_ENABLE off the macros expand to nothing and their arguments
+ * are not evaluated.
+ *
+ * Names must be string literals: only the pointer is stored.
+ */
+
+typedef enum
+{
+    TRACE_PHASE_BEGIN = 'B',        // span on the recording task
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_ASYNC_BEGIN = 'b',  // span that ends on another task, matched by id
+    TRACE_PHASE_ASYNC_END = 'e',
+} trace_phase_t;
+
+typedef struct
+{
+    int64_t ts_us;
+    const char *name;
+    uint32_t id;            // async spans only
+    uint8_t phase;          // trace_phase_t
+    uint8_t thread;         // see trace_thread_name()
+    uint8_t core;
+} trace_event_t;
+
+typedef void (*trace_visit_fn)(const trace_event_t *event, void *ctx);
+
+#if CONFIG_TRACE_ENABLE
+
+#define TRACE_BEGIN(name)           trace_record((name), TRACE_PHASE_BEGIN, 0)
+#define TRACE_END(name)             trace_record((name), TRACE_PHASE_END, 0)
+#define TRACE_ASYNC_BEGIN(name, id) trace_record((name), TRACE_PHASE_ASYNC_BEGIN, (uint32_t)(id))
+#define TRACE_ASYNC_END(name, id)   trace_record((name), TRACE_PHASE_ASYNC_END, (uint32_t)(id))
+
+/**
+ * @brief Record one event on the ring of the current core. Lock-free.
+ */
+void trace_record(const char *name, trace_phase_t phase, uint32_t id);
+
+/**
+ * @brief Visit the events still in the rings, oldest first per core.
+ *
+ * Recording continues meanwhile; events overwritten while they are being
+ * read are skipped.
+ */
+void trace_foreach(trace_visit_fn fn, void *ctx);
+
+/**
+ * @brief Name of the task an event was recorded on, or NULL past the last
+ * known task. Task names are captured when a task records its first event.
+ */
+const char *trace_thread_name(uint8_t thread);
+
+#else
+
+#define TRACE_BEGIN(name)           do { } while (0)
+#define TRACE_END(name)             do { } while (0)
+#define TRACE_ASYNC_BEGIN(name, id) do { } while (0)
+#define TRACE_ASYNC_END(name, id)   do { } while (0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
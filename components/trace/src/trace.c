@@ -0,0 +1,133 @@
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "trace.h"
+
+/*
+ * Each core has a ring of CONFIG_TRACE_RING_EVENTS slots. A writer claims
+ * event number n with a fetch-add on the ring head, zeroes the slot's seq,
+ * writes the event and stores n + 1 in seq. A reader accepts a slot only if
+ * seq holds the number it expects before and after copying it, the same
+ * scheme as the sensor bus. A task preempted in the middle of a write for a
+ * full ring of events can still leave a mixed slot behind; with a ring of
+ * hundreds of events that is not worth a lock.
+ */
+
+#define RING CONFIG_TRACE_RING_EVENTS
+#define MAX_THREADS 32
+
+typedef struct
+{
+    atomic_uint seq;
+    trace_event_t event;
+} trace_slot_t;
+
+typedef struct
+{
+    atomic_uint head;
+    trace_slot_t slots[RING];
+} trace_ring_t;
+
+typedef struct
+{
+    atomic_uintptr_t task;
+    atomic_bool named;
+    char name[configMAX_TASK_NAME_LEN];
+} trace_thread_t;
+
+static trace_ring_t s_rings[portNUM_PROCESSORS];
+static trace_thread_t s_threads[MAX_THREADS];
+
+/**
+ * Index of the calling task in s_threads, claiming a free entry on its first
+ * event. Tasks beyond MAX_THREADS share the index MAX_THREADS.
+ */
+static uint8_t thread_index(void)
+{
+    uintptr_t self = (uintptr_t)xTaskGetCurrentTaskHandle();
+
+    for (int i = 0; i < MAX_THREADS; i++)
+    {
+        trace_thread_t *t = &s_threads[i];
+        uintptr_t task = atomic_load_explicit(&t->task, memory_order_acquire);
+        if (task == self)
+        {
+            return i;
+        }
+        if (task == 0)
+        {
+            if (atomic_compare_exchange_strong(&t->task, &task, self))
+            {
+                strncpy(t->name, pcTaskGetName(NULL), sizeof(t->name) - 1);
+                atomic_store_explicit(&t->named, true, memory_order_release);
+                return i;
+            }
+            if (task == self)
+            {
+                return i;
+            }
+        }
+    }
+    return MAX_THREADS;
+}
+
+void trace_record(const char *name, trace_phase_t phase, uint32_t id)
+{
+    int64_t now = esp_timer_get_time();
+    uint8_t core = (uint8_t)xPortGetCoreID();
+    trace_ring_t *ring = &s_rings[core];
+
+    unsigned n = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+    trace_slot_t *slot = &ring->slots[n % RING];
+
+    atomic_store_explicit(&slot->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->event.ts_us = now;
+    slot->event.name = name;
+    slot->event.id = id;
+    slot->event.phase = (uint8_t)phase;
+    slot->event.thread = thread_index();
+    slot->event.core = core;
+    atomic_store_explicit(&slot->seq, n + 1, memory_order_release);
+}
+
+void trace_foreach(trace_visit_fn fn, void *ctx)
+{
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        trace_ring_t *ring = &s_rings[core];
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        unsigned start = head > RING ? head - RING : 0;
+
+        for (unsigned n = start; n != head; n++)
+        {
+            trace_slot_t *slot = &ring->slots[n % RING];
+            if (atomic_load_explicit(&slot->seq, memory_order_acquire) != n + 1)
+            {
+                continue;   // overwritten, or claimed and not written yet
+            }
+            trace_event_t event = slot->event;
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != n + 1)
+            {
+                continue;
+            }
+            fn(&event, ctx);
+        }
+    }
+}
+
+const char *trace_thread_name(uint8_t thread)
+{
+    if (thread >= MAX_THREADS)
+    {
+        return thread == MAX_THREADS ? "other" : NULL;
+    }
+    if (!atomic_load_explicit(&s_threads[thread].named, memory_order_acquire))
+    {
+        return NULL;
+    }
+    return s_threads[thread].name;
+}
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "asset_bundle.h"
+
+static const char *TAG = "asset_bundle";
+
+static const uint8_t *s_base;
+static const asset_bundle_entry_t *s_index;
+static uint16_t s_count;
+static esp_partition_mmap_handle_t s_mmap;
+
+esp_err_t asset_bundle_init(void)
+{
+    const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "www");
+    if (!part)
+    {
+        ESP_LOGE(TAG, "no \"www\" partition");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    asset_bundle_header_t hdr;
+    esp_err_t err = esp_partition_read(part, 0, &hdr, sizeof(hdr));
+    if (err != ESP_OK)
+    {
+        return err;
+    }
+    if (hdr.magic != ASSET_BUNDLE_MAGIC || hdr.version != ASSET_BUNDLE_VERSION
+        || hdr.total_len > part->size
+        || sizeof(hdr) + (size_t)hdr.count * sizeof(asset_bundle_entry_t) > hdr.total_len)
+    {
+        ESP_LOGE(TAG, "\"www\" partition holds no valid asset bundle");
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Map only the bundle, not the whole partition
+    const void *ptr;
+    err = esp_partition_mmap(part, 0, hdr.total_len, ESP_PARTITION_MMAP_DATA, &ptr, &s_mmap);
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "esp_partition_mmap failed: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    s_base = ptr;
+    s_index = (const asset_bundle_entry_t *)(s_base + sizeof(asset_bundle_header_t));
+    for (uint16_t i = 0; i < hdr.count; i++)
+    {
+        const asset_bundle_entry_t *e = &s_index[i];
+        if ((uint64_t)e->offset + e->length > hdr.total_len
+            || e->path[sizeof(e->path) - 1] || e->type[sizeof(e->type) - 1] || e->etag[sizeof(e->etag) - 1])
+        {
+            ESP_LOGE(TAG, "corrupt bundle entry %u", i);
+            esp_partition_munmap(s_mmap);
+            s_base = NULL;
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    s_count = hdr.count;
+    ESP_LOGI(TAG, "%u assets, %u bytes mapped", s_count, (unsigned)hdr.total_len);
+    return ESP_OK;
+}
+
+static int compare_entry(const void *key, const void *elem)
+{
+    return strcmp((const char *)key, ((const asset_bundle_entry_t *)elem)->path);
+}
+
+bool asset_bundle_find(const char *uri_path, asset_t *out)
+{
+    if (!s_base)
+    {
+        return false;
+    }
+
+    const asset_bundle_entry_t *e = bsearch(uri_path, s_index, s_count, sizeof(*s_index), compare_entry);
+    if (!e)
+    {
+        return false;
+    }
+    *out = (asset_t) {
+        .path = e->path,
+        .data = s_base + e->offset,
+        .len = e->length,
+        .etag = e->etag,
+        .type = e->type,
+        .gzip = e->flags & ASSET_BUNDLE_FLAG_GZIP,
+    };
+    return true;
+}
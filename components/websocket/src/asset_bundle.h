@@ -0,0 +1,53 @@
+#pragma once
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "asset_cache.h"
+
+/**
+ * Packed asset bundle written into the "www" partition by
+ * `compress_assets.py --bundle`. A header is followed by an index sorted by
+ * path and the asset data; all integers are little-endian and all strings
+ * NUL-terminated. Keep in sync with compress_assets.py.
+ */
+
+#define ASSET_BUNDLE_MAGIC 0x42575757   // "WWWB"
+#define ASSET_BUNDLE_VERSION 1
+#define ASSET_BUNDLE_FLAG_GZIP 0x1
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;             // index entries
+    uint32_t total_len;         // bytes of the whole bundle
+    uint32_t reserved;
+} asset_bundle_header_t;
+
+typedef struct
+{
+    char path[64];
+    char type[28];
+    char etag[20];
+    uint32_t offset;            // from the start of the bundle
+    uint32_t length;
+    uint32_t flags;             // ASSET_BUNDLE_FLAG_*
+    uint32_t reserved;
+} asset_bundle_entry_t;
+
+static_assert(sizeof(asset_bundle_header_t) == 16, "bundle header layout changed");
+static_assert(sizeof(asset_bundle_entry_t) == 128, "bundle entry layout changed");
+
+/**
+ * @brief Memory-map the bundle in the "www" partition and check its index.
+ */
+esp_err_t asset_bundle_init(void);
+
+/**
+ * @brief Find an asset by URI path with a binary search over the index.
+ *
+ * The returned asset points straight into mapped flash.
+ */
+bool asset_bundle_find(const char *uri_path, asset_t *out);
@@ -0,0 +1,176 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "asset_cache.h"
+
+static const char *TAG = "asset_cache";
+
+typedef struct
+{
+    char path[ASSET_PATH_MAX];
+    char etag[20];
+    asset_t asset;
+} cached_asset_t;
+
+static cached_asset_t s_assets[ASSET_CACHE_MAX_ENTRIES];
+static size_t s_count;
+static size_t s_bytes;
+
+// Paths found missing, a ring; the web root does not change while running
+static char s_missing[ASSET_CACHE_MISS_ENTRIES][ASSET_PATH_MAX];
+static size_t s_missing_next;
+
+static uint64_t fnv1a64(const uint8_t *data, size_t len)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= data[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static const asset_t *find(const char *uri_path)
+{
+    for (size_t i = 0; i < s_count; i++)
+    {
+        if (strcmp(s_assets[i].path, uri_path) == 0)
+        {
+            return &s_assets[i].asset;
+        }
+    }
+    return NULL;
+}
+
+static bool known_missing(const char *uri_path)
+{
+    for (size_t i = 0; i < ASSET_CACHE_MISS_ENTRIES; i++)
+    {
+        if (strcmp(s_missing[i], uri_path) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const asset_t *load(const char *base_path, const char *uri_path, bool *missing)
+{
+    char filepath[256];
+    struct stat st;
+
+    if (s_count == ASSET_CACHE_MAX_ENTRIES || strlen(uri_path) >= ASSET_PATH_MAX)
+    {
+        return NULL;
+    }
+    if (snprintf(filepath, sizeof(filepath), "%s%s", base_path, uri_path) >= (int)sizeof(filepath))
+    {
+        return NULL;
+    }
+    if (stat(filepath, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        strlcpy(s_missing[s_missing_next], uri_path, ASSET_PATH_MAX);
+        s_missing_next = (s_missing_next + 1) % ASSET_CACHE_MISS_ENTRIES;
+        *missing = true;
+        return NULL;
+    }
+    if (s_bytes + st.st_size > (size_t)CONFIG_ASSET_CACHE_SIZE_KB * 1024)
+    {
+        ESP_LOGW(TAG, "%s (%ld bytes) does not fit the cache", uri_path, (long)st.st_size);
+        return NULL;
+    }
+
+    int fd = open(filepath, O_RDONLY, 0);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+    uint8_t *data = malloc(st.st_size > 0 ? st.st_size : 1);
+    size_t got = 0;
+    while (data && got < (size_t)st.st_size)
+    {
+        ssize_t n = read(fd, data + got, st.st_size - got);
+        if (n <= 0)
+        {
+            free(data);
+            data = NULL;
+            break;
+        }
+        got += n;
+    }
+    close(fd);
+    if (!data)
+    {
+        ESP_LOGE(TAG, "failed to load %s", uri_path);
+        return NULL;
+    }
+
+    cached_asset_t *c = &s_assets[s_count++];
+    strlcpy(c->path, uri_path, sizeof(c->path));
+    snprintf(c->etag, sizeof(c->etag), "\"%016" PRIx64 "\"", fnv1a64(data, got));
+    c->asset = (asset_t) {
+        .path = c->path,
+        .data = data,
+        .len = got,
+        .etag = c->etag,
+        .type = NULL,
+        .gzip = true,       // everything in the web root is gzipped at build time
+    };
+    s_bytes += got;
+    ESP_LOGI(TAG, "cached %s (%u bytes, etag %s)", c->path, (unsigned)got, c->etag);
+    return &c->asset;
+}
+
+esp_err_t asset_cache_init(const char *base_path)
+{
+    DIR *dir = opendir(base_path);
+    if (!dir)
+    {
+        ESP_LOGW(TAG, "cannot list %s, assets are loaded on first request", base_path);
+        return ESP_OK;
+    }
+
+    char uri_path[ASSET_PATH_MAX];
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        // Skip dot files such as the build stamps next to the host assets
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        snprintf(uri_path, sizeof(uri_path), "/%s", entry->d_name);
+        bool missing;
+        if (!find(uri_path))
+        {
+            load(base_path, uri_path, &missing);
+        }
+    }
+    closedir(dir);
+    ESP_LOGI(TAG, "%u assets, %u bytes cached", (unsigned)s_count, (unsigned)s_bytes);
+    return ESP_OK;
+}
+
+const asset_t *asset_cache_get(const char *base_path, const char *uri_path, bool *missing)
+{
+    const asset_t *a = find(uri_path);
+
+    *missing = false;
+    if (a)
+    {
+        return a;
+    }
+    if (known_missing(uri_path))
+    {
+        *missing = true;
+        return NULL;
+    }
+    return load(base_path, uri_path, missing);
+}
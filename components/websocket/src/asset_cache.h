@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define ASSET_CACHE_MAX_ENTRIES 16
+#define ASSET_CACHE_MISS_ENTRIES 8
+#define ASSET_PATH_MAX 64
+
+/**
+ * @brief A web asset ready to be sent: held in the RAM cache or mapped from
+ * the asset bundle in flash. All pointers stay valid while the server runs.
+ */
+typedef struct
+{
+    const char *path;               // URI path, e.g. "/app.js"
+    const uint8_t *data;
+    size_t len;
+    const char *etag;               // quoted 64-bit FNV-1a hash of data
+    const char *type;               // MIME type, NULL to derive it from the path
+    bool gzip;                      // data is gzip encoded
+} asset_t;
+
+/**
+ * @brief Load every file under base_path into the cache, within
+ * CONFIG_ASSET_CACHE_SIZE_KB. Files that do not fit are streamed from the
+ * filesystem as before.
+ */
+esp_err_t asset_cache_init(const char *base_path);
+
+/**
+ * @brief Look up an asset, loading it on first use.
+ *
+ * Only called from the httpd task, so the cache needs no locking. The last
+ * ASSET_CACHE_MISS_ENTRIES paths found missing are remembered, so repeated
+ * requests for them do not touch the filesystem.
+ *
+ * @param[out] missing Set when the file does not exist.
+ * @return The asset, or NULL if the file does not exist or does not fit.
+ */
+const asset_t *asset_cache_get(const char *base_path, const char *uri_path, bool *missing);
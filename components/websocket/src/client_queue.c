@@ -0,0 +1,117 @@
+#include <string.h>
+#include "client_queue.h"
+
+typedef struct
+{
+    ws_frame_t *frames[CONFIG_WS_CLIENT_QUEUE_LEN];
+    uint8_t head;               // index of the oldest frame
+    uint8_t count;
+    client_queue_stats_t stats;
+} client_queue_t;
+
+static client_queue_t s_queues[CONFIG_WS_MAX_CLIENTS];
+
+static ws_frame_t *take_oldest(client_queue_t *q)
+{
+    ws_frame_t *frame = q->frames[q->head];
+    q->frames[q->head] = NULL;
+    q->head = (q->head + 1) % CONFIG_WS_CLIENT_QUEUE_LEN;
+    q->count--;
+    q->stats.depth = q->count;
+    return frame;
+}
+
+void client_queue_close(int slot)
+{
+    client_queue_t *q = &s_queues[slot];
+    while (q->count)
+    {
+        frame_unref(take_oldest(q));
+    }
+}
+
+void client_queue_open(int slot, client_queue_policy_t policy)
+{
+    client_queue_close(slot);
+    memset(&s_queues[slot], 0, sizeof(s_queues[slot]));
+    s_queues[slot].stats.policy = policy;
+}
+
+bool client_queue_push(int slot, ws_frame_t *frame)
+{
+    client_queue_t *q = &s_queues[slot];
+    bool full = q->count == CONFIG_WS_CLIENT_QUEUE_LEN;
+
+    if (full)
+    {
+        q->stats.saturated++;
+        q->stats.dropped++;
+        if (q->stats.policy == CLIENT_QUEUE_DROP)
+        {
+            return true;
+        }
+        frame_unref(take_oldest(q));
+    }
+    else
+    {
+        q->stats.saturated = 0;
+    }
+
+    frame_ref(frame);
+    q->frames[(q->head + q->count) % CONFIG_WS_CLIENT_QUEUE_LEN] = frame;
+    q->count++;
+    q->stats.depth = q->count;
+    if (q->count > q->stats.depth_max)
+    {
+        q->stats.depth_max = q->count;
+    }
+    return full;
+}
+
+ws_frame_t *client_queue_peek(int slot)
+{
+    client_queue_t *q = &s_queues[slot];
+    return q->count ? q->frames[q->head] : NULL;
+}
+
+void client_queue_pop_sent(int slot, int64_t now_us)
+{
+    client_queue_t *q = &s_queues[slot];
+    if (!q->count)
+    {
+        return;
+    }
+
+    ws_frame_t *frame = take_oldest(q);
+    int64_t latency = now_us - frame->read_us;
+    uint32_t us = latency < 0 ? 0 : latency > UINT32_MAX ? UINT32_MAX : (uint32_t)latency;
+    frame_unref(frame);
+
+    client_queue_stats_t *st = &q->stats;
+    st->sent++;
+    st->latency_us_last = us;
+    if (us > st->latency_us_max)
+    {
+        st->latency_us_max = us;
+    }
+    // avg += (x - avg) / 8, seeded with the first sample
+    st->latency_us_avg = st->sent == 1 ? us
+        : (uint32_t)((int64_t)st->latency_us_avg + ((int64_t)us - st->latency_us_avg) / 8);
+}
+
+bool client_queue_shed(int slot)
+{
+    client_queue_t *q = &s_queues[slot];
+    if (!q->count)
+    {
+        return false;
+    }
+    frame_unref(take_oldest(q));
+    q->stats.dropped++;
+    return true;
+}
+
+void client_queue_get_stats(int slot, client_queue_stats_t *out)
+{
+    *out = s_queues[slot].stats;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "frame_pool.h"
+
+/**
+ * What happens to a reading that finds the client's queue full.
+ */
+typedef enum
+{
+    CLIENT_QUEUE_COALESCE = 0,  // evict the oldest queued reading, the latest always gets in
+    CLIENT_QUEUE_DROP,          // drop the new reading and count it
+} client_queue_policy_t;
+
+#if CONFIG_WS_CLIENT_QUEUE_DROP
+#define CLIENT_QUEUE_DEFAULT_POLICY CLIENT_QUEUE_DROP
+#else
+#define CLIENT_QUEUE_DEFAULT_POLICY CLIENT_QUEUE_COALESCE
+#endif
+
+typedef struct
+{
+    client_queue_policy_t policy;
+    uint32_t depth;             // frames waiting now
+    uint32_t depth_max;         // high-water mark of depth
+    uint32_t sent;              // frames handed to the socket
+    uint32_t dropped;           // readings lost, by either policy or shedding
+    uint32_t saturated;         // consecutive readings that found the queue full
+    uint32_t latency_us_last;   // reading to send completion
+    uint32_t latency_us_avg;    // moving average over about 8 sends
+    uint32_t latency_us_max;
+} client_queue_stats_t;
+
+/*
+ * Bounded per-client queue of frame references, indexed by the registry slot.
+ * Every function must be called from the httpd task, which is the only one
+ * that sends; that is what makes the queues lock-free.
+ */
+
+/**
+ * @brief Reset a slot for a newly registered client, releasing anything left
+ * queued in it.
+ */
+void client_queue_open(int slot, client_queue_policy_t policy);
+
+/**
+ * @brief Release everything queued for a slot whose client went away.
+ */
+void client_queue_close(int slot);
+
+/**
+ * @brief Queue a frame for a client, taking a reference to it.
+ *
+ * When the queue is full the slot's policy decides which reading is lost and
+ * the saturation count goes up; otherwise it is reset.
+ *
+ * @return true if the queue was full.
+ */
+bool client_queue_push(int slot, ws_frame_t *frame);
+
+/**
+ * @brief Oldest queued frame, or NULL. The queue keeps its reference.
+ */
+ws_frame_t *client_queue_peek(int slot);
+
+/**
+ * @brief Remove the oldest frame after it was sent and record its latency.
+ */
+void client_queue_pop_sent(int slot, int64_t now_us);
+
+/**
+ * @brief Discard the oldest queued frame and count it as dropped.
+ *
+ * @return false if the queue was empty.
+ */
+bool client_queue_shed(int slot);
+
+void client_queue_get_stats(int slot, client_queue_stats_t *out);
@@ -0,0 +1,192 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "client_registry.h"
+
+static const char *TAG = "client_registry";
+
+/*
+ * Read-copy-update over a few static snapshots. A writer copies the current
+ * snapshot into one that is neither current nor pinned, edits the copy and
+ * publishes it with an atomic store. A reader increments the reader count of
+ * the snapshot it loaded and then checks that it is still current; if a
+ * writer swapped in between, it drops the count and retries. A snapshot is
+ * only reused once it is unpublished and its reader count is zero, so a
+ * pinned snapshot never changes and nothing is allocated or freed.
+ */
+
+#define SNAPSHOT_COUNT 3
+
+static client_snapshot_t s_snapshots[SNAPSHOT_COUNT];
+static _Atomic(client_snapshot_t *) s_current = &s_snapshots[0];
+static atomic_int s_encoding_clients[WS_ENCODING_COUNT];
+static bool s_slot_used[CONFIG_WS_MAX_CLIENTS];     // guarded by s_write_lock
+static SemaphoreHandle_t s_write_lock;
+static int s_capacity = CONFIG_WS_MAX_CLIENTS;
+
+void client_registry_init(int capacity)
+{
+    if (!s_write_lock)
+    {
+        s_write_lock = xSemaphoreCreateMutex();
+    }
+    s_capacity = capacity < 1 ? 1 : capacity > CONFIG_WS_MAX_CLIENTS ? CONFIG_WS_MAX_CLIENTS : capacity;
+    ESP_LOGI(TAG, "up to %d clients", s_capacity);
+}
+
+/**
+ * Find a snapshot the writer may overwrite. Readers hold a snapshot only for
+ * one fanout, so with three of them this practically never has to wait.
+ */
+static client_snapshot_t *writable_snapshot(const client_snapshot_t *current)
+{
+    for (;;)
+    {
+        for (int i = 0; i < SNAPSHOT_COUNT; i++)
+        {
+            client_snapshot_t *s = &s_snapshots[i];
+            if (s != current && atomic_load(&s->readers) == 0)
+            {
+                return s;
+            }
+        }
+        vTaskDelay(1);
+    }
+}
+
+static void publish(client_snapshot_t *next, const client_snapshot_t *current)
+{
+    next->version = current->version + 1;
+    atomic_store(&s_current, next);
+}
+
+static int alloc_slot(void)
+{
+    for (int i = 0; i < s_capacity; i++)
+    {
+        if (!s_slot_used[i])
+        {
+            s_slot_used[i] = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+esp_err_t client_registry_add(int fd, client_transport_t transport, ws_encoding_t encoding, int subscription,
+                              uint32_t generation, int *slot, int *previous)
+{
+    esp_err_t ret = ESP_OK;
+
+    *previous = -1;
+
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    client_snapshot_t *current = atomic_load(&s_current);
+    client_snapshot_t *next = writable_snapshot(current);
+    next->count = current->count;
+    memcpy(next->clients, current->clients, current->count * sizeof(ws_client_t));
+
+    int i = 0;
+    while (i < next->count && next->clients[i].fd != fd) i++;
+    if (i < next->count)
+    {
+        atomic_fetch_sub(&s_encoding_clients[next->clients[i].encoding], 1);
+        next->clients[i].encoding = encoding;
+        *previous = next->clients[i].subscription;
+        next->clients[i].subscription = subscription;
+        next->clients[i].generation = generation;
+        *slot = next->clients[i].slot;
+    }
+    else if (next->count < s_capacity)
+    {
+        next->clients[next->count].fd = fd;
+        next->clients[next->count].transport = transport;
+        next->clients[next->count].encoding = encoding;
+        next->clients[next->count].subscription = subscription;
+        next->clients[next->count].generation = generation;
+        next->clients[next->count].slot = *slot = alloc_slot();
+        next->count++;
+    }
+    else
+    {
+        ret = ESP_ERR_NO_MEM;
+    }
+
+    if (ret == ESP_OK)
+    {
+        atomic_fetch_add(&s_encoding_clients[encoding], 1);
+        publish(next, current);
+    }
+    xSemaphoreGive(s_write_lock);
+    return ret;
+}
+
+bool client_registry_remove(int fd, int *slot, int *subscription)
+{
+    bool found = false;
+
+    xSemaphoreTake(s_write_lock, portMAX_DELAY);
+    client_snapshot_t *current = atomic_load(&s_current);
+    for (int i = 0; i < current->count; i++)
+    {
+        if (current->clients[i].fd != fd)
+        {
+            continue;
+        }
+        client_snapshot_t *next = writable_snapshot(current);
+        next->count = 0;
+        for (int j = 0; j < current->count; j++)
+        {
+            if (j != i)
+            {
+                next->clients[next->count++] = current->clients[j];
+            }
+        }
+        atomic_fetch_sub(&s_encoding_clients[current->clients[i].encoding], 1);
+        s_slot_used[current->clients[i].slot] = false;
+        if (slot)
+        {
+            *slot = current->clients[i].slot;
+        }
+        if (subscription)
+        {
+            *subscription = current->clients[i].subscription;
+        }
+        publish(next, current);
+        found = true;
+        break;
+    }
+    xSemaphoreGive(s_write_lock);
+    return found;
+}
+
+const client_snapshot_t *client_registry_acquire(void)
+{
+    for (;;)
+    {
+        client_snapshot_t *s = atomic_load(&s_current);
+        atomic_fetch_add(&s->readers, 1);
+        if (atomic_load(&s_current) == s)
+        {
+            return s;
+        }
+        atomic_fetch_sub(&s->readers, 1);
+    }
+}
+
+void client_registry_release(const client_snapshot_t *snapshot)
+{
+    atomic_fetch_sub(&((client_snapshot_t *)snapshot)->readers, 1);
+}
+
+int client_registry_count(ws_encoding_t encoding)
+{
+    return atomic_load(&s_encoding_clients[encoding]);
+}
+
+int client_registry_capacity(void)
+{
+    return s_capacity;
+}
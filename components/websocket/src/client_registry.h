@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "ws_protocol.h"
+
+/**
+ * How a client's frames reach its socket.
+ */
+typedef enum
+{
+    CLIENT_TRANSPORT_WS = 0,                // WebSocket frames
+    CLIENT_TRANSPORT_SSE,                   // Server-Sent Events on a chunked /api/stream response
+} client_transport_t;
+
+typedef struct 
+{
+    int fd;
+    ws_encoding_t encoding;
+    client_transport_t transport;
+    int slot;                               // stable index for per-client state, < CONFIG_WS_MAX_CLIENTS
+    int subscription;                       // subscription table entry (subscription.h)
+    uint32_t generation;                    // of that entry when the client took it
+} ws_client_t;
+
+/**
+ * @brief Immutable view of the registered clients.
+ *
+ * Writers never modify a published snapshot; they fill a free one and swap
+ * the current pointer. Readers pin the snapshot they got with a reader count
+ * so it is not reused under them.
+ */
+typedef struct
+{
+    atomic_int readers;
+    uint32_t version;                       // bumped by every change
+    int count;                              // valid entries in clients[]
+    ws_client_t clients[CONFIG_WS_MAX_CLIENTS];
+} client_snapshot_t;
+
+/**
+ * @brief Set the number of clients accepted, at most CONFIG_WS_MAX_CLIENTS.
+ */
+void client_registry_init(int capacity);
+
+/**
+ * @brief Register a client, or change the encoding and subscription of a
+ * registered one. The transport is set when the client is first added.
+ *
+ * @param slot Set to the slot of the client, which it keeps until removed.
+ * @param previous Set to the subscription a registered client had, else -1.
+ * @return ESP_OK, or ESP_ERR_NO_MEM when the registry is full.
+ */
+esp_err_t client_registry_add(int fd, client_transport_t transport, ws_encoding_t encoding, int subscription,
+                              uint32_t generation, int *slot, int *previous);
+
+/**
+ * @brief Unregister a client. Unknown fds are ignored.
+ *
+ * @param slot Set to the slot the client held; may be NULL.
+ * @param subscription Set to the subscription the client held; may be NULL.
+ * @return true if the fd was registered.
+ */
+bool client_registry_remove(int fd, int *slot, int *subscription);
+
+/**
+ * @brief Pin the current snapshot. Lock-free; never waits for writers.
+ *
+ * Must be paired with client_registry_release().
+ */
+const client_snapshot_t *client_registry_acquire(void);
+
+void client_registry_release(const client_snapshot_t *snapshot);
+
+/**
+ * @brief Registered clients using an encoding.
+ */
+int client_registry_count(ws_encoding_t encoding);
+
+/**
+ * @brief Number of clients the registry accepts.
+ */
+int client_registry_capacity(void);
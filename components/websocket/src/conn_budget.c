@@ -0,0 +1,242 @@
+#include <inttypes.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "conn_budget.h"
+
+static const char *TAG = "conn_budget";
+
+#define CONN_MAX_SESSIONS (CONFIG_WS_MAX_CLIENTS + CONFIG_HTTP_ASSET_SOCKETS + CONFIG_HTTP_API_SOCKETS)
+// Class of a session that has not made a request yet
+#define CONN_CLASS_NEW CONN_CLASS_COUNT
+
+typedef struct
+{
+    int fd;                     // -1 = free entry
+    uint8_t cls;                // conn_class_t, or CONN_CLASS_NEW
+    bool closing;               // eviction requested, close_fn not called yet
+    bool in_handler;            // a request handler is running
+    uint8_t holds;              // async responses still being sent
+    int64_t opened_us;
+    int64_t idle_us;            // last response completed, or opened
+} conn_session_t;
+
+// Sessions are only touched by the httpd task; s_stats is read by others
+static conn_session_t s_sessions[CONN_MAX_SESSIONS];
+static conn_budget_stats_t s_stats;
+static portMUX_TYPE s_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+void conn_budget_init(int sockets)
+{
+    int reserved = CONFIG_HTTP_ASSET_SOCKETS + CONFIG_HTTP_API_SOCKETS;
+
+    for (int i = 0; i < CONN_MAX_SESSIONS; i++)
+    {
+        s_sessions[i].fd = -1;
+    }
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_stats.sockets = sockets;
+    s_stats.capacity[CONN_CLASS_ASSET] = CONFIG_HTTP_ASSET_SOCKETS;
+    s_stats.capacity[CONN_CLASS_API] = CONFIG_HTTP_API_SOCKETS;
+    s_stats.capacity[CONN_CLASS_STREAM] = sockets - reserved < 1 ? 1 : sockets - reserved;
+    ESP_LOGI(TAG, "%d sockets: up to %" PRIu32 " streams, %d reserved for assets, %d for the API",
+             sockets, s_stats.capacity[CONN_CLASS_STREAM], CONFIG_HTTP_ASSET_SOCKETS, CONFIG_HTTP_API_SOCKETS);
+}
+
+int conn_budget_capacity(conn_class_t cls)
+{
+    return (int)s_stats.capacity[cls];
+}
+
+static conn_session_t *find(int fd)
+{
+    for (int i = 0; i < CONN_MAX_SESSIONS; i++)
+    {
+        if (s_sessions[i].fd == fd)
+        {
+            return &s_sessions[i];
+        }
+    }
+    return NULL;
+}
+
+static uint32_t *open_count(uint8_t cls)
+{
+    return cls == CONN_CLASS_NEW ? &s_stats.open_new : &s_stats.open[cls];
+}
+
+/**
+ * A session is busy from the start of a request handler until its response,
+ * including an async one, is complete, and while a request is waiting in its
+ * socket. Closing it would cut off that request.
+ */
+static bool busy(const conn_session_t *c)
+{
+    char b;
+    return c->in_handler || c->holds > 0 || recv(c->fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) > 0;
+}
+
+/**
+ * Idle HTTP session to close for a new one: sessions of a class above its
+ * reserve go before those within it, sessions that were used before those
+ * that never made a request (a browser may be about to use a preconnect),
+ * and then the one idle the longest. Streams and busy sessions are never
+ * picked.
+ */
+static conn_session_t *pick_victim(int new_fd)
+{
+    conn_session_t *victim = NULL;
+    int victim_rank = 0;
+
+    for (int i = 0; i < CONN_MAX_SESSIONS; i++)
+    {
+        conn_session_t *c = &s_sessions[i];
+        if (c->fd < 0 || c->fd == new_fd || c->closing || c->cls == CONN_CLASS_STREAM || busy(c))
+        {
+            continue;
+        }
+        bool over = c->cls != CONN_CLASS_NEW && s_stats.open[c->cls] > s_stats.capacity[c->cls];
+        int rank = (over ? 2 : 0) + (c->cls != CONN_CLASS_NEW ? 1 : 0);
+        if (!victim || rank > victim_rank || (rank == victim_rank && c->idle_us < victim->idle_us))
+        {
+            victim = c;
+            victim_rank = rank;
+        }
+    }
+    return victim;
+}
+
+esp_err_t conn_budget_open(httpd_handle_t hd, int sockfd)
+{
+    conn_session_t *c = find(-1);
+    if (!c)
+    {
+        // httpd never opens more than the budget; this is a configuration bug
+        ESP_LOGE(TAG, "no session entry for fd=%d", sockfd);
+        return ESP_FAIL;
+    }
+    int in_use = 1;
+    for (int i = 0; i < CONN_MAX_SESSIONS; i++)
+    {
+        in_use += s_sessions[i].fd >= 0 && !s_sessions[i].closing;
+    }
+
+    // httpd stops accepting once every slot is taken; keep one free
+    conn_session_t *victim = NULL;
+    if (in_use >= (int)s_stats.sockets)
+    {
+        victim = pick_victim(sockfd);
+        if (!victim)
+        {
+            // Refuse the new one rather than cut off a busy session
+            taskENTER_CRITICAL(&s_stats_mux);
+            s_stats.exhausted++;
+            taskEXIT_CRITICAL(&s_stats_mux);
+            ESP_LOGW(TAG, "all %" PRIu32 " sockets busy, refusing fd=%d", s_stats.sockets, sockfd);
+            return ESP_FAIL;
+        }
+        victim->closing = true;
+        ESP_LOGD(TAG, "evicting idle fd=%d", victim->fd);
+        httpd_sess_trigger_close(hd, victim->fd);
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    *c = (conn_session_t) { .fd = sockfd, .cls = CONN_CLASS_NEW, .opened_us = now_us, .idle_us = now_us };
+    taskENTER_CRITICAL(&s_stats_mux);
+    s_stats.accepted++;
+    s_stats.open_new++;
+    s_stats.evicted += victim != NULL;
+    taskEXIT_CRITICAL(&s_stats_mux);
+    return ESP_OK;
+}
+
+void conn_budget_close(int sockfd)
+{
+    conn_session_t *c = find(sockfd);
+    if (!c)
+    {
+        return;
+    }
+    taskENTER_CRITICAL(&s_stats_mux);
+    (*open_count(c->cls))--;
+    taskEXIT_CRITICAL(&s_stats_mux);
+    c->fd = -1;
+}
+
+bool conn_budget_admit(httpd_req_t *req, conn_class_t cls)
+{
+    conn_session_t *c = find(httpd_req_to_sockfd(req));
+    if (!c)
+    {
+        return true;
+    }
+    int64_t now_us = esp_timer_get_time();
+    bool admitted = true;
+
+    taskENTER_CRITICAL(&s_stats_mux);
+    if (c->cls == CONN_CLASS_NEW)
+    {
+        int64_t us = now_us - c->opened_us;
+        uint32_t accept_us = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+        s_stats.accept_us_count++;
+        s_stats.accept_us_sum += accept_us;
+        if (accept_us > s_stats.accept_us_max)
+        {
+            s_stats.accept_us_max = accept_us;
+        }
+    }
+    if (cls == CONN_CLASS_STREAM && c->cls != CONN_CLASS_STREAM
+        && s_stats.open[CONN_CLASS_STREAM] >= s_stats.capacity[CONN_CLASS_STREAM])
+    {
+        s_stats.refused++;
+        admitted = false;
+    }
+    else if (cls != c->cls)
+    {
+        (*open_count(c->cls))--;
+        s_stats.open[cls]++;
+        c->cls = cls;
+    }
+    taskEXIT_CRITICAL(&s_stats_mux);
+
+    c->in_handler = true;
+    return admitted;
+}
+
+void conn_budget_done(httpd_req_t *req)
+{
+    conn_session_t *c = find(httpd_req_to_sockfd(req));
+    if (c && c->in_handler)
+    {
+        c->in_handler = false;
+        c->idle_us = esp_timer_get_time();
+    }
+}
+
+void conn_budget_hold(httpd_req_t *req)
+{
+    conn_session_t *c = find(httpd_req_to_sockfd(req));
+    if (c)
+    {
+        c->holds++;
+    }
+}
+
+void conn_budget_release(httpd_req_t *req)
+{
+    conn_session_t *c = find(httpd_req_to_sockfd(req));
+    if (c && c->holds > 0 && --c->holds == 0)
+    {
+        c->idle_us = esp_timer_get_time();
+    }
+}
+
+void conn_budget_get_stats(conn_budget_stats_t *out)
+{
+    taskENTER_CRITICAL(&s_stats_mux);
+    *out = s_stats;
+    taskEXIT_CRITICAL(&s_stats_mux);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+/**
+ * What a session is used for, decided by the last request it made.
+ */
+typedef enum
+{
+    CONN_CLASS_STREAM = 0,      // WebSocket or /api/stream, held for as long as the client stays
+    CONN_CLASS_ASSET,           // page, scripts, styles
+    CONN_CLASS_API,             // /api/* and /metrics
+    CONN_CLASS_COUNT
+} conn_class_t;
+
+typedef struct
+{
+    uint32_t sockets;                       // sessions httpd may hold open
+    uint32_t capacity[CONN_CLASS_COUNT];    // streams: upper limit; HTTP classes: slots reserved
+    uint32_t open[CONN_CLASS_COUNT];        // sessions now, by class of their last request
+    uint32_t open_new;                      // sessions that have not made a request yet
+    uint32_t accepted;                      // sessions opened since boot
+    uint32_t refused;                       // streams turned away at the stream limit
+    uint32_t evicted;                       // idle HTTP sessions closed to make room
+    uint32_t exhausted;                     // sessions refused because every slot was busy
+    uint32_t accept_us_count;               // sessions that made a first request
+    uint64_t accept_us_sum;                 // session open to first request, summed
+    uint32_t accept_us_max;
+} conn_budget_stats_t;
+
+/*
+ * Socket budget of the HTTP server. Streams are capped so that the
+ * CONFIG_HTTP_ASSET_SOCKETS + CONFIG_HTTP_API_SOCKETS slots stay with plain
+ * HTTP. When a new session takes the last free slot, an idle HTTP session is
+ * closed so the next connection is accepted at once: first one of a class
+ * holding more than its reserve, the one idle the longest first. Streams and
+ * sessions with a request in progress are never evicted; if every session is
+ * busy the new one is refused. Every function except conn_budget_get_stats() must be called from
+ * the httpd task.
+ */
+
+/**
+ * @brief Split the socket budget between the classes.
+ *
+ * @param sockets The httpd max_open_sockets.
+ */
+void conn_budget_init(int sockets);
+
+/**
+ * @brief Slots of a class: the stream limit, or an HTTP class' reserve.
+ */
+int conn_budget_capacity(conn_class_t cls);
+
+/**
+ * @brief httpd open_fn. Evicts an idle session when the budget is full.
+ *
+ * @return ESP_FAIL, so httpd closes the new socket, when no session is idle.
+ */
+esp_err_t conn_budget_open(httpd_handle_t hd, int sockfd);
+
+/**
+ * @brief Forget a session; from the httpd close_fn.
+ */
+void conn_budget_close(int sockfd);
+
+/**
+ * @brief Account a request at the start of its handler.
+ *
+ * @return false, counting a refusal, if it would open a stream beyond the
+ *         stream limit. HTTP requests are always admitted.
+ */
+bool conn_budget_admit(httpd_req_t *req, conn_class_t cls);
+
+/**
+ * @brief The handler of a request returned; from then on the session is idle
+ * unless it holds an async response.
+ */
+void conn_budget_done(httpd_req_t *req);
+
+/**
+ * @brief An async response (httpd_req_async_handler_begin) keeps the session
+ * busy until conn_budget_release() with the same request.
+ */
+void conn_budget_hold(httpd_req_t *req);
+
+void conn_budget_release(httpd_req_t *req);
+
+/**
+ * @brief Snapshot of the counters. Any task.
+ */
+void conn_budget_get_stats(conn_budget_stats_t *out);
@@ -0,0 +1,51 @@
+#include "frame_pool.h"
+
+static ws_frame_t s_frames[CONFIG_WS_FRAME_POOL_SIZE];
+
+static atomic_uint s_acquired;
+static atomic_uint s_exhausted;
+static atomic_uint s_in_use;
+static atomic_uint s_in_use_max;
+
+ws_frame_t *frame_pool_acquire(void)
+{
+    for (int i = 0; i < CONFIG_WS_FRAME_POOL_SIZE; i++)
+    {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&s_frames[i].refs, &expected, 1))
+        {
+            unsigned in_use = atomic_fetch_add(&s_in_use, 1) + 1;
+            unsigned max = atomic_load(&s_in_use_max);
+            while (in_use > max && !atomic_compare_exchange_weak(&s_in_use_max, &max, in_use))
+            {
+            }
+            atomic_fetch_add(&s_acquired, 1);
+            s_frames[i].len = 0;
+            s_frames[i].next = NULL;
+            return &s_frames[i];
+        }
+    }
+    atomic_fetch_add(&s_exhausted, 1);
+    return NULL;
+}
+
+void frame_ref(ws_frame_t *frame)
+{
+    atomic_fetch_add(&frame->refs, 1);
+}
+
+void frame_unref(ws_frame_t *frame)
+{
+    if (atomic_fetch_sub(&frame->refs, 1) == 1)
+    {
+        atomic_fetch_sub(&s_in_use, 1);
+    }
+}
+
+void frame_pool_get_stats(frame_pool_stats_t *out)
+{
+    out->acquired = atomic_load(&s_acquired);
+    out->exhausted = atomic_load(&s_exhausted);
+    out->in_use = atomic_load(&s_in_use);
+    out->in_use_max = atomic_load(&s_in_use_max);
+}
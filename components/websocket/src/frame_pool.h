@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// One broadcast frame carries the readings of every sensor and the derived
+// values of sensor 0
+#define WS_FRAME_MAX_LEN (768 * CONFIG_SPS30_COUNT)
+
+/**
+ * @brief Preallocated, reference counted frame buffer.
+ *
+ * The producer renders a reading into a frame once; every pending socket send
+ * holds its own reference. The frame returns to the pool when the last
+ * reference is dropped.
+ */
+typedef struct ws_frame
+{
+    atomic_int refs;
+    size_t len;
+    int encoding;                       // wire encoding of data (ws_encoding_t)
+    int64_t read_us;                    // esp_timer_get_time() when the reading arrived
+    void *ctx;                          // context of the fanout that sends it
+    int subscription;                   // subscription entry it was rendered for
+    uint32_t generation;                // of that entry (subscription_read)
+    struct ws_frame *next;              // other frames rendered from the same reading
+    uint8_t data[WS_FRAME_MAX_LEN];
+} ws_frame_t;
+
+typedef struct
+{
+    uint32_t acquired;      // successful frame_pool_acquire() calls
+    uint32_t exhausted;     // acquire calls that found no free frame
+    uint32_t in_use;        // frames currently referenced
+    uint32_t in_use_max;    // high-water mark of in_use
+} frame_pool_stats_t;
+
+/**
+ * @brief Take a free frame from the pool with a reference count of one.
+ *
+ * Lock-free and allocation-free. Safe to call from any task.
+ *
+ * @return The frame, or NULL if every frame is still referenced.
+ */
+ws_frame_t *frame_pool_acquire(void);
+
+/**
+ * @brief Add a reference to a frame the caller already holds.
+ */
+void frame_ref(ws_frame_t *frame);
+
+/**
+ * @brief Drop a reference; the frame is free again once none are left.
+ */
+void frame_unref(ws_frame_t *frame);
+
+/**
+ * @brief Snapshot of the pool counters.
+ */
+void frame_pool_get_stats(frame_pool_stats_t *out);
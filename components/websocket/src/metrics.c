@@ -0,0 +1,405 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "sps30_hal_stats.h"
+#include "metrics.h"
+#include "conn_budget.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <malloc.h>
+#else
+#include "esp_system.h"
+#endif
+
+static const char *TAG = "metrics";
+
+#define METRICS_UART_COMMANDS 16
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+typedef struct
+{
+    char *data;
+    size_t len;
+} metrics_buf_t;
+
+/*
+ * s_front is what scrapes send, under s_front_lock; s_back is only touched
+ * by the broadcast task. Swapping takes the lock without waiting, so a slow
+ * scraper delays publication of a new body, never the broadcast task.
+ */
+static metrics_buf_t s_bufs[2];
+static metrics_buf_t *s_front = &s_bufs[0];
+static metrics_buf_t *s_back = &s_bufs[1];
+static SemaphoreHandle_t s_front_lock;
+static bool s_overflow_logged;
+
+// Fanout counters, written by the httpd task
+static portMUX_TYPE s_fanout_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_fanouts;
+static uint64_t s_fanout_us_total;
+static uint32_t s_fanout_us_max;
+static uint64_t s_frames_sent;
+
+#if CONFIG_IDF_TARGET_LINUX
+static size_t s_heap_free_min = SIZE_MAX;
+#endif
+
+// One metric family per channel group, one series per channel and sensor
+typedef struct
+{
+    const char *name;
+    const char *unit;
+    const char *help;
+} metric_family_t;
+
+static const metric_family_t channel_families[SENSOR_GROUP_COUNT] =
+{
+#define CHANNEL_FAMILY(NAME, metric, metric_unit, unit, help) [SENSOR_GROUP_##NAME] = { metric, metric_unit, help },
+    SENSOR_CHANNEL_GROUPS(CHANNEL_FAMILY)
+#undef CHANNEL_FAMILY
+};
+
+typedef struct
+{
+    uint8_t group;
+    const char *labels;         // after sensor="n"
+} metric_series_t;
+
+static const metric_series_t channel_series[SENSOR_CHANNEL_COUNT] =
+{
+#define CHANNEL_SERIES(NAME, field, key, group, size, ...) \
+    [SENSOR_CHANNEL_##NAME] = { SENSOR_GROUP_##group, sizeof(size) > 1 ? ",size=\"" size "\"" : "" },
+    SENSOR_CHANNELS(CHANNEL_SERIES)
+#undef CHANNEL_SERIES
+};
+static const char *status_names[] = { "ok", "comm_error", "not_ready", "fan_cleaning", "sleeping" };
+
+esp_err_t metrics_init(void)
+{
+    s_front_lock = xSemaphoreCreateMutex();
+    s_bufs[0].data = malloc(CONFIG_WEB_METRICS_BUFFER_SIZE);
+    s_bufs[1].data = malloc(CONFIG_WEB_METRICS_BUFFER_SIZE);
+    if (!s_front_lock || !s_bufs[0].data || !s_bufs[1].data)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void metrics_record_fanout(uint32_t us, int sent)
+{
+    taskENTER_CRITICAL(&s_fanout_mux);
+    s_fanouts++;
+    s_fanout_us_total += us;
+    if (us > s_fanout_us_max) s_fanout_us_max = us;
+    s_frames_sent += (uint32_t)sent;
+    taskEXIT_CRITICAL(&s_fanout_mux);
+}
+
+/**
+ * Append to the back buffer; past its end only the length keeps growing so
+ * the caller can tell the size that would have been needed.
+ */
+static void put(metrics_buf_t *b, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = b->len < CONFIG_WEB_METRICS_BUFFER_SIZE ? CONFIG_WEB_METRICS_BUFFER_SIZE - b->len : 0;
+    int n = vsnprintf(room ? b->data + b->len : NULL, room, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+    {
+        b->len += n;
+    }
+}
+
+static void render_sensors(metrics_buf_t *b, const sensor_sample_t *sample)
+{
+    // Formatted like the WebSocket frames, without floats in the fixed-point pipeline
+    char value[16];
+
+    for (int g = 0; g < SENSOR_GROUP_COUNT; g++)
+    {
+        const metric_family_t *f = &channel_families[g];
+        put(b, "# TYPE %s gauge\n# UNIT %s %s\n# HELP %s %s\n", f->name, f->name, f->unit, f->name, f->help);
+        for (int s = 0; s < sample->count; s++)
+        {
+            for (int c = 0; c < SENSOR_CHANNEL_COUNT; c++)
+            {
+                if (channel_series[c].group != g)
+                {
+                    continue;
+                }
+                sensor_value_format(value, sizeof(value), c, sample->sensors[s].values[c]);
+                put(b, "%s{sensor=\"%d\"%s} %s\n", f->name, s, channel_series[c].labels, value);
+            }
+        }
+    }
+
+    // Derived by the statistics stage; left out until there is enough data
+    put(b, "# TYPE sps30_nowcast_micrograms_per_cubic_meter gauge\n"
+           "# UNIT sps30_nowcast_micrograms_per_cubic_meter micrograms_per_cubic_meter\n"
+           "# HELP sps30_nowcast_micrograms_per_cubic_meter US EPA NowCast of the hourly mass concentration.\n");
+    for (int s = 0; s < sample->count; s++)
+    {
+        const sensor_derived_t *d = &sample->derived[s];
+        if (!isnan(d->nowcast_pm2_5))
+        {
+            put(b, "sps30_nowcast_micrograms_per_cubic_meter{sensor=\"%d\",size=\"2.5\"} %.1f\n", s, d->nowcast_pm2_5);
+        }
+        if (!isnan(d->nowcast_pm10))
+        {
+            put(b, "sps30_nowcast_micrograms_per_cubic_meter{sensor=\"%d\",size=\"10\"} %.1f\n", s, d->nowcast_pm10);
+        }
+    }
+
+    put(b, "# TYPE sps30_aqi gauge\n"
+           "# HELP sps30_aqi US Air Quality Index of the NowCast.\n");
+    for (int s = 0; s < sample->count; s++)
+    {
+        const sensor_derived_t *d = &sample->derived[s];
+        if (d->aqi_pm2_5 >= 0)
+        {
+            put(b, "sps30_aqi{sensor=\"%d\",size=\"2.5\"} %d\n", s, d->aqi_pm2_5);
+        }
+        if (d->aqi_pm10 >= 0)
+        {
+            put(b, "sps30_aqi{sensor=\"%d\",size=\"10\"} %d\n", s, d->aqi_pm10);
+        }
+    }
+
+    put(b, "# TYPE sps30_status stateset\n");
+    for (int s = 0; s < sample->count; s++)
+    {
+        for (int st = 0; st < (int)(sizeof(status_names) / sizeof(status_names[0])); st++)
+        {
+            put(b, "sps30_status{sensor=\"%d\",sps30_status=\"%s\"} %d\n",
+                s, status_names[st], (int)sample->sensors[s].status == st);
+        }
+    }
+
+    sensor_sched_report_t sched;
+    sensor_task_get_sched_report(&sched);
+    put(b, "# TYPE sps30_samples_published counter\n"
+           "sps30_samples_published_total %" PRIu32 "\n"
+           "# TYPE sps30_readings counter\n", sched.published);
+    for (int s = 0; s < SENSOR_COUNT; s++)
+    {
+        put(b, "sps30_readings_total{sensor=\"%d\"} %" PRIu32 "\n", s, sched.sensors[s].samples);
+    }
+    put(b, "# TYPE sps30_readings_missed counter\n");
+    for (int s = 0; s < SENSOR_COUNT; s++)
+    {
+        put(b, "sps30_readings_missed_total{sensor=\"%d\"} %" PRIu32 "\n", s, sched.sensors[s].missed);
+    }
+}
+
+static void render_uart(metrics_buf_t *b)
+{
+    sps30_hal_command_stats_t cmds[METRICS_UART_COMMANDS];
+    size_t n = sps30_hal_get_command_totals(cmds, METRICS_UART_COMMANDS);
+
+    put(b, "# TYPE sps30_uart_response_seconds summary\n"
+           "# UNIT sps30_uart_response_seconds seconds\n"
+           "# HELP sps30_uart_response_seconds SHDLC request to complete response, per command byte.\n");
+    for (size_t i = 0; i < n; i++)
+    {
+        put(b, "sps30_uart_response_seconds_count{command=\"0x%02x\"} %" PRIu32 "\n"
+               "sps30_uart_response_seconds_sum{command=\"0x%02x\"} %.6f\n",
+            cmds[i].command, cmds[i].count, cmds[i].command, cmds[i].total_us / 1e6);
+    }
+    put(b, "# TYPE sps30_uart_response_max_seconds gauge\n"
+           "# UNIT sps30_uart_response_max_seconds seconds\n");
+    for (size_t i = 0; i < n; i++)
+    {
+        put(b, "sps30_uart_response_max_seconds{command=\"0x%02x\"} %.6f\n",
+            cmds[i].command, cmds[i].max_us / 1e6);
+    }
+    put(b, "# TYPE sps30_uart_timeouts counter\n");
+    for (size_t i = 0; i < n; i++)
+    {
+        put(b, "sps30_uart_timeouts_total{command=\"0x%02x\"} %" PRIu32 "\n", cmds[i].command, cmds[i].timeouts);
+    }
+    put(b, "# TYPE sps30_uart_errors counter\n"
+           "# HELP sps30_uart_errors Responses with a non-zero SHDLC state byte.\n");
+    for (size_t i = 0; i < n; i++)
+    {
+        put(b, "sps30_uart_errors_total{command=\"0x%02x\"} %" PRIu32 "\n", cmds[i].command, cmds[i].errors);
+    }
+}
+
+static void render_server(metrics_buf_t *b, const metrics_server_stats_t *server)
+{
+    taskENTER_CRITICAL(&s_fanout_mux);
+    uint32_t fanouts = s_fanouts;
+    uint64_t fanout_us_total = s_fanout_us_total;
+    uint32_t fanout_us_max = s_fanout_us_max;
+    uint64_t frames_sent = s_frames_sent;
+    taskEXIT_CRITICAL(&s_fanout_mux);
+
+    put(b, "# TYPE ws_fanout_seconds summary\n"
+           "# UNIT ws_fanout_seconds seconds\n"
+           "ws_fanout_seconds_count %" PRIu32 "\n"
+           "ws_fanout_seconds_sum %.6f\n"
+           "# TYPE ws_fanout_max_seconds gauge\n"
+           "# UNIT ws_fanout_max_seconds seconds\n"
+           "ws_fanout_max_seconds %.6f\n"
+           "# TYPE ws_frames_sent counter\n"
+           "ws_frames_sent_total %" PRIu64 "\n"
+           "# TYPE ws_clients gauge\n"
+           "ws_clients %" PRIu32 "\n"
+           "# TYPE ws_slow_disconnects counter\n"
+           "ws_slow_disconnects_total %" PRIu32 "\n",
+        fanouts, fanout_us_total / 1e6, fanout_us_max / 1e6, frames_sent,
+        server->clients, server->slow_disconnects);
+}
+
+static void render_connections(metrics_buf_t *b)
+{
+    static const char *class_names[CONN_CLASS_COUNT] = { "stream", "asset", "api" };
+    conn_budget_stats_t c;
+    conn_budget_get_stats(&c);
+
+    put(b, "# TYPE http_socket_budget gauge\n"
+           "# HELP http_socket_budget Sessions the HTTP server may hold open.\n"
+           "http_socket_budget %" PRIu32 "\n"
+           "# TYPE http_socket_capacity gauge\n"
+           "# HELP http_socket_capacity Stream limit, or sockets reserved for an HTTP class.\n",
+        c.sockets);
+    for (int i = 0; i < CONN_CLASS_COUNT; i++)
+    {
+        put(b, "http_socket_capacity{class=\"%s\"} %" PRIu32 "\n", class_names[i], c.capacity[i]);
+    }
+    put(b, "# TYPE http_sessions gauge\n"
+           "# HELP http_sessions Open sessions by class of their last request.\n");
+    for (int i = 0; i < CONN_CLASS_COUNT; i++)
+    {
+        put(b, "http_sessions{class=\"%s\"} %" PRIu32 "\n", class_names[i], c.open[i]);
+    }
+    put(b, "http_sessions{class=\"new\"} %" PRIu32 "\n"
+           "# TYPE http_sessions_accepted counter\n"
+           "http_sessions_accepted_total %" PRIu32 "\n"
+           "# TYPE http_streams_refused counter\n"
+           "# HELP http_streams_refused WebSocket and event stream requests turned away at the stream limit.\n"
+           "http_streams_refused_total %" PRIu32 "\n"
+           "# TYPE http_sessions_evicted counter\n"
+           "# HELP http_sessions_evicted Idle HTTP sessions closed to free a socket.\n"
+           "http_sessions_evicted_total %" PRIu32 "\n"
+           "# TYPE http_socket_budget_exhausted counter\n"
+           "# HELP http_socket_budget_exhausted New connections refused because every socket was busy.\n"
+           "http_socket_budget_exhausted_total %" PRIu32 "\n"
+           "# TYPE http_accept_latency_seconds summary\n"
+           "# UNIT http_accept_latency_seconds seconds\n"
+           "# HELP http_accept_latency_seconds Session open to the start of its first request.\n"
+           "http_accept_latency_seconds_count %" PRIu32 "\n"
+           "http_accept_latency_seconds_sum %.6f\n"
+           "# TYPE http_accept_latency_max_seconds gauge\n"
+           "# UNIT http_accept_latency_max_seconds seconds\n"
+           "http_accept_latency_max_seconds %.6f\n",
+        c.open_new, c.accepted, c.refused, c.evicted, c.exhausted,
+        c.accept_us_count, c.accept_us_sum / 1e6, c.accept_us_max / 1e6);
+}
+
+static void render_system(metrics_buf_t *b)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    struct mallinfo2 mi = mallinfo2();
+    size_t heap_free = mi.fordblks;
+    if (heap_free < s_heap_free_min) s_heap_free_min = heap_free;
+    size_t heap_free_min = s_heap_free_min;
+#else
+    size_t heap_free = esp_get_free_heap_size();
+    size_t heap_free_min = esp_get_minimum_free_heap_size();
+#endif
+
+    put(b, "# TYPE heap_free_bytes gauge\n"
+           "# UNIT heap_free_bytes bytes\n"
+           "heap_free_bytes %u\n"
+           "# TYPE heap_minimum_free_bytes gauge\n"
+           "# UNIT heap_minimum_free_bytes bytes\n"
+           "heap_minimum_free_bytes %u\n",
+        (unsigned)heap_free, (unsigned)heap_free_min);
+
+    // Looked up by name on every render; a cached handle could outlive its task
+    static const char *tasks[] = { "sensor_task", "broadcast_task", "record_task", "datalog", "httpd" };
+    put(b, "# TYPE task_stack_high_water_mark_bytes gauge\n"
+           "# UNIT task_stack_high_water_mark_bytes bytes\n"
+           "# HELP task_stack_high_water_mark_bytes Least free stack the task has had.\n");
+    for (size_t i = 0; i < sizeof(tasks) / sizeof(tasks[0]); i++)
+    {
+        TaskHandle_t task = xTaskGetHandle(tasks[i]);
+        if (task)
+        {
+            put(b, "task_stack_high_water_mark_bytes{task=\"%s\"} %u\n",
+                tasks[i], (unsigned)uxTaskGetStackHighWaterMark(task));
+        }
+    }
+    for (int s = 0; s < SENSOR_COUNT; s++)
+    {
+        char name[configMAX_TASK_NAME_LEN];
+        snprintf(name, sizeof(name), "sps30_%d", s);
+        TaskHandle_t task = xTaskGetHandle(name);
+        if (task)
+        {
+            put(b, "task_stack_high_water_mark_bytes{task=\"%s\"} %u\n",
+                name, (unsigned)uxTaskGetStackHighWaterMark(task));
+        }
+    }
+}
+
+void metrics_render(const sensor_sample_t *sample, const metrics_server_stats_t *server)
+{
+    metrics_buf_t *b = s_back;
+
+    b->len = 0;
+    render_sensors(b, sample);
+    render_uart(b);
+    render_server(b, server);
+    render_connections(b);
+    render_system(b);
+    put(b, "# EOF\n");
+
+    if (b->len >= CONFIG_WEB_METRICS_BUFFER_SIZE)
+    {
+        // A cut body is not valid OpenMetrics; keep serving the last good one
+        if (!s_overflow_logged)
+        {
+            ESP_LOGW(TAG, "exposition needs %u bytes, raise WEB_METRICS_BUFFER_SIZE", (unsigned)b->len + 1);
+            s_overflow_logged = true;
+        }
+        return;
+    }
+
+    if (xSemaphoreTake(s_front_lock, 0) == pdTRUE)
+    {
+        s_back = s_front;
+        s_front = b;
+        xSemaphoreGive(s_front_lock);
+    }
+}
+
+esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    xSemaphoreTake(s_front_lock, portMAX_DELAY);
+    if (s_front->len == 0)
+    {
+        xSemaphoreGive(s_front_lock);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_send(req, "No sample yet", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, METRICS_CONTENT_TYPE);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    esp_err_t err = httpd_resp_send(req, s_front->data, s_front->len);
+    xSemaphoreGive(s_front_lock);
+    return err;
+}
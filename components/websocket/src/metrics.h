@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+#include "sensor_events.h"
+
+/**
+ * OpenMetrics exposition for GET /metrics.
+ *
+ * The body is rendered once per published sample by the broadcast task, and
+ * every few seconds while none is published, into a back buffer, which is
+ * swapped with the served one when no scrape is in progress. A scrape only
+ * copies out the newest complete body, so scrape rate does not affect CPU use
+ * beyond the socket send.
+ */
+
+/**
+ * @brief Counters of the broadcast path, owned by the httpd task.
+ */
+typedef struct
+{
+    uint32_t clients;               // registered WebSocket clients
+    uint32_t slow_disconnects;      // clients closed for a saturated queue
+} metrics_server_stats_t;
+
+/**
+ * @brief Allocate the buffers. Called once before the first render.
+ */
+esp_err_t metrics_init(void);
+
+/**
+ * @brief Count one broadcast fanout. httpd task only.
+ *
+ * @param us    Time the fanout took.
+ * @param sent  Frames sent by it.
+ */
+void metrics_record_fanout(uint32_t us, int sent);
+
+/**
+ * @brief Render the exposition for a sample and publish it unless a scrape
+ * holds the current body, in which case the next sample tries again.
+ *
+ * Never blocks. Broadcast task only.
+ */
+void metrics_render(const sensor_sample_t *sample, const metrics_server_stats_t *server);
+
+/**
+ * @brief GET /metrics handler.
+ */
+esp_err_t metrics_get_handler(httpd_req_t *req);
@@ -0,0 +1,100 @@
+#include <stdatomic.h>
+#include "subscription.h"
+
+/*
+ * The table is written by the httpd task only. An entry's spec is guarded by
+ * a sequence count that is odd while the entry is being (re)assigned, so the
+ * broadcast task can copy it without a lock and retry on a torn copy.
+ */
+
+typedef struct
+{
+    atomic_uint seq;
+    atomic_int refs;
+    uint32_t generation;
+    ws_subscription_t spec;
+} subscription_entry_t;
+
+static subscription_entry_t s_entries[CONFIG_WS_MAX_SUBSCRIPTIONS];
+
+// Field by field: callers build specs on the stack, their padding is not zeroed
+static bool spec_equal(const ws_subscription_t *a, const ws_subscription_t *b)
+{
+    return a->encoding == b->encoding && a->channels == b->channels
+        && a->every == b->every && a->batch == b->batch;
+}
+
+int subscription_acquire(const ws_subscription_t *spec, uint32_t *generation)
+{
+    int free_id = -1;
+
+    for (int i = 0; i < CONFIG_WS_MAX_SUBSCRIPTIONS; i++)
+    {
+        subscription_entry_t *e = &s_entries[i];
+        if (atomic_load(&e->refs) == 0)
+        {
+            if (free_id < 0) free_id = i;
+            continue;
+        }
+        if (spec_equal(&e->spec, spec))
+        {
+            atomic_fetch_add(&e->refs, 1);
+            *generation = e->generation;
+            return i;
+        }
+    }
+    if (free_id < 0)
+    {
+        return -1;
+    }
+
+    subscription_entry_t *e = &s_entries[free_id];
+    unsigned seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    atomic_store_explicit(&e->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e->spec = *spec;
+    e->generation++;
+    atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+    atomic_store(&e->refs, 1);
+    *generation = e->generation;
+    return free_id;
+}
+
+void subscription_release(int id)
+{
+    if (id >= 0 && id < CONFIG_WS_MAX_SUBSCRIPTIONS)
+    {
+        atomic_fetch_sub(&s_entries[id].refs, 1);
+    }
+}
+
+bool subscription_read(int id, ws_subscription_t *out, uint32_t *generation)
+{
+    subscription_entry_t *e = &s_entries[id];
+
+    if (atomic_load(&e->refs) <= 0)
+    {
+        return false;
+    }
+    // Only an entry without clients is ever reassigned, so a copy that
+    // overlaps an assignment can be treated as no clients yet
+    unsigned s1 = atomic_load_explicit(&e->seq, memory_order_acquire);
+    if (s1 & 1)
+    {
+        return false;
+    }
+    *out = e->spec;
+    *generation = e->generation;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&e->seq, memory_order_relaxed) == s1;
+}
+
+int subscription_active_count(void)
+{
+    int n = 0;
+    for (int i = 0; i < CONFIG_WS_MAX_SUBSCRIPTIONS; i++)
+    {
+        n += atomic_load(&s_entries[i].refs) > 0;
+    }
+    return n;
+}
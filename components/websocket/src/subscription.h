@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "ws_protocol.h"
+
+// All channels, bit n = channel n in wire order
+#define WS_CHANNELS_ALL ((uint16_t)((1u << SENSOR_CHANNEL_COUNT) - 1))
+#define WS_SUBSCRIPTION_MAX_EVERY 3600
+#define WS_SUBSCRIPTION_MAX_BATCH 60
+
+/**
+ * What a client asked to receive:
+ *   {"action":"registerClient","encoding":"json","channels":2,"every":10,"batch":6}
+ * Clients with identical specs share one table entry, and the broadcast task
+ * renders each entry once per reading for all of its clients.
+ */
+typedef struct
+{
+    ws_encoding_t encoding;
+    uint16_t channels;      // WS_CHANNELS_ALL unless a subset was asked for
+    uint16_t every;         // send every Nth reading, 1 = all
+    uint16_t batch;         // readings per frame (fewer if they do not fit), 1 = one per frame
+} ws_subscription_t;
+
+/**
+ * @brief The spec of a client that did not ask for one.
+ */
+static inline ws_subscription_t subscription_default(ws_encoding_t encoding)
+{
+    return (ws_subscription_t) { .encoding = encoding, .channels = WS_CHANNELS_ALL, .every = 1, .batch = 1 };
+}
+
+static inline bool subscription_is_default(const ws_subscription_t *spec)
+{
+    return spec->channels == WS_CHANNELS_ALL && spec->every == 1 && spec->batch == 1;
+}
+
+/**
+ * @brief Take a reference to the entry for a spec, adding it if needed.
+ *
+ * httpd task only, like every registry change.
+ *
+ * @param generation Set to the entry's generation, as subscription_read()
+ *        reports it while the entry keeps this spec.
+ * @return Entry id below CONFIG_WS_MAX_SUBSCRIPTIONS, or -1 if the table is
+ *         full of other specs.
+ */
+int subscription_acquire(const ws_subscription_t *spec, uint32_t *generation);
+
+/**
+ * @brief Drop a reference taken by subscription_acquire(). httpd task only.
+ */
+void subscription_release(int id);
+
+/**
+ * @brief Copy of an entry that has clients. Lock-free; any task.
+ *
+ * @param generation Changes whenever the entry is reused for another spec.
+ * @return false if the entry has no clients.
+ */
+bool subscription_read(int id, ws_subscription_t *out, uint32_t *generation);
+
+/**
+ * @brief Number of entries that have clients.
+ */
+int subscription_active_count(void);
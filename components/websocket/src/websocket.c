@@ -1,21 +1,42 @@
+#include <assert.h>
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include <sys/time.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <fcntl.h>
+#include <unistd.h>
+#include <sys/select.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_timer.h"
 #include "esp_http_server.h"
-#include "esp_chip_info.h"
-#include "esp_random.h"
 #include "esp_log.h"
-#include "esp_vfs.h"
 #include "cJSON.h"
 #include "websocket.h"
-#include "sensirion_uart_hal.h"
-#include "sensirion_common.h"
-#include "sps30_uart.h"
+#include "bench.h"
+#include "frame_pool.h"
+#include "client_registry.h"
+#include "conn_budget.h"
+#include "subscription.h"
+#include "client_queue.h"
+#include "metrics.h"
+#include "trace.h"
+#include "ws_command.h"
+#include "asset_cache.h"
+#if CONFIG_WEB_ASSET_BUNDLE
+#include "asset_bundle.h"
+#endif
+#include "ws_protocol.h"
+#include "sensor_events.h"
+#include "sensor_bus.h"
+#include "sensor_stats.h"
+#include "history.h"
+#include "datalog.h"
 
 static const char *TAG = "websocket";
 
@@ -29,32 +50,53 @@ static const char *TAG = "websocket";
         }                                                                              \
     } while (0)
 
-#define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
+#if CONFIG_IDF_TARGET_LINUX
+// Host build serves the web assets straight from the build directory
+#define BASE_PATH_MAX 256
+#else
+#include "esp_vfs.h"
+#define BASE_PATH_MAX ESP_VFS_PATH_MAX
+#endif
+
+#define FILE_PATH_MAX (BASE_PATH_MAX + 128)
 #define SCRATCH_BUFSIZE (10240)
-#define MAX_WEBSOCKET_CLIENTS 5
+// Sockets kept free for plain HTTP requests (page, assets, API)
+#define HTTP_RESERVED_SOCKETS (CONFIG_HTTP_ASSET_SOCKETS + CONFIG_HTTP_API_SOCKETS)
+// Retry interval for client queues left over by a fanout
+#define DRAIN_RETRY_MS 20
+// Longest command a client may send; longer frames close the session
+#define WS_COMMAND_MAX_LEN 256
+// Reconnect delay suggested to /api/stream clients
+#define SSE_RETRY_MS 3000
+// URI handlers registered, see route()
+#define HTTP_MAX_ROUTES 12
+// /metrics is re-rendered at least this often, also while no reading is published
+#define METRICS_REFRESH_MS 5000
 
-typedef struct 
-{
-    int fd;
-} ws_client_t;
+#ifdef CONFIG_LWIP_MAX_SOCKETS
+// httpd itself needs three of the LWIP sockets
+#define HTTPD_SOCKET_LIMIT (CONFIG_LWIP_MAX_SOCKETS - 3)
+#else
+#define HTTPD_SOCKET_LIMIT (CONFIG_WS_MAX_CLIENTS + HTTP_RESERVED_SOCKETS)
+#endif
 
 typedef struct websocket_context 
 {
-    char base_path[ESP_VFS_PATH_MAX + 1];
+    char base_path[BASE_PATH_MAX + 1];
     char scratch[SCRATCH_BUFSIZE];
-    ws_client_t clients[MAX_WEBSOCKET_CLIENTS];
     httpd_handle_t server;
-    SemaphoreHandle_t lock;
+    SemaphoreHandle_t lock;    // guards task
     TaskHandle_t task;
+    esp_timer_handle_t drain_timer;
+    atomic_bool drain_pending;
+    uint32_t slow_disconnects; // httpd task only
+    uint32_t readings;         // readings rendered, broadcast task only
+    char rx[WS_COMMAND_MAX_LEN + 1];   // incoming command, httpd task only
 } websocket_context_t;
 
-typedef struct 
-{
-    httpd_handle_t server;
-    uint8_t *payload;
-    size_t len;
-    ws_client_t clients[MAX_WEBSOCKET_CLIENTS]; // Current client list at the time of broadcast
-} broadcast_arg_t;
+#define ASSET_CACHE_CONTROL_(s) "public, max-age=" #s
+#define ASSET_CACHE_CONTROL_X(s) ASSET_CACHE_CONTROL_(s)
+#define ASSET_CACHE_CONTROL ASSET_CACHE_CONTROL_X(CONFIG_ASSET_MAX_AGE_S)
 
 #define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
 
@@ -77,26 +119,93 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepa
     return httpd_resp_set_type(req, type);
 }
 
+/**
+ * @brief Sends an asset from RAM or mapped flash, or 304 when the client
+ * already has it.
+ */
+static esp_err_t send_asset(httpd_req_t *req, const asset_t *asset)
+{
+    char if_none_match[24];
+
+    httpd_resp_set_hdr(req, "ETag", asset->etag);
+    // Page, scripts and styles keep their names across firmware updates, so
+    // they are revalidated against the ETag every time (a 304 when
+    // unchanged); only images may be reused without asking
+    bool revalidate = CHECK_FILE_EXTENSION(asset->path, ".html") || CHECK_FILE_EXTENSION(asset->path, ".js")
+                     || CHECK_FILE_EXTENSION(asset->path, ".css");
+    httpd_resp_set_hdr(req, "Cache-Control", revalidate ? "no-cache" : ASSET_CACHE_CONTROL);
+
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK
+        && strcmp(if_none_match, asset->etag) == 0)
+    {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    if (asset->type) 
+    {
+        httpd_resp_set_type(req, asset->type);
+    } 
+    else 
+    {
+        set_content_type_from_file(req, asset->path);
+    }
+    if (asset->gzip) 
+    {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+    // Sent in one piece with Content-Length, no copy through scratch
+    return httpd_resp_send(req, (const char *)asset->data, asset->len);
+}
+
 static esp_err_t send_file(httpd_req_t *req)
 {
-    char filepath[FILE_PATH_MAX];
+    char uri_path[ASSET_PATH_MAX];
 
-    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
-    strlcpy(filepath, _context->base_path, sizeof(filepath));
-    if (req->uri[strlen(req->uri) - 1] == '/') 
+    conn_budget_admit(req, CONN_CLASS_ASSET);
+    size_t uri_len = strcspn(req->uri, "?#");
+    if (uri_len == 0 || req->uri[uri_len - 1] == '/') 
     {
-        strlcat(filepath, "/index.html", sizeof(filepath));
+        snprintf(uri_path, sizeof(uri_path), "%.*sindex.html", (int)uri_len, req->uri);
     } 
     else 
     {
-        strlcat(filepath, req->uri, sizeof(filepath));
+        snprintf(uri_path, sizeof(uri_path), "%.*s", (int)uri_len, req->uri);
+    }
+
+#if CONFIG_WEB_ASSET_BUNDLE
+    asset_t bundled;
+    if (asset_bundle_find(uri_path, &bundled)) 
+    {
+        return send_asset(req, &bundled);
+    }
+    httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+    return ESP_FAIL;
+#else
+    char filepath[FILE_PATH_MAX];
+    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+
+    bool missing;
+    const asset_t *asset = asset_cache_get(_context->base_path, uri_path, &missing);
+    if (asset) 
+    {
+        return send_asset(req, asset);
     }
+    if (missing) 
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        return ESP_FAIL;
+    }
+
+    // Not cached (too large for the cache or missing): stream from the filesystem
+    strlcpy(filepath, _context->base_path, sizeof(filepath));
+    strlcat(filepath, uri_path, sizeof(filepath));
     int fd = open(filepath, O_RDONLY, 0);
     if (fd == -1) 
     {
         ESP_LOGE(TAG, "Failed to open file : %s", filepath);
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+        /* Respond with 404 Not Found */
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
         return ESP_FAIL;
     }
 
@@ -136,368 +245,2355 @@ static esp_err_t send_file(httpd_req_t *req)
     /* Respond with an empty chunk to signal HTTP response completion */
     httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
+#endif
 }
 
 /**
- * @brief Sends a JSON response back to a specific client.
- *
- * Used to send ACK/NACK messages for client actions.
- *
- * @param req The HTTP request object, used to identify the client.
- * @param action The original action this response is for (e.g., "registerClient").
- * @param status The result of the action ("success" or "error").
- * @param message A descriptive message.
+ * @brief State of a chunked response rendered into the scratch buffer.
  */
-static void send_response_to_client(httpd_req_t *req, const char *action, const char *status, const char *message) 
+typedef struct
 {
-    cJSON *response_root = cJSON_CreateObject();
-    cJSON_AddStringToObject(response_root, "response_for", action);
-    cJSON_AddStringToObject(response_root, "status", status);
-    cJSON_AddStringToObject(response_root, "message", message);
+    httpd_req_t *req;
+    char *buf;
+    size_t len;
+    bool binary;
+    bool first;
+    uint32_t interval_s;    // history only: bucket width
+    int64_t offset_ms;      // history only: Unix ms of history time 0
+    esp_err_t err;
+} chunk_stream_t;
 
-    const char *response_str = cJSON_PrintUnformatted(response_root);
-    if (response_str) 
+static bool stream_flush(chunk_stream_t *s)
+{
+    if (s->len > 0 && s->err == ESP_OK)
     {
-        httpd_ws_frame_t ws_pkt;
-        memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-        ws_pkt.payload = (uint8_t*)response_str;
-        ws_pkt.len = strlen(response_str);
-        ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+        s->err = httpd_resp_send_chunk(s->req, s->buf, s->len);
+    }
+    s->len = 0;
+    return s->err == ESP_OK;
+}
+
+static bool stream_append_json_array(chunk_stream_t *s, const char *key, const float *v)
+{
+    size_t len = s->len;
+    int n = snprintf(s->buf + len, SCRATCH_BUFSIZE - len, ",\"%s\":[", key);
 
-        // Use httpd_ws_send_frame to send back to the specific client
-        httpd_ws_send_frame(req, &ws_pkt);
+    for (int c = 0; n >= 0 && (size_t)n < SCRATCH_BUFSIZE - len && c < SENSOR_CHANNEL_COUNT; c++)
+    {
+        len += n;
+        n = snprintf(s->buf + len, SCRATCH_BUFSIZE - len, c ? ",%g" : "%g", v[c]);
+    }
+    if (n < 0 || (size_t)n + 1 >= SCRATCH_BUFSIZE - len)
+    {
+        return false;
     }
+    len += n;
+    s->buf[len++] = ']';
+    s->len = len;
+    return true;
+}
 
-    cJSON_Delete(response_root);
-    free((void*)response_str);
+// ,"key":value, or null for a value that is not available (NAN)
+static bool stream_append_json_number(chunk_stream_t *s, const char *key, float v)
+{
+    int n = isnan(v) ? snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len, ",\"%s\":null", key)
+                     : snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len, ",\"%s\":%g", key, v);
+    if (n < 0 || (size_t)n >= SCRATCH_BUFSIZE - s->len)
+    {
+        return false;
+    }
+    s->len += n;
+    return true;
 }
 
 /**
- * @brief Adds a new client's file descriptor to the list of clients.
- *
- * @param new_fd The file descriptor of the new client.
- * @return esp_err_t ESP_OK on success, ESP_FAIL if the client list is full.
+ * @brief history_read() callback that renders entries into the scratch buffer
+ * and sends it as a chunk whenever it fills up.
  */
-static esp_err_t add_client(websocket_context_t* _context, int new_fd) 
+static bool history_entry_cb(const history_entry_t *e, void *ctx)
 {
-    if (xSemaphoreTake(_context->lock, portMAX_DELAY) == pdTRUE) 
+    chunk_stream_t *s = (chunk_stream_t *)ctx;
+    int64_t timestamp_ms = s->offset_ms + (int64_t)e->t_s * 1000;
+
+    if (s->binary)
     {
-        for (int i = 0; i < MAX_WEBSOCKET_CLIENTS; i++) 
+        if (SCRATCH_BUFSIZE - s->len < sizeof(ws_binary_rollup_t) && !stream_flush(s))
         {
-            if (_context->clients[i].fd >= 0)
-                continue;
-
-            _context->clients[i].fd = new_fd;
-            ESP_LOGI(TAG, "Client connected, fd=%d", new_fd);
-            xSemaphoreGive(_context->lock);
-            return ESP_OK;
+            return false;
         }
-        ESP_LOGW(TAG, "Client list full, connection rejected for fd=%d", new_fd);
-        xSemaphoreGive(_context->lock);
-        return ESP_FAIL;
+        if (s->interval_s == 1)
+        {
+            ws_binary_reading_t rec = {
+                .version = WS_BINARY_VERSION,
+                .sensor_id = e->sensor_id,
+                .timestamp_ms = timestamp_ms,
+            };
+            memcpy(rec.values, e->mean, sizeof(rec.values));
+            memcpy(s->buf + s->len, &rec, sizeof(rec));
+            s->len += sizeof(rec);
+        }
+        else
+        {
+            ws_binary_rollup_t rec = {
+                .version = WS_BINARY_VERSION,
+                .sensor_id = e->sensor_id,
+                .count = e->count,
+                .interval_s = s->interval_s,
+                .timestamp_ms = timestamp_ms,
+            };
+            memcpy(rec.mean, e->mean, sizeof(rec.mean));
+            memcpy(rec.min, e->min, sizeof(rec.min));
+            memcpy(rec.max, e->max, sizeof(rec.max));
+            memcpy(s->buf + s->len, &rec, sizeof(rec));
+            s->len += sizeof(rec);
+        }
+        return true;
     }
-    return ESP_FAIL;
+
+    // One JSON entry is well below 1 KB
+    if (SCRATCH_BUFSIZE - s->len < 1024 && !stream_flush(s))
+    {
+        return false;
+    }
+    int n = snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len,
+        "%s{\"t\":%" PRId64 ",\"sensor\":%u,\"n\":%u",
+        s->first ? "" : ",", timestamp_ms, e->sensor_id, e->count);
+    s->len += n;
+    s->first = false;
+    int aqi_pm2_5 = sensor_aqi_pm2_5(e->nowcast_pm2_5);
+    int aqi_pm10 = sensor_aqi_pm10(e->nowcast_pm10);
+    if (!stream_append_json_array(s, "mean", e->mean)
+        || (s->interval_s > 1 && (!stream_append_json_array(s, "min", e->min)
+                                  || !stream_append_json_array(s, "max", e->max)))
+        || !stream_append_json_number(s, "nowcast_pm2_5", e->nowcast_pm2_5)
+        || !stream_append_json_number(s, "nowcast_pm10", e->nowcast_pm10)
+        || !stream_append_json_number(s, "aqi_pm2_5", aqi_pm2_5 < 0 ? NAN : aqi_pm2_5)
+        || !stream_append_json_number(s, "aqi_pm10", aqi_pm10 < 0 ? NAN : aqi_pm10))
+    {
+        s->err = ESP_ERR_NO_MEM;
+        return false;
+    }
+    s->buf[s->len++] = '}';
+    return true;
 }
 
 /**
- * @brief Removes a client's file descriptor from the list.
+ * @brief GET /api/history?tier=second|minute|hour&since=<unix ms>&format=json|bin&sensor=<n>|all
  *
- * @param fd_to_remove The file descriptor of the client to remove.
+ * Streams one history tier, oldest first, in chunks. Without a sensor (or
+ * with sensor=all) the tiers of all sensors follow one another, each entry
+ * tagged with its sensor. The rollups are kept up
+ * to date as samples arrive, so this only copies stored entries out.
  */
-static void remove_client(websocket_context_t* _context, int fd_to_remove) 
+static esp_err_t history_get_handler(httpd_req_t *req)
 {
-    if (xSemaphoreTake(_context->lock, portMAX_DELAY) == pdTRUE) 
+    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+    char query[96] = {0};
+    char value[24];
+    history_tier_t tier = HISTORY_TIER_SECOND;
+    bool binary = false;
+    int64_t since_ms = 0;
+    int first_sensor = 0;
+    int last_sensor = SENSOR_COUNT - 1;
+
+    conn_budget_admit(req, CONN_CLASS_API);
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
     {
-        for (int i = 0; i < MAX_WEBSOCKET_CLIENTS; i++) 
+        if (httpd_query_key_value(query, "tier", value, sizeof(value)) == ESP_OK)
         {
-            if (_context->clients[i].fd == fd_to_remove) 
+            if (strcmp(value, "second") == 0)
+                tier = HISTORY_TIER_SECOND;
+            else if (strcmp(value, "minute") == 0)
+                tier = HISTORY_TIER_MINUTE;
+            else if (strcmp(value, "hour") == 0)
+                tier = HISTORY_TIER_HOUR;
+            else
             {
-                _context->clients[i].fd = -1;
-                ESP_LOGI(TAG, "Client disconnected, fd=%d", fd_to_remove);
-                break;
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown tier");
+                return ESP_FAIL;
             }
         }
-        xSemaphoreGive(_context->lock);
+        if (httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK)
+        {
+            binary = strcmp(value, "bin") == 0;
+        }
+        if (httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK)
+        {
+            since_ms = strtoll(value, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "sensor", value, sizeof(value)) == ESP_OK
+            && strcmp(value, "all") != 0)
+        {
+            char *end;
+            long sensor = strtol(value, &end, 10);
+            if (*end != '\0' || sensor < 0 || sensor >= SENSOR_COUNT)
+            {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown sensor");
+                return ESP_FAIL;
+            }
+            first_sensor = last_sensor = (int)sensor;
+        }
     }
-}
 
+    static const char *tier_names[HISTORY_TIER_COUNT] = { "second", "minute", "hour" };
+    chunk_stream_t s = {
+        .req = req,
+        .buf = _context->scratch,
+        .binary = binary,
+        .first = true,
+        .interval_s = history_interval_s(tier),
+        .offset_ms = history_to_unix_ms(0),
+        .err = ESP_OK,
+    };
+    int64_t since_s = since_ms > s.offset_ms ? (since_ms - s.offset_ms + 999) / 1000 : 0;
 
-static int sps30_init() 
-{
-    int16_t error = NO_ERROR;
+    httpd_resp_set_type(req, binary ? "application/octet-stream" : "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    if (!binary)
+    {
+        s.len = snprintf(s.buf, SCRATCH_BUFSIZE,
+            "{\"tier\":\"%s\",\"interval_s\":%" PRIu32 ",\"entries\":[",
+            tier_names[tier], s.interval_s);
+    }
 
-    // input parameter unused for this application
-    error = sensirion_uart_hal_init(0);
-    if (error != NO_ERROR) 
+    for (int sensor = first_sensor; sensor <= last_sensor && s.err == ESP_OK; sensor++)
     {
-        printf("error executing sensirion_uart_hal_init(): %i\n", error);
+        history_read(sensor, tier, since_s > UINT32_MAX ? UINT32_MAX : (uint32_t)since_s,
+                     history_entry_cb, &s);
     }
 
-    error = sps30_stop_measurement();
-    if (error != NO_ERROR) 
+    if (!binary && s.err == ESP_OK)
     {
-        printf("error executing sps30_stop_measurement(): %i\n", error);
+        s.buf[s.len++] = ']';
+        s.buf[s.len++] = '}';
     }
-    
-    //float outputs
-    error = sps30_start_measurement((sps30_output_format)(259));
-    if (error != NO_ERROR) 
+    if (!stream_flush(&s))
     {
-        printf("error executing start_measurement(): %i\n", error);
-        return error;
+        ESP_LOGW(TAG, "history send failed: %s", esp_err_to_name(s.err));
+        httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
     }
-
-    return NO_ERROR;
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
 }
 
-static void broadcast_work_cb(void *arg)
+/**
+ * @brief datalog_read() callback, renders CSV lines or ws_binary_reading_t
+ * records into the scratch buffer.
+ */
+static bool datalog_entry_cb(const datalog_entry_t *e, void *ctx)
 {
-    broadcast_arg_t *a = (broadcast_arg_t *)arg;
-    if (!a) return;
-
-    httpd_ws_frame_t tx = {
-        .final = true,
-        .fragmented = false,
-        .type = HTTPD_WS_TYPE_TEXT,
-        .payload = a->payload,
-        .len = a->len
-    };
+    chunk_stream_t *s = (chunk_stream_t *)ctx;
 
-    for (int i = 0; i < MAX_WEBSOCKET_CLIENTS; ++i) 
+    if (SCRATCH_BUFSIZE - s->len < 256 && !stream_flush(s))
     {
-        int fd = a->clients[i].fd;
-        if (fd < 0) continue;
+        return false;
+    }
+    if (s->binary)
+    {
+        // The log holds the valid readings of sensor 0 only
+        ws_binary_reading_t rec = {
+            .version = WS_BINARY_VERSION,
+            .status = SENSOR_OK,
+            .sensor_id = 0,
+            .timestamp_ms = (int64_t)e->t_s * 1000,
+        };
+        memcpy(rec.values, e->values, sizeof(rec.values));
+        memcpy(s->buf + s->len, &rec, sizeof(rec));
+        s->len += sizeof(rec);
+        return true;
+    }
 
-        ESP_LOGI(TAG, "client %d package sent.", fd);
-        httpd_ws_send_frame_async(a->server, fd, &tx);
+    // A row that does not fit is left out, as before
+    size_t len = s->len;
+    int n = snprintf(s->buf + len, SCRATCH_BUFSIZE - len, "%" PRIu32, e->t_s);
+    for (int c = 0; n > 0 && (size_t)n < SCRATCH_BUFSIZE - len && c < SENSOR_CHANNEL_COUNT; c++)
+    {
+        len += n;
+        n = snprintf(s->buf + len, SCRATCH_BUFSIZE - len, ",%g", e->values[c]);
     }
+    if (n > 0 && (size_t)n + 1 < SCRATCH_BUFSIZE - len)
+    {
+        len += n;
+        s->buf[len++] = '\n';
+        s->len = len;
+    }
+    return true;
+}
+
+// Records sent per step of a /api/datalog download
+#define DATALOG_EXPORT_BATCH 64
 
-    // free payload & arg
-    free(a->payload);
-    free(a);
+/*
+ * A /api/datalog download in progress. It is sent DATALOG_EXPORT_BATCH
+ * records at a time, one httpd work item each, so a long range does not hold
+ * up the other sessions. Each step resumes at the second of the last record
+ * sent and skips the records of that second it already sent.
+ */
+typedef struct
+{
+    websocket_context_t *context;
+    chunk_stream_t stream;
+    uint32_t from_s;
+    uint32_t to_s;
+    uint32_t skip;          // records at from_s sent by the previous step
+    uint32_t sent;          // records sent by this step
+} datalog_export_t;
+
+static bool datalog_export_cb(const datalog_entry_t *e, void *ctx)
+{
+    datalog_export_t *x = (datalog_export_t *)ctx;
+
+    if (x->skip > 0 && e->t_s == x->from_s)
+    {
+        x->skip--;
+        return true;
+    }
+    if (!datalog_entry_cb(e, &x->stream))
+    {
+        return false;
+    }
+    if (e->t_s != x->from_s)
+    {
+        x->from_s = e->t_s;
+        x->skip = 0;
+    }
+    x->skip++;
+    return ++x->sent < DATALOG_EXPORT_BATCH;
 }
 
 /**
- * @brief Task to broadcast dummy data to all connected WebSocket clients.
- *
- * Runs in a loop, creates a JSON payload, and sends it to every client
- * in the client list every 2 seconds.
+ * @brief Send the next batch of an export as one chunk.
  *
- * @param pvParameters context.
+ * @return true when the export is complete or the send failed.
  */
-void broadcast_task(void *pvParameters)
+static bool datalog_export_step(datalog_export_t *x)
 {
-    websocket_context_t *_context = (websocket_context_t*)pvParameters;
-    int16_t error = NO_ERROR;
-    float mc_1p0 = 0;
-    float mc_2p5 = 0;
-    float mc_4p0 = 0;
-    float mc_10p0 = 0;
-    float nc_0p5 = 0;
-    float nc_1p0 = 0;
-    float nc_2p5 = 0;
-    float nc_4p0 = 0;
-    float nc_10p0 = 0;
-    float typical_particle_size = 0;
-    const char *OK = "OK";
-    const char *NOK = "NOK";
+    x->sent = 0;
+    x->stream.buf = x->context->scratch;
+    datalog_read(x->from_s, x->to_s, datalog_export_cb, x);
+    return !stream_flush(&x->stream) || x->sent < DATALOG_EXPORT_BATCH;
+}
 
-    for (;;) 
+static void datalog_export_finish(datalog_export_t *x)
+{
+    httpd_req_t *req = x->stream.req;
+
+    if (x->stream.err != ESP_OK)
     {
-        cJSON *root = cJSON_CreateObject();
-        error = sps30_read_measurement_values_float(
-            &mc_1p0, &mc_2p5, &mc_4p0, &mc_10p0, &nc_0p5, &nc_1p0, &nc_2p5,
-            &nc_4p0, &nc_10p0, &typical_particle_size);
-        if (error != NO_ERROR) 
-        {
-            printf("error executing read_measurement_values_uint16(): %i\n",
-                   error);
-            cJSON_AddStringToObject(root, "status", NOK);
-        }
-        else
-        {
-            cJSON_AddStringToObject(root, "status", OK);
-        }
-        cJSON_AddNumberToObject(root, "mc_1p0", mc_1p0);
-        cJSON_AddNumberToObject(root, "mc_2p5", mc_2p5);
-        cJSON_AddNumberToObject(root, "mc_4p0", mc_4p0);
-        cJSON_AddNumberToObject(root, "mc_10p0", mc_10p0);
-        cJSON_AddNumberToObject(root, "nc_0p5", nc_0p5);
-        cJSON_AddNumberToObject(root, "nc_1p0", nc_1p0);
-        cJSON_AddNumberToObject(root, "nc_2p5", nc_2p5);
-        cJSON_AddNumberToObject(root, "nc_4p0", nc_4p0);
-        cJSON_AddNumberToObject(root, "nc_10p0", nc_10p0);
-        cJSON_AddNumberToObject(root, "typical_particle_size", typical_particle_size);
+        ESP_LOGW(TAG, "datalog send failed: %s", esp_err_to_name(x->stream.err));
+        httpd_sess_trigger_close(x->context->server, httpd_req_to_sockfd(req));
+    }
+    else
+    {
+        httpd_resp_send_chunk(req, NULL, 0);
+    }
+    conn_budget_release(req);
+    httpd_req_async_handler_complete(req);
+    free(x);
+}
 
-        char *json_string = cJSON_PrintUnformatted(root);
-        cJSON_Delete(root);
+static void datalog_export_work_cb(void *arg)
+{
+    datalog_export_t *x = (datalog_export_t *)arg;
 
-        if (!json_string) 
-        {
-            ESP_LOGE(TAG, "Failed to print cJSON");
-            vTaskDelay(pdMS_TO_TICKS(1000));
-            continue;
-        }
-        
-        ESP_LOGI(TAG, "broadcast string: %s.", json_string);
-        
-        // copy payload once to heap
-        size_t len = strlen(json_string);
-        broadcast_arg_t *arg = malloc(sizeof(*arg));
-        if (!arg) 
+    if (datalog_export_step(x))
+    {
+        datalog_export_finish(x);
+    }
+    else if (httpd_queue_work(x->context->server, datalog_export_work_cb, x) != ESP_OK)
+    {
+        x->stream.err = ESP_FAIL;
+        datalog_export_finish(x);
+    }
+}
+
+/**
+ * @brief GET /api/datalog?from=<unix ms>&to=<unix ms>&format=csv|bin
+ *
+ * Streams the persisted readings straight from flash as a chunked download.
+ * The start page is found through the data log's page index. The first batch
+ * is sent from the handler; a longer range continues through the async
+ * request API in httpd work items, interleaved with the other sessions.
+ */
+static esp_err_t datalog_get_handler(httpd_req_t *req)
+{
+    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+    char query[96] = {0};
+    char value[24];
+    bool binary = false;
+    int64_t from_ms = 0;
+    int64_t to_ms = INT64_MAX;
+
+    conn_budget_admit(req, CONN_CLASS_API);
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK)
         {
-            ESP_LOGE(TAG, "no mem for broadcast arg");
-            return;
+            binary = strcmp(value, "bin") == 0;
         }
-        arg->payload = malloc(len);
-        if (!arg->payload) 
+        if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK)
         {
-            free(arg);
-            ESP_LOGE(TAG, "no mem for payload");
-            return;
+            from_ms = strtoll(value, NULL, 10);
         }
-        
-        memcpy(arg->payload, json_string, len);
-        xSemaphoreTake(_context->lock, portMAX_DELAY);
-        for (int i = 0; i < MAX_WEBSOCKET_CLIENTS; ++i) 
+        if (httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK)
         {
-            arg->clients[i].fd = _context->clients[i].fd;
+            to_ms = strtoll(value, NULL, 10);
         }
-        arg->len = len;
-        arg->server = _context->server;
-        xSemaphoreGive(_context->lock);
+    }
+
+    datalog_export_t first = {
+        .context = _context,
+        .stream = {
+            .req = req,
+            .buf = _context->scratch,
+            .binary = binary,
+            .err = ESP_OK,
+        },
+        .from_s = from_ms <= 0 ? 0 : from_ms / 1000 > UINT32_MAX ? UINT32_MAX : (uint32_t)(from_ms / 1000),
+        .to_s = to_ms / 1000 >= UINT32_MAX ? UINT32_MAX : to_ms < 0 ? 0 : (uint32_t)(to_ms / 1000),
+    };
+
+    httpd_resp_set_type(req, binary ? "application/octet-stream" : "text/csv");
+    httpd_resp_set_hdr(req, "Content-Disposition",
+                       binary ? "attachment; filename=\"datalog.bin\"" : "attachment; filename=\"datalog.csv\"");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    if (!binary)
+    {
+#define CSV_COLUMN(NAME, field, key, ...) "," key
+        first.stream.len = snprintf(first.stream.buf, SCRATCH_BUFSIZE, "%s", "timestamp" SENSOR_CHANNELS(CSV_COLUMN) "\n");
+#undef CSV_COLUMN
+    }
 
-        esp_err_t r = httpd_queue_work(_context->server, broadcast_work_cb, arg);
-        if (r != ESP_OK) 
+    if (datalog_export_step(&first))
+    {
+        if (first.stream.err != ESP_OK)
         {
-            ESP_LOGW(TAG, "httpd_queue_work failed: 0x%x", r);
-            free(arg->payload);
-            free(arg);
+            ESP_LOGW(TAG, "datalog send failed: %s", esp_err_to_name(first.stream.err));
+            httpd_resp_sendstr_chunk(req, NULL);
+            return ESP_FAIL;
         }
+        httpd_resp_send_chunk(req, NULL, 0);
+        return ESP_OK;
+    }
 
-        free(json_string);
-
-        vTaskDelay(pdMS_TO_TICKS(1000)); // or your desired rate
+    datalog_export_t *x = malloc(sizeof(*x));
+    if (!x)
+    {
+        return ESP_FAIL;
+    }
+    *x = first;
+    if (httpd_req_async_handler_begin(req, &x->stream.req) != ESP_OK)
+    {
+        free(x);
+        return ESP_FAIL;
+    }
+    // The session must not be evicted while work items still send on it
+    conn_budget_hold(x->stream.req);
+    if (httpd_queue_work(_context->server, datalog_export_work_cb, x) != ESP_OK)
+    {
+        x->stream.err = ESP_FAIL;
+        datalog_export_finish(x);
     }
+    return ESP_OK;
 }
 
-//     if (req->method == HTTP_GET) {
-//         ESP_LOGI(TAG, "Handshake done, new connection was opened");
-//         return ESP_OK;
-//     }
+#if CONFIG_TRACE_ENABLE
+typedef struct
+{
+    chunk_stream_t stream;
+    uint32_t seen[256 / 32];    // thread indexes that have events
+} trace_stream_t;
 
-//     websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+/**
+ * @brief trace_foreach() callback that renders one Chrome trace event.
+ */
+static void trace_event_cb(const trace_event_t *e, void *ctx)
+{
+    trace_stream_t *t = (trace_stream_t *)ctx;
+    chunk_stream_t *s = &t->stream;
 
-//     int client_fd = httpd_req_to_sockfd(req);
-//     if (add_client(_context, client_fd) != ESP_OK) 
-//     {
-//         // If we can't add the client, close the connection
-//         httpd_sess_trigger_close(req->handle, client_fd);
-//         return ESP_OK;
-//     }
+    if (SCRATCH_BUFSIZE - s->len < 160 && !stream_flush(s))
+    {
+        return;
+    }
+    t->seen[e->thread / 32] |= 1u << (e->thread % 32);
 
-static esp_err_t ws_handler(httpd_req_t *req) 
-{
-    if (req->method == HTTP_GET) 
+    bool async = e->phase == TRACE_PHASE_ASYNC_BEGIN || e->phase == TRACE_PHASE_ASYNC_END;
+    s->len += snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len,
+        "%s{\"name\":\"%s\",\"cat\":\"sps30\",\"ph\":\"%c\",\"ts\":%" PRId64 ",\"pid\":1,\"tid\":%u",
+        s->first ? "" : ",\n", e->name, e->phase, e->ts_us, e->thread);
+    if (async)
     {
-        ESP_LOGI(TAG, "Handshake done, new connection was opened");
-        return ESP_OK;
+        s->len += snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len, ",\"id\":\"0x%" PRIx32 "\"", e->id);
     }
+    s->len += snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len, ",\"args\":{\"core\":%u}}", e->core);
+    s->first = false;
+}
 
+/**
+ * @brief GET /api/trace: the trace rings as Chrome Trace Event JSON, for
+ * Perfetto (ui.perfetto.dev) or chrome://tracing.
+ */
+static esp_err_t trace_get_handler(httpd_req_t *req)
+{
     websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+    trace_stream_t t = {
+        .stream = {
+            .req = req,
+            .buf = _context->scratch,
+            .first = true,
+            .err = ESP_OK,
+        },
+    };
+    chunk_stream_t *s = &t.stream;
 
-    int client_fd = httpd_req_to_sockfd(req);
-    httpd_ws_frame_t ws_pkt;
-    uint8_t *buf = NULL;
-    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
-    
-    /* Set max_len = 0 to get the frame len */
-    esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
-    if (ret != ESP_OK) 
-    {
-        ESP_LOGE(TAG, "httpd_ws_recv_frame failed to get frame len with %d", ret);
-        remove_client(_context, client_fd);
-        return ret;
-    }
-    
-    if (ws_pkt.len > 0) 
-    {
-        /* ws_pkt.len + 1 is for NULL termination as we are expecting a string */
-        buf = calloc(1, ws_pkt.len + 1);
-        if (buf == NULL) {
-            ESP_LOGE(TAG, "Failed to calloc memory for buf");
-            remove_client(_context, client_fd);
-            return ESP_ERR_NO_MEM;
-        }
-
-        ws_pkt.payload = buf;
-        /* Set max_len = ws_pkt.len to get the frame payload */
-        ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG, "httpd_ws_recv_frame failed with %d", ret);
-            free(buf);
-            remove_client(_context, client_fd);
-            return ret;
-        }
-        ESP_LOGI(TAG, "Got packet with message: %s", ws_pkt.payload);
-
-        // JSON parsing
-        cJSON *root = cJSON_Parse((const char *)ws_pkt.payload);
-        if (root) {
-            cJSON *action_item = cJSON_GetObjectItem(root, "action");
-            if (action_item && cJSON_IsString(action_item)) 
-            {
-                const char *action_str = action_item->valuestring;
-                ESP_LOGI(TAG, "Received action: %s from fd: %d", action_str, client_fd);
+    conn_budget_admit(req, CONN_CLASS_API);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"sps30-trace.json\"");
+    s->len = snprintf(s->buf, SCRATCH_BUFSIZE, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
 
-                if (strcmp(action_str, "registerClient") == 0) 
-                {
-                    if (add_client(_context, client_fd) == ESP_OK) 
-                    {
-                        send_response_to_client(req, "registerClient", "success", "Client registered successfully.");
-                    } else 
-                    {
-                        send_response_to_client(req, "registerClient", "error", "Client list is full.");
-                    }
-                } else if (strcmp(action_str, "closeConnection") == 0) 
-                {
-                    remove_client(_context, client_fd);
-                    send_response_to_client(req, "closeConnection", "success", "Connection will be closed.");
-                    // The session will be closed after this handler returns
-                    httpd_sess_trigger_close(req->handle, client_fd);
-                } else 
-                {
-                    send_response_to_client(req, action_str, "error", "Unknown action.");
-                }
-            }
-            cJSON_Delete(root);
-        } else 
+    trace_foreach(trace_event_cb, &t);
+
+    // Task names for the threads that appear above
+    for (int i = 0; i < 256 && s->err == ESP_OK; i++)
+    {
+        const char *name = (t.seen[i / 32] & (1u << (i % 32))) ? trace_thread_name(i) : NULL;
+        if (!name)
+        {
+            continue;
+        }
+        if (SCRATCH_BUFSIZE - s->len < 128 && !stream_flush(s))
         {
-             send_response_to_client(req, "parse", "error", "Invalid JSON format.");
+            break;
         }
+        s->len += snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len,
+            "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            s->first ? "" : ",\n", i, name);
+        s->first = false;
     }
 
-    if (ws_pkt.type == HTTPD_WS_TYPE_CLOSE) 
+    if (s->err == ESP_OK)
     {
-        remove_client(_context, client_fd);
+        s->len += snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len, "]}\n");
     }
-    
-    free(buf);
-    return ESP_OK;
+    if (!stream_flush(s))
+    {
+        ESP_LOGW(TAG, "trace send failed: %s", esp_err_to_name(s->err));
+        httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+    return httpd_resp_sendstr_chunk(req, NULL);
 }
+#endif
 
-esp_err_t websocket_server_start(const char *base_path) 
+/**
+ * @brief GET /api/clients: per-client subscription and send queue state.
+ *
+ * Runs on the httpd task like every queue operation, so the counters are
+ * read without locking.
+ */
+static esp_err_t clients_get_handler(httpd_req_t *req)
 {
-    WEBSOCKET_CHECK(base_path, "wrong base path", err);
-    websocket_context_t *_context = calloc(1, sizeof(websocket_context_t));
-    WEBSOCKET_CHECK(_context, "No memory for sunrise server context", err);
-    strlcpy(_context->base_path, base_path, sizeof(_context->base_path));
+    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+    static const char *policy_names[] = { "coalesce", "drop" };
+    frame_pool_stats_t pool;
+    char *buf = _context->scratch;
+    size_t len = 0;
+
+    conn_budget_admit(req, CONN_CLASS_API);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    frame_pool_get_stats(&pool);
+    len += snprintf(buf + len, SCRATCH_BUFSIZE - len,
+        "{\"capacity\":%d,\"queue_len\":%d,\"slow_disconnects\":%" PRIu32 ","
+        "\"frame_pool\":{\"in_use\":%" PRIu32 ",\"in_use_max\":%" PRIu32 ",\"exhausted\":%" PRIu32 "},"
+        "\"clients\":[",
+        client_registry_capacity(), CONFIG_WS_CLIENT_QUEUE_LEN, _context->slow_disconnects,
+        pool.in_use, pool.in_use_max, pool.exhausted);
+
+    const client_snapshot_t *snapshot = client_registry_acquire();
+    for (int i = 0; i < snapshot->count; ++i) 
+    {
+        const ws_client_t *c = &snapshot->clients[i];
+        client_queue_stats_t q;
+        ws_subscription_t spec;
+        uint32_t generation;
+        client_queue_get_stats(c->slot, &q);
+        if (!subscription_read(c->subscription, &spec, &generation))
+        {
+            spec = subscription_default(c->encoding);
+        }
+        len += snprintf(buf + len, SCRATCH_BUFSIZE - len,
+            "%s{\"fd\":%d,\"transport\":\"%s\",\"encoding\":\"%s\",\"channels\":%u,\"every\":%u,\"batch\":%u,"
+            "\"policy\":\"%s\",\"queue_depth\":%" PRIu32 ","
+            "\"queue_depth_max\":%" PRIu32 ",\"sent\":%" PRIu32 ",\"dropped\":%" PRIu32 ","
+            "\"saturated\":%" PRIu32 ",\"latency_us\":{\"last\":%" PRIu32 ",\"avg\":%" PRIu32 ",\"max\":%" PRIu32 "}}",
+            i ? "," : "", c->fd, c->transport == CLIENT_TRANSPORT_SSE ? "sse" : "ws", c->encoding == WS_ENCODING_BINARY ? "binary" : "json",
+            spec.channels, spec.every, spec.batch, policy_names[q.policy], q.depth, q.depth_max, q.sent, q.dropped, q.saturated,
+            q.latency_us_last, q.latency_us_avg, q.latency_us_max);
+        // One entry is well under 512 bytes
+        if (len > SCRATCH_BUFSIZE - 512) 
+        {
+            httpd_resp_send_chunk(req, buf, len);
+            len = 0;
+        }
+    }
+    client_registry_release(snapshot);
+
+    len += snprintf(buf + len, SCRATCH_BUFSIZE - len, "]}");
+    httpd_resp_send_chunk(req, buf, len);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/**
+ * @brief GET /api/sampling
+ *
+ * Sampling profile, and per sensor how well the readers track the sensors'
+ * 1 s measurement clock: readings taken, missed and duplicated, polls
+ * without new data and pick-up jitter.
+ */
+static esp_err_t sampling_get_handler(httpd_req_t *req)
+{
+    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+    sensor_sched_report_t report;
+    char *buf = _context->scratch;
+    size_t len = 0;
+
+    conn_budget_admit(req, CONN_CLASS_API);
+    sensor_task_get_sched_report(&report);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    len += snprintf(buf + len, SCRATCH_BUFSIZE - len,
+        "{\"profile\":\"%s\",\"period_s\":%" PRIu32 ",\"awake_s\":%" PRIu32 ","
+        "\"published\":%" PRIu32 ",\"publish_jitter_us\":{\"avg\":%" PRIu32 ",\"max\":%" PRIu32 "},"
+        "\"sensors\":[",
+        sensor_profile_name(report.profile.mode), report.profile.period_s, report.profile.awake_s,
+        report.published, report.publish_jitter_us_avg, report.publish_jitter_us_max);
+    for (int i = 0; i < SENSOR_COUNT; i++) 
+    {
+        const sensor_sched_stats_t *st = &report.sensors[i];
+        len += snprintf(buf + len, SCRATCH_BUFSIZE - len,
+            "%s{\"id\":%d,\"samples\":%" PRIu32 ",\"missed\":%" PRIu32 ",\"duplicates\":%" PRIu32 ","
+            "\"not_ready\":%" PRIu32 ",\"jitter_us\":{\"last\":%" PRIu32 ",\"avg\":%" PRIu32 ",\"max\":%" PRIu32 "}}",
+            i ? "," : "", i, st->samples, st->missed, st->duplicates, st->not_ready,
+            st->jitter_us_last, st->jitter_us_avg, st->jitter_us_max);
+    }
+    len += snprintf(buf + len, SCRATCH_BUFSIZE - len, "]}");
+    return httpd_resp_send(req, buf, len);
+}
+
+/**
+ * @brief POST /api/sampling {"profile":"live"|"averaged"|"duty","period_s":n,"awake_s":n}
+ *
+ * Switches the sampling profile at runtime. Omitted periods keep their
+ * configured defaults.
+ */
+static esp_err_t sampling_post_handler(httpd_req_t *req)
+{
+    char body[128];
+    int received = 0;
+
+    conn_budget_admit(req, CONN_CLASS_API);
+    if (req->content_len >= sizeof(body)) 
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Body too long");
+        return ESP_FAIL;
+    }
+    while (received < (int)req->content_len) 
+    {
+        int r = httpd_req_recv(req, body + received, req->content_len - received);
+        if (r <= 0) 
+        {
+            if (r == HTTPD_SOCK_ERR_TIMEOUT) 
+                continue;
+            return ESP_FAIL;
+        }
+        received += r;
+    }
+    body[received] = '\0';
+
+    cJSON *root = cJSON_Parse(body);
+    const cJSON *mode = cJSON_GetObjectItem(root, "profile");
+    const cJSON *period = cJSON_GetObjectItem(root, "period_s");
+    const cJSON *awake = cJSON_GetObjectItem(root, "awake_s");
+    sensor_profile_t profile = 
+    {
+        .mode = cJSON_IsString(mode) ? sensor_profile_from_name(mode->valuestring) : SENSOR_PROFILE_COUNT,
+    };
+    if (profile.mode == SENSOR_PROFILE_AVERAGED) 
+    {
+        profile.period_s = CONFIG_SENSOR_AVERAGE_PERIOD_S;
+    }
+    else if (profile.mode == SENSOR_PROFILE_DUTY_CYCLE) 
+    {
+        profile.period_s = CONFIG_SENSOR_DUTY_PERIOD_S;
+        profile.awake_s = CONFIG_SENSOR_DUTY_AWAKE_S;
+    }
+    // Range-checked before the cast; a double beyond uint32_t does not convert
+    bool in_range = true;
+    if (cJSON_IsNumber(period)) 
+    {
+        in_range = period->valuedouble >= 0 && period->valuedouble <= SENSOR_PROFILE_MAX_PERIOD_S;
+        if (in_range) 
+        {
+            profile.period_s = (uint32_t)period->valuedouble;
+        }
+    }
+    if (cJSON_IsNumber(awake) && in_range) 
+    {
+        in_range = awake->valuedouble >= 0 && awake->valuedouble <= SENSOR_PROFILE_MAX_AWAKE_S;
+        if (in_range) 
+        {
+            profile.awake_s = (uint32_t)awake->valuedouble;
+        }
+    }
+    cJSON_Delete(root);
+
+    if (!in_range) 
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "period_s or awake_s out of range");
+        return ESP_FAIL;
+    }
+
+    if (sensor_task_set_profile(&profile) != ESP_OK) 
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid profile");
+        return ESP_FAIL;
+    }
+    return sampling_get_handler(req);
+}
+
+/**
+ * @brief GET /metrics, accounted as an API request.
+ */
+static esp_err_t metrics_handler(httpd_req_t *req)
+{
+    conn_budget_admit(req, CONN_CLASS_API);
+    return metrics_get_handler(req);
+}
+
+/**
+ * @brief Sends a response, with the command handle unless it is 0.
+ *
+ * Rendered into a stack buffer; the action is echoed from the client, so it
+ * is escaped and cut to fit.
+ */
+static void send_response_with_handle(httpd_req_t *req, const char *action, const char *status,
+                                      const char *message, sensor_command_handle_t handle)
+{
+    char escaped[WS_COMMAND_MAX_LEN / 2];
+    char response[sizeof(escaped) + 160];
+
+    ws_json_escape(escaped, sizeof(escaped), action);
+    int len = snprintf(response, sizeof(response),
+        "{\"response_for\":\"%s\",\"status\":\"%s\",\"message\":\"%s\"", escaped, status, message);
+    if (handle != 0)
+    {
+        len += snprintf(response + len, sizeof(response) - len, ",\"handle\":%" PRIu32, handle);
+    }
+    len += snprintf(response + len, sizeof(response) - len, "}");
+
+    httpd_ws_frame_t ws_pkt;
+    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+    ws_pkt.payload = (uint8_t*)response;
+    ws_pkt.len = len < (int)sizeof(response) ? (size_t)len : sizeof(response) - 1;
+    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
+
+    // Use httpd_ws_send_frame to send back to the specific client
+    httpd_ws_send_frame(req, &ws_pkt);
+}
+
+/**
+ * @brief Sends a JSON response back to a specific client.
+ *
+ * Used to send ACK/NACK messages for client actions.
+ *
+ * @param req The HTTP request object, used to identify the client.
+ * @param action The original action this response is for (e.g., "registerClient").
+ * @param status The result of the action ("success" or "error").
+ * @param message A descriptive message.
+ */
+static void send_response_to_client(httpd_req_t *req, const char *action, const char *status, const char *message) 
+{
+    send_response_with_handle(req, action, status, message, 0);
+}
+
+/**
+ * @brief Submits a sensor command and tells the client its handle.
+ *
+ * The reply only says whether the command was queued; progress follows as
+ * {"command":{...}} status messages to every client.
+ */
+static void submit_command(httpd_req_t *req, const char *action, command_event_id_t command)
+{
+    sensor_command_handle_t handle = 0;
+    esp_err_t err = sensor_command_submit(command, &handle);
+
+    send_response_with_handle(req, action, err == ESP_OK ? "success" : "error",
+                              err == ESP_OK ? "Command queued." : esp_err_to_name(err), handle);
+}
+
+/**
+ * @brief Adds a new client's file descriptor to the registry.
+ *
+ * A client that registers again keeps its entry and switches subscription;
+ * its send queue starts over.
+ *
+ * @param new_fd The file descriptor of the new client.
+ * @param transport WebSocket or Server-Sent Events.
+ * @param spec Encoding, channels and rate the client negotiated.
+ * @param policy What to do with readings when the client's queue is full.
+ * @param slot_out Set to the client's registry slot; may be NULL.
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NO_MEM if the registry is
+ *         full, ESP_ERR_NOT_FOUND if the subscription table is.
+ */
+static esp_err_t add_client(websocket_context_t* _context, int new_fd, client_transport_t transport,
+                            const ws_subscription_t *spec, client_queue_policy_t policy, int *slot_out) 
+{
+    int slot, previous;
+    uint32_t generation;
+    int subscription = subscription_acquire(spec, &generation);
+    if (subscription < 0) 
+    {
+        ESP_LOGW(TAG, "Subscription table full (%d), connection rejected for fd=%d",
+                 CONFIG_WS_MAX_SUBSCRIPTIONS, new_fd);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (client_registry_add(new_fd, transport, spec->encoding, subscription, generation, &slot, &previous) != ESP_OK) 
+    {
+        subscription_release(subscription);
+        ESP_LOGW(TAG, "Client list full (%d), connection rejected for fd=%d",
+                 client_registry_capacity(), new_fd);
+        return ESP_ERR_NO_MEM;
+    }
+    subscription_release(previous);
+    client_queue_open(slot, policy);
+    if (slot_out) 
+    {
+        *slot_out = slot;
+    }
+    ESP_LOGI(TAG, "Client connected, fd=%d, encoding=%d, subscription=%d", new_fd, spec->encoding, subscription);
+    return ESP_OK;
+}
+
+/**
+ * @brief Removes a client's file descriptor from the registry.
+ *
+ * @param fd_to_remove The file descriptor of the client to remove.
+ */
+static void remove_client(websocket_context_t* _context, int fd_to_remove) 
+{
+    int slot, subscription;
+    if (client_registry_remove(fd_to_remove, &slot, &subscription)) 
+    {
+        client_queue_close(slot);
+        subscription_release(subscription);
+        ESP_LOGI(TAG, "Client disconnected, fd=%d", fd_to_remove);
+    }
+}
+
+// Open /api/stream responses by registry slot, httpd task only
+static httpd_req_t *s_streams[CONFIG_WS_MAX_CLIENTS];
+
+// Replay entries sent per step of an /api/stream reconnect
+#define STREAM_REPLAY_BATCH 64
+
+/*
+ * The Last-Event-ID replay of an event stream in progress. It is sent
+ * STREAM_REPLAY_BATCH entries at a time, one httpd work item each, like a
+ * datalog export. The stream's live readings stay queued until it is done.
+ */
+typedef struct
+{
+    websocket_context_t *context;
+    chunk_stream_t stream;
+    int slot;
+    uint32_t since_s;       // next history second to replay
+    uint32_t sent;          // entries sent by this step
+} stream_replay_t;
+
+/*
+ * By registry slot, httpd task only: the replay still running, and the id of
+ * the last entry replayed (-1 if none). Live readings up to the end of that
+ * second are already covered by the replayed 1 s mean and are not sent.
+ */
+static stream_replay_t *s_replays[CONFIG_WS_MAX_CLIENTS];
+static int64_t s_replayed_ms[CONFIG_WS_MAX_CLIENTS];
+
+/**
+ * @brief httpd close_fn: drops clients whose socket went away without a
+ * WebSocket close frame, so the fd is not reused while still registered.
+ * An event stream's request is completed here as well, and the session
+ * leaves the socket budget.
+ */
+static void session_close(httpd_handle_t hd, int sockfd) 
+{
+    int slot, subscription;
+    if (client_registry_remove(sockfd, &slot, &subscription)) 
+    {
+        client_queue_close(slot);
+        subscription_release(subscription);
+        if (s_streams[slot]) 
+        {
+            // A replay step still queued finds its entry gone and stops
+            s_replays[slot] = NULL;
+            httpd_req_async_handler_complete(s_streams[slot]);
+            s_streams[slot] = NULL;
+        }
+        ESP_LOGI(TAG, "Client socket closed, fd=%d", sockfd);
+    }
+    conn_budget_close(sockfd);
+    close(sockfd);
+}
+
+/*
+ * The serializers below are expanded from SENSOR_CHANNELS: each channel is
+ * its own unrolled step with its ,"key": prefix as a literal, so rendering
+ * a reading does no key lookups or %s formatting. Bit n of a channel mask
+ * is channel n.
+ */
+
+/**
+ * @brief printf into out + *len, cap bytes in all.
+ *
+ * @return false, leaving *len alone, if it did not fit.
+ */
+static bool append_text(char *out, size_t cap, size_t *len, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(out + *len, cap - *len, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= cap - *len)
+    {
+        return false;
+    }
+    *len += (size_t)n;
+    return true;
+}
+
+/**
+ * @brief Copies n bytes to out + *len; false, leaving *len alone, if they
+ * do not fit with room for a NUL.
+ */
+static bool append_bytes(char *out, size_t cap, size_t *len, const char *bytes, size_t n)
+{
+    if (n >= cap - *len)
+    {
+        return false;
+    }
+    memcpy(out + *len, bytes, n);
+    *len += n;
+    return true;
+}
+
+// A string literal, its length known at compile time
+#define append_literal(out, cap, len, lit) append_bytes(out, cap, len, lit, sizeof(lit) - 1)
+
+/**
+ * @brief Appends the channels of v selected by a mask, as ,"key":value pairs
+ * or as a bare comma separated list. Values go through sensor_value_format(),
+ * which needs no floating point in the fixed-point pipeline.
+ */
+static bool append_channels(char *out, size_t cap, size_t *len, const sensor_value_t *v, uint16_t channels, bool keys)
+{
+    bool first = true;
+    size_t n;
+
+#define APPEND_CHANNEL(NAME, field, key, ...) \
+    if (channels & (1u << SENSOR_CHANNEL_##NAME)) \
+    { \
+        bool ok = keys ? append_literal(out, cap, len, ",\"" key "\":") \
+                       : (first || append_literal(out, cap, len, ",")); \
+        n = ok ? sensor_value_format(out + *len, cap - *len, SENSOR_CHANNEL_##NAME, v[SENSOR_CHANNEL_##NAME]) : 0; \
+        if (n == 0) \
+        { \
+            return false; \
+        } \
+        *len += n; \
+        first = false; \
+    }
+    SENSOR_CHANNELS(APPEND_CHANNEL)
+#undef APPEND_CHANNEL
+    return true;
+}
+
+// A number, or null for a value that is not available (NAN)
+static bool append_number(char *out, size_t cap, size_t *len, const char *prefix, float v)
+{
+    return isnan(v) ? append_text(out, cap, len, "%snull", prefix)
+                    : append_text(out, cap, len, "%s%g", prefix, v);
+}
+
+// ,"key":[...] with one number per channel
+static bool append_number_array(char *out, size_t cap, size_t *len, const char *key, const float *v)
+{
+    if (!append_text(out, cap, len, ",\"%s\":[", key))
+    {
+        return false;
+    }
+    for (int c = 0; c < SENSOR_CHANNEL_COUNT; c++)
+    {
+        if (!append_number(out, cap, len, c ? "," : "", v[c]))
+        {
+            return false;
+        }
+    }
+    return append_text(out, cap, len, "]");
+}
+
+/**
+ * @brief Appends ,"key":{"ewma":..,"mean":[...]} of channel c, prefix being
+ * its ,"key":{ literal.
+ */
+static bool append_channel_derived(char *out, size_t cap, size_t *len, const char *prefix, size_t prefix_len,
+                                   const sensor_derived_t *d, int c)
+{
+    if (!append_bytes(out, cap, len, prefix, prefix_len)
+        || !append_number(out, cap, len, "\"ewma\":", d->ewma[c]))
+    {
+        return false;
+    }
+    for (int w = 0; w < SENSOR_WINDOW_COUNT; w++)
+    {
+        if (!append_number(out, cap, len, w ? "," : ",\"mean\":[", d->mean[w][c]))
+        {
+            return false;
+        }
+    }
+    return append_literal(out, cap, len, "]}");
+}
+
+/**
+ * @brief Appends ,"derived":{...}: AQIs and NowCasts, plus the EWMA and the
+ * 1 min/15 min/1 h/24 h means of PM2.5 and PM10 if they are subscribed.
+ */
+static bool append_derived(char *out, size_t cap, size_t *len, const sensor_derived_t *d, uint16_t channels)
+{
+    if (!append_number(out, cap, len, ",\"derived\":{\"aqi_pm2_5\":", d->aqi_pm2_5 < 0 ? NAN : d->aqi_pm2_5)
+        || !append_number(out, cap, len, ",\"aqi_pm10\":", d->aqi_pm10 < 0 ? NAN : d->aqi_pm10)
+        || !append_number(out, cap, len, ",\"nowcast_pm2_5\":", d->nowcast_pm2_5)
+        || !append_number(out, cap, len, ",\"nowcast_pm10\":", d->nowcast_pm10))
+    {
+        return false;
+    }
+
+    // Only the NowCast channels have their windows in the frame
+#define APPEND_CHANNEL_DERIVED(NAME, field, key, ...) \
+    if ((SENSOR_CHANNEL_##NAME == SENSOR_CHANNEL_PM2_5 || SENSOR_CHANNEL_##NAME == SENSOR_CHANNEL_PM10) \
+        && (channels & (1u << SENSOR_CHANNEL_##NAME)) \
+        && !append_channel_derived(out, cap, len, ",\"" key "\":{", sizeof(",\"" key "\":{") - 1, \
+                                   d, SENSOR_CHANNEL_##NAME)) \
+    { \
+        return false; \
+    }
+    SENSOR_CHANNELS(APPEND_CHANNEL_DERIVED)
+#undef APPEND_CHANNEL_DERIVED
+    return append_literal(out, cap, len, "}");
+}
+
+/**
+ * @brief Renders one reading as JSON straight into a buffer.
+ *
+ * Replaces the cJSON tree on the broadcast path so that a tick does not touch
+ * the heap. The default subscription gets the same object as always; any
+ * other gets "timestamp_ms" and only the channels it subscribed to. Both get
+ * the derived values of sensor 0.
+ *
+ * @return Length of the payload, or 0 if it did not fit.
+ */
+static size_t render_reading_json(char *out, size_t cap, const sensor_sample_t *sample,
+                                  const ws_subscription_t *spec, int64_t timestamp_ms)
+{
+    const sensor_data_t *first = &sample->sensors[0];
+    const sensor_value_t *v = first->values;
+    const char *status = first->status == SENSOR_OK ? "OK" : "NOK";
+    size_t len = 0;
+
+    // Sensor 0 stays flat so single-sensor clients keep working
+    if (subscription_is_default(spec))
+    {
+        if (!append_text(out, cap, &len, "{\"status\":\"%s\"", status)
+            || !append_channels(out, cap, &len, v, WS_CHANNELS_ALL, true))
+        {
+            return 0;
+        }
+    }
+    else if (!append_text(out, cap, &len, "{\"status\":\"%s\",\"timestamp_ms\":%" PRId64, status, timestamp_ms)
+             || !append_channels(out, cap, &len, v, spec->channels, true))
+    {
+        return 0;
+    }
+    if (!append_derived(out, cap, &len, &sample->derived[0], spec->channels))
+    {
+        return 0;
+    }
+
+#if SENSOR_COUNT > 1
+    for (int i = 0; i < sample->count; i++)
+    {
+        const sensor_data_t *d = &sample->sensors[i];
+        if (!append_text(out, cap, &len, "%s{\"id\":%u,\"status\":\"%s\",\"values\":[",
+                         i == 0 ? ",\"sensors\":[" : ",", d->sensor_id, d->status == SENSOR_OK ? "OK" : "NOK")
+            || !append_channels(out, cap, &len, d->values, spec->channels, false)
+            || !append_text(out, cap, &len, "]}"))
+        {
+            return 0;
+        }
+    }
+    if (!append_text(out, cap, &len, "]"))
+    {
+        return 0;
+    }
+#endif
+
+    if (!append_text(out, cap, &len, "}"))
+    {
+        return 0;
+    }
+    return len;
+}
+
+/**
+ * @brief Renders a sample as one packed binary record per sensor (see
+ * ws_protocol.h): a ws_binary_reading_t when all channels are subscribed,
+ * else a ws_binary_subset_t followed by the subscribed channels.
+ *
+ * @return Length of the payload, or 0 if it did not fit.
+ */
+static size_t render_reading_binary(uint8_t *out, size_t cap, const sensor_sample_t *sample,
+                                    uint16_t channels, int64_t timestamp_ms)
+{
+    static_assert(sizeof(ws_binary_reading_t) * SENSOR_COUNT <= WS_FRAME_MAX_LEN,
+                  "binary sample does not fit in a frame");
+    size_t len = 0;
+
+    for (int i = 0; i < sample->count; i++)
+    {
+        const sensor_data_t *d = &sample->sensors[i];
+        uint8_t status = d->status == SENSOR_OK ? 0 : 1;
+
+        if (channels == WS_CHANNELS_ALL)
+        {
+            ws_binary_reading_t rec = {
+                .version = WS_BINARY_VERSION,
+                .status = status,
+                .sensor_id = d->sensor_id,
+                .timestamp_ms = timestamp_ms,
+            };
+            if (len + sizeof(rec) > cap)
+            {
+                return 0;
+            }
+#define BINARY_CHANNEL(NAME, field, ...) \
+            rec.values[SENSOR_CHANNEL_##NAME] = sensor_value_to_float(SENSOR_CHANNEL_##NAME, d->field);
+            SENSOR_CHANNELS(BINARY_CHANNEL)
+#undef BINARY_CHANNEL
+            memcpy(out + len, &rec, sizeof(rec));
+            len += sizeof(rec);
+            continue;
+        }
+
+        ws_binary_subset_t rec = {
+            .version = WS_BINARY_SUBSET_VERSION,
+            .status = status,
+            .sensor_id = d->sensor_id,
+            .timestamp_ms = timestamp_ms,
+            .channels = channels,
+        };
+        if (len + sizeof(rec) + SENSOR_CHANNEL_COUNT * sizeof(float) > cap)
+        {
+            return 0;
+        }
+        memcpy(out + len, &rec, sizeof(rec));
+        len += sizeof(rec);
+#define BINARY_SUBSET_CHANNEL(NAME, field, ...) \
+        if (channels & (1u << SENSOR_CHANNEL_##NAME)) \
+        { \
+            float value = sensor_value_to_float(SENSOR_CHANNEL_##NAME, d->field); \
+            memcpy(out + len, &value, sizeof(float)); \
+            len += sizeof(float); \
+        }
+        SENSOR_CHANNELS(BINARY_SUBSET_CHANNEL)
+#undef BINARY_SUBSET_CHANNEL
+    }
+    return len;
+}
+
+/**
+ * @brief Renders one reading for a subscription.
+ */
+static size_t render_reading(uint8_t *out, size_t cap, const sensor_sample_t *sample,
+                             const ws_subscription_t *spec, int64_t timestamp_ms)
+{
+    size_t len;
+
+    if (spec->encoding == WS_ENCODING_BINARY)
+    {
+        TRACE_BEGIN("render_binary");
+        len = render_reading_binary(out, cap, sample, spec->channels, timestamp_ms);
+        TRACE_END("render_binary");
+    }
+    else
+    {
+        TRACE_BEGIN("render_json");
+        len = render_reading_json((char *)out, cap, sample, spec, timestamp_ms);
+        TRACE_END("render_json");
+    }
+    return len;
+}
+
+/**
+ * @brief GET /api/stats?sensor=<n>
+ *
+ * Rolling windows of one sensor (0 by default) with mean, min and max per
+ * channel in wire order, the EWMA, NowCasts and AQIs. Values without data
+ * are null.
+ */
+static esp_err_t stats_get_handler(httpd_req_t *req)
+{
+    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+    char query[32] = {0};
+    char value[8];
+    int sensor = 0;
+    sensor_stats_t st;
+    char *buf = _context->scratch;
+    size_t len = 0;
+
+    conn_budget_admit(req, CONN_CLASS_API);
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+        && httpd_query_key_value(query, "sensor", value, sizeof(value)) == ESP_OK)
+    {
+        char *end;
+        long n = strtol(value, &end, 10);
+        if (*end != '\0' || n < 0 || n >= SENSOR_COUNT)
+        {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown sensor");
+            return ESP_FAIL;
+        }
+        sensor = (int)n;
+    }
+    if (sensor_stats_get(sensor, &st) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Statistics not running");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+
+    // Well below the scratch buffer: about 2.5 KB
+    bool ok = append_text(buf, SCRATCH_BUFSIZE, &len, "{\"sensor\":%d,\"ewma_tau_s\":%d,\"nowcast_hours\":%" PRIu32,
+                          sensor, CONFIG_SENSOR_STATS_EWMA_TAU_S, st.hours)
+        && append_number(buf, SCRATCH_BUFSIZE, &len, ",\"aqi_pm2_5\":", st.aqi_pm2_5 < 0 ? NAN : st.aqi_pm2_5)
+        && append_number(buf, SCRATCH_BUFSIZE, &len, ",\"aqi_pm10\":", st.aqi_pm10 < 0 ? NAN : st.aqi_pm10)
+        && append_number(buf, SCRATCH_BUFSIZE, &len, ",\"nowcast_pm2_5\":", st.nowcast_pm2_5)
+        && append_number(buf, SCRATCH_BUFSIZE, &len, ",\"nowcast_pm10\":", st.nowcast_pm10)
+        && append_number_array(buf, SCRATCH_BUFSIZE, &len, "ewma", st.ewma)
+        && append_text(buf, SCRATCH_BUFSIZE, &len, ",\"windows\":[");
+    for (int w = 0; ok && w < SENSOR_WINDOW_COUNT; w++)
+    {
+        const sensor_stats_window_t *win = &st.windows[w];
+        ok = append_text(buf, SCRATCH_BUFSIZE, &len,
+                         "%s{\"window\":\"%s\",\"span_s\":%" PRIu32 ",\"bucket_s\":%" PRIu32 ",\"samples\":%" PRIu32,
+                         w ? "," : "", sensor_window_name(w), win->span_s, win->bucket_s, win->samples)
+            && append_number_array(buf, SCRATCH_BUFSIZE, &len, "mean", win->mean)
+            && append_number_array(buf, SCRATCH_BUFSIZE, &len, "min", win->min)
+            && append_number_array(buf, SCRATCH_BUFSIZE, &len, "max", win->max)
+            && append_text(buf, SCRATCH_BUFSIZE, &len, "}");
+    }
+    if (!ok || !append_text(buf, SCRATCH_BUFSIZE, &len, "]}"))
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Response too large");
+        return ESP_FAIL;
+    }
+    return httpd_resp_send(req, buf, len);
+}
+
+/**
+ * @brief Converts a reading timestamp (ms since boot) to Unix time in ms.
+ */
+static int64_t uptime_to_unix_ms(int64_t uptime_ms)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    int64_t unix_now_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+    return uptime_ms + unix_now_ms - esp_timer_get_time() / 1000;
+}
+
+/**
+ * @brief True if a send to the socket would not block right now.
+ */
+static bool socket_writable(int fd)
+{
+    fd_set wfds;
+    struct timeval tv = { 0, 0 };
+    FD_ZERO(&wfds);
+    FD_SET(fd, &wfds);
+    return select(fd + 1, NULL, &wfds, NULL, &tv) > 0;
+}
+
+/**
+ * @brief Sends one Server-Sent Event as a chunk of an open /api/stream
+ * response. The payload goes out as it is, so one rendering serves the
+ * WebSocket and the event stream clients alike; it must not contain a
+ * newline, which rendered JSON never does.
+ *
+ * @param event Event type, or NULL for the default "message".
+ * @param id Event id, the Unix ms of the reading, or -1 for none.
+ */
+static esp_err_t sse_send_event(httpd_handle_t server, int fd, const char *event, int64_t id,
+                                const uint8_t *payload, size_t len)
+{
+    char fields[64];
+    char head[sizeof(fields) + 16];
+    size_t n = 0;
+
+    if (event)
+    {
+        n += snprintf(fields + n, sizeof(fields) - n, "event: %s\n", event);
+    }
+    if (id >= 0)
+    {
+        n += snprintf(fields + n, sizeof(fields) - n, "id: %" PRId64 "\n", id);
+    }
+    // Chunk size line, the event fields and "data: " in one send
+    int head_len = snprintf(head, sizeof(head), "%x\r\n%sdata: ", (unsigned)(n + 6 + len + 2), fields);
+
+    const struct { const char *buf; size_t len; } parts[] = 
+    {
+        { head, (size_t)head_len },
+        { (const char *)payload, len },
+        { "\n\n\r\n", 4 },
+    };
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) 
+    {
+        size_t sent = 0;
+        while (sent < parts[i].len) 
+        {
+            int r = httpd_socket_send(server, fd, parts[i].buf + sent, parts[i].len - sent, 0);
+            if (r <= 0) 
+            {
+                return ESP_FAIL;
+            }
+            sent += r;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Sends whatever is queued for the clients of a snapshot, skipping
+ * clients whose socket is not writable so that one slow peer never holds up
+ * the httpd task.
+ *
+ * @return Number of frames sent; *pending is set if any queue is not empty.
+ */
+static int drain_clients(websocket_context_t *_context, const client_snapshot_t *snapshot, bool *pending)
+{
+    int sent = 0;
+    *pending = false;
+
+    for (int i = 0; i < snapshot->count; ++i) 
+    {
+        const ws_client_t *client = &snapshot->clients[i];
+        ws_frame_t *frame;
+
+        while ((frame = client_queue_peek(client->slot)) != NULL) 
+        {
+            if (!socket_writable(client->fd)) 
+            {
+                *pending = true;
+                break;
+            }
+
+            esp_err_t err;
+            if (client->transport == CLIENT_TRANSPORT_SSE) 
+            {
+                int64_t id = uptime_to_unix_ms(frame->read_us / 1000);
+                if (s_replays[client->slot]) 
+                {
+                    // Sent once the replay reaches the live edge
+                    break;
+                }
+                if (s_replayed_ms[client->slot] >= 0 && id < s_replayed_ms[client->slot] + 1000) 
+                {
+                    // Delivered already as part of the replayed 1 s mean
+                    client_queue_pop_sent(client->slot, esp_timer_get_time());
+                    continue;
+                }
+                TRACE_BEGIN("sse_send");
+                err = sse_send_event(_context->server, client->fd, NULL, id, frame->data, frame->len);
+                TRACE_END("sse_send");
+            }
+            else 
+            {
+                httpd_ws_frame_t tx = {
+                    .final = true,
+                    .fragmented = false,
+                    .type = frame->encoding == WS_ENCODING_BINARY ? HTTPD_WS_TYPE_BINARY : HTTPD_WS_TYPE_TEXT,
+                    .payload = frame->data,
+                    .len = frame->len
+                };
+                TRACE_BEGIN("ws_send");
+                err = httpd_ws_send_frame_async(_context->server, client->fd, &tx);
+                TRACE_END("ws_send");
+            }
+            if (err != ESP_OK) 
+            {
+                ESP_LOGW(TAG, "send to fd=%d failed, closing", client->fd);
+                client_queue_close(client->slot);
+                httpd_sess_trigger_close(_context->server, client->fd);
+                break;
+            }
+            int64_t now_us = esp_timer_get_time();
+            bench_record_latency(frame->read_us);
+            client_queue_pop_sent(client->slot, now_us);
+            sent++;
+        }
+    }
+    return sent;
+}
+
+/**
+ * @brief Frees pool frames pinned by saturated queues until the next reading
+ * is sure to get a frame for every subscription, so stalled clients cannot
+ * starve the healthy ones.
+ */
+static void shed_saturated(const client_snapshot_t *snapshot)
+{
+    frame_pool_stats_t stats;
+    bool shed = true;
+
+    frame_pool_get_stats(&stats);
+    while (shed && stats.in_use + subscription_active_count() > CONFIG_WS_FRAME_POOL_SIZE) 
+    {
+        shed = false;
+        for (int i = 0; i < snapshot->count; ++i) 
+        {
+            client_queue_stats_t q;
+            client_queue_get_stats(snapshot->clients[i].slot, &q);
+            if (q.saturated > 0 && client_queue_shed(snapshot->clients[i].slot)) 
+            {
+                shed = true;
+            }
+        }
+        frame_pool_get_stats(&stats);
+    }
+}
+
+static void drain_work_cb(void *arg);
+
+static void drain_timer_cb(void *arg)
+{
+    websocket_context_t *_context = (websocket_context_t *)arg;
+    if (httpd_queue_work(_context->server, drain_work_cb, _context) != ESP_OK) 
+    {
+        atomic_store(&_context->drain_pending, false);
+    }
+}
+
+static void schedule_drain(websocket_context_t *_context)
+{
+    if (!atomic_exchange(&_context->drain_pending, true)) 
+    {
+        esp_timer_start_once(_context->drain_timer, DRAIN_RETRY_MS * 1000);
+    }
+}
+
+/**
+ * @brief Retries the sends a fanout had to leave queued.
+ */
+static void drain_work_cb(void *arg)
+{
+    websocket_context_t *_context = (websocket_context_t *)arg;
+    bool pending;
+
+    atomic_store(&_context->drain_pending, false);
+    const client_snapshot_t *snapshot = client_registry_acquire();
+    drain_clients(_context, snapshot, &pending);
+    client_registry_release(snapshot);
+
+    if (pending) 
+    {
+        schedule_drain(_context);
+    }
+}
+
+/**
+ * @brief Queues the frames rendered for one reading for every registered
+ * client and sends what the sockets accept.
+ *
+ * Runs on the httpd task. The frames for the different subscriptions are
+ * chained through frame->next; each client queue takes a reference to the one
+ * of its subscription and the producer's references are dropped at the
+ * end. A client whose queue stayed full for CONFIG_WS_CLIENT_SATURATED_LIMIT
+ * readings in a row is disconnected.
+ */
+static void broadcast_work_cb(void *arg)
+{
+    ws_frame_t *head = (ws_frame_t *)arg;
+    websocket_context_t *_context = (websocket_context_t *)head->ctx;
+    ws_frame_t *by_subscription[CONFIG_WS_MAX_SUBSCRIPTIONS] = {0};
+    bool pending;
+
+    TRACE_ASYNC_END("queue_work", (uintptr_t)head);
+    TRACE_BEGIN("fanout");
+    for (ws_frame_t *f = head; f; f = f->next)
+    {
+        by_subscription[f->subscription] = f;
+    }
+
+    // Lock-free: add/remove publish a new snapshot instead of editing this one
+    const client_snapshot_t *snapshot = client_registry_acquire();
+    const ws_client_t *clients = snapshot->clients;
+
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i < snapshot->count; ++i) 
+    {
+        ws_frame_t *frame = by_subscription[clients[i].subscription];
+        // Nothing due for this subscription, or the client registered or
+        // switched encoding after the reading was rendered, or the entry was
+        // reused for another spec since
+        if (!frame || frame->encoding != (int)clients[i].encoding
+            || frame->generation != clients[i].generation) continue;
+
+        if (client_queue_push(clients[i].slot, frame)) 
+        {
+            client_queue_stats_t q;
+            client_queue_get_stats(clients[i].slot, &q);
+            if (q.saturated == CONFIG_WS_CLIENT_SATURATED_LIMIT) 
+            {
+                ESP_LOGW(TAG, "client fd=%d saturated for %" PRIu32 " readings, disconnecting",
+                         clients[i].fd, q.saturated);
+                _context->slow_disconnects++;
+                client_queue_close(clients[i].slot);
+                httpd_sess_trigger_close(_context->server, clients[i].fd);
+            }
+        }
+    }
+    int sent = drain_clients(_context, snapshot, &pending);
+    bench_record_fanout(start_us, sent);
+    metrics_record_fanout((uint32_t)(esp_timer_get_time() - start_us), sent);
+
+    while (head)
+    {
+        ws_frame_t *next = head->next;
+        frame_unref(head);
+        head = next;
+    }
+
+    shed_saturated(snapshot);
+    client_registry_release(snapshot);
+    TRACE_END("fanout");
+
+    if (pending) 
+    {
+        schedule_drain(_context);
+    }
+}
+
+/**
+ * @brief Sends a command status frame to every registered client, as a
+ * "command" event to the event stream clients.
+ *
+ * Runs on the httpd task. Status messages are rare and small, so they skip
+ * the per-client queues: a client whose socket is not writable right now
+ * misses the update, as it would miss a reading shed from a full queue.
+ */
+static void command_status_work_cb(void *arg)
+{
+    ws_frame_t *frame = (ws_frame_t *)arg;
+    websocket_context_t *_context = (websocket_context_t *)frame->ctx;
+
+    const client_snapshot_t *snapshot = client_registry_acquire();
+    for (int i = 0; i < snapshot->count; ++i) 
+    {
+        const ws_client_t *client = &snapshot->clients[i];
+        if (!socket_writable(client->fd)) 
+        {
+            continue;
+        }
+        if (client->transport == CLIENT_TRANSPORT_SSE) 
+        {
+            sse_send_event(_context->server, client->fd, "command", -1, frame->data, frame->len);
+            continue;
+        }
+        httpd_ws_frame_t tx = {
+            .final = true,
+            .fragmented = false,
+            .type = HTTPD_WS_TYPE_TEXT,
+            .payload = frame->data,
+            .len = frame->len
+        };
+        httpd_ws_send_frame_async(_context->server, client->fd, &tx);
+    }
+    client_registry_release(snapshot);
+    frame_unref(frame);
+}
+
+/**
+ * @brief Pushes SENSOR_COMMAND_STATUS events to the WebSocket clients.
+ *
+ * Runs on the default event loop, so it only renders and hands off to the
+ * httpd task.
+ */
+static void command_status_handler(void *arg, esp_event_base_t base, int32_t id, void *event_data)
+{
+    websocket_context_t *_context = (websocket_context_t *)arg;
+    const sensor_command_status_t *status = (const sensor_command_status_t *)event_data;
+
+    ws_frame_t *frame = frame_pool_acquire();
+    if (!frame) 
+    {
+        return;
+    }
+    int len = snprintf((char *)frame->data, WS_FRAME_MAX_LEN,
+        "{\"command\":{\"handle\":%" PRIu32 ",\"type\":\"%s\",\"state\":\"%s\"%s%s%s}}",
+        status->handle, sensor_command_name(status->command), sensor_command_state_name(status->state),
+        status->state == SENSOR_COMMAND_FAILED ? ",\"error\":\"" : "",
+        status->state == SENSOR_COMMAND_FAILED ? esp_err_to_name(status->error) : "",
+        status->state == SENSOR_COMMAND_FAILED ? "\"" : "");
+    frame->len = len;
+    frame->encoding = WS_ENCODING_JSON;
+    frame->read_us = esp_timer_get_time();
+    frame->ctx = _context;
+    frame->next = NULL;
+    if (httpd_queue_work(_context->server, command_status_work_cb, frame) != ESP_OK) 
+    {
+        frame_unref(frame);
+    }
+}
+
+/**
+ * @brief history_read() callback that replays 1 s entries as events carrying
+ * the same JSON as a live reading.
+ */
+static bool stream_replay_cb(const history_entry_t *e, void *ctx)
+{
+    chunk_stream_t *s = (chunk_stream_t *)ctx;
+    ws_subscription_t spec = subscription_default(WS_ENCODING_JSON);
+    sensor_sample_t sample = { .count = 1 };
+    int64_t id = s->offset_ms + (int64_t)e->t_s * 1000;
+
+    for (int c = 0; c < SENSOR_CHANNEL_COUNT; c++)
+    {
+        sample.sensors[0].values[c] = sensor_value_from_float(c, e->mean[c]);
+    }
+    sample.sensors[0].status = SENSOR_OK;
+    sample.sensors[0].sensor_id = e->sensor_id;
+
+    // History keeps the NowCasts only; the rolling means are not replayed
+    sensor_derived_t *d = &sample.derived[0];
+    for (int c = 0; c < SENSOR_CHANNEL_COUNT; c++)
+    {
+        d->ewma[c] = NAN;
+        for (int w = 0; w < SENSOR_WINDOW_COUNT; w++)
+        {
+            d->mean[w][c] = NAN;
+        }
+    }
+    d->nowcast_pm2_5 = e->nowcast_pm2_5;
+    d->nowcast_pm10 = e->nowcast_pm10;
+    d->aqi_pm2_5 = (int16_t)sensor_aqi_pm2_5(e->nowcast_pm2_5);
+    d->aqi_pm10 = (int16_t)sensor_aqi_pm10(e->nowcast_pm10);
+
+    // One event is well below 1 KB
+    if (SCRATCH_BUFSIZE - s->len < 1024 && !stream_flush(s))
+    {
+        return false;
+    }
+    int n = snprintf(s->buf + s->len, SCRATCH_BUFSIZE - s->len, "id: %" PRId64 "\ndata: ", id);
+    // Leave room for the blank line that ends the event
+    size_t len = render_reading_json(s->buf + s->len + n, SCRATCH_BUFSIZE - s->len - n - 2, &sample, &spec, id);
+    if (len == 0)
+    {
+        s->err = ESP_ERR_NO_MEM;
+        return false;
+    }
+    s->len += n + len;
+    s->buf[s->len++] = '\n';
+    s->buf[s->len++] = '\n';
+    return true;
+}
+
+static bool stream_replay_batch_cb(const history_entry_t *e, void *ctx)
+{
+    stream_replay_t *x = (stream_replay_t *)ctx;
+
+    if (!stream_replay_cb(e, &x->stream))
+    {
+        return false;
+    }
+    s_replayed_ms[x->slot] = x->stream.offset_ms + (int64_t)e->t_s * 1000;
+    x->since_s = e->t_s + 1;
+    return ++x->sent < STREAM_REPLAY_BATCH;
+}
+
+static void stream_replay_work_cb(void *arg)
+{
+    stream_replay_t *x = (stream_replay_t *)arg;
+
+    if (s_replays[x->slot] != x)
+    {
+        // The session closed and its request is gone
+        free(x);
+        return;
+    }
+    x->sent = 0;
+    x->stream.buf = x->context->scratch;
+    history_read(0, HISTORY_TIER_SECOND, x->since_s, stream_replay_batch_cb, x);
+    bool ok = stream_flush(&x->stream);
+    if (ok && x->sent == STREAM_REPLAY_BATCH &&
+        httpd_queue_work(x->context->server, stream_replay_work_cb, x) == ESP_OK)
+    {
+        return;
+    }
+
+    s_replays[x->slot] = NULL;
+    conn_budget_release(x->stream.req);
+    if (!ok)
+    {
+        ESP_LOGW(TAG, "stream replay failed: %s", esp_err_to_name(x->stream.err));
+        httpd_sess_trigger_close(x->context->server, httpd_req_to_sockfd(x->stream.req));
+    }
+    else
+    {
+        // Live edge reached: send what queued up meanwhile
+        schedule_drain(x->context);
+    }
+    free(x);
+}
+
+/**
+ * @brief GET /api/stream: readings as Server-Sent Events, for clients that
+ * cannot do WebSocket (curl, kiosk browsers).
+ *
+ * Each event carries the frame the default JSON WebSocket clients get, from
+ * the same rendering, with the Unix ms of the reading as its id. The response
+ * is left open through the async request API and registered like a WebSocket
+ * client: it counts against the same stream limit of the socket budget and
+ * gets a send queue with the same policy and saturation limit.
+ *
+ * A client that reconnects with Last-Event-ID first gets the readings it
+ * missed from the 1 s history of sensor 0, in httpd work items. Its live
+ * readings queue up meanwhile and are sent after the replay, except those
+ * within the last second replayed.
+ */
+static esp_err_t stream_get_handler(httpd_req_t *req)
+{
+    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+    char last_event_id[24];
+    int64_t since_ms = -1;
+
+    if (!conn_budget_admit(req, CONN_CLASS_STREAM))
+    {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "10");
+        return httpd_resp_sendstr(req, "Client list is full.");
+    }
+    if (httpd_req_get_hdr_value_str(req, "Last-Event-ID", last_event_id, sizeof(last_event_id)) == ESP_OK)
+    {
+        since_ms = strtoll(last_event_id, NULL, 10);
+    }
+
+    stream_replay_t *x = NULL;
+    if (since_ms >= 0)
+    {
+        x = malloc(sizeof(*x));
+        if (!x)
+        {
+            return ESP_FAIL;
+        }
+        *x = (stream_replay_t){
+            .context = _context,
+            .stream = {
+                .offset_ms = history_to_unix_ms(0),
+                .err = ESP_OK,
+            },
+        };
+        // Entries after the second of the last event the client saw
+        int64_t since_s = since_ms >= x->stream.offset_ms ? (since_ms - x->stream.offset_ms) / 1000 + 1 : 0;
+        x->since_s = since_s > UINT32_MAX ? UINT32_MAX : (uint32_t)since_s;
+    }
+
+    httpd_resp_set_type(req, "text/event-stream");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    char retry[24];
+    int n = snprintf(retry, sizeof(retry), "retry: %d\n\n", SSE_RETRY_MS);
+    httpd_req_t *stream;
+    if (httpd_resp_send_chunk(req, retry, n) != ESP_OK ||
+        httpd_req_async_handler_begin(req, &stream) != ESP_OK)
+    {
+        free(x);
+        return ESP_FAIL;
+    }
+    int fd = httpd_req_to_sockfd(stream);
+    int slot;
+    ws_subscription_t spec = subscription_default(WS_ENCODING_JSON);
+    if (add_client(_context, fd, CLIENT_TRANSPORT_SSE, &spec, CLIENT_QUEUE_DEFAULT_POLICY, &slot) != ESP_OK)
+    {
+        // Failing the handler closes the session
+        free(x);
+        httpd_req_async_handler_complete(stream);
+        return ESP_FAIL;
+    }
+    s_streams[slot] = stream;
+    s_replayed_ms[slot] = -1;
+    if (x)
+    {
+        x->stream.req = stream;
+        x->slot = slot;
+        s_replays[slot] = x;
+        // The session must not be evicted while work items still send on it
+        conn_budget_hold(stream);
+        if (httpd_queue_work(_context->server, stream_replay_work_cb, x) != ESP_OK)
+        {
+            s_replays[slot] = NULL;
+            conn_budget_release(stream);
+            free(x);
+        }
+    }
+    ESP_LOGI(TAG, "Event stream opened, fd=%d", fd);
+    return ESP_OK;
+}
+
+static void release_frames(ws_frame_t *head)
+{
+    while (head) 
+    {
+        ws_frame_t *next = head->next;
+        frame_unref(head);
+        head = next;
+    }
+}
+
+/*
+ * Readings of a batched subscription collect here until the batch is full.
+ * Broadcast task only.
+ */
+typedef struct
+{
+    uint32_t generation;        // of the subscription entry the readings were rendered for
+    uint16_t count;
+    size_t len;
+    uint8_t data[WS_FRAME_MAX_LEN];
+} reading_batch_t;
+
+static reading_batch_t s_batches[CONFIG_WS_MAX_SUBSCRIPTIONS];
+
+/**
+ * @brief Appends a reading to a batch. JSON readings become the elements of
+ * {"batch":[...]}, binary records are simply concatenated.
+ *
+ * @return false if the reading did not fit.
+ */
+static bool batch_append(reading_batch_t *b, const sensor_sample_t *sample,
+                         const ws_subscription_t *spec, int64_t timestamp_ms)
+{
+    static const char json_open[] = "{\"batch\":[";
+    bool json = spec->encoding == WS_ENCODING_JSON;
+    // Leave room for the closing "]}" of a JSON batch
+    size_t cap = sizeof(b->data) - (json ? 2 : 0);
+    size_t start = b->len;
+
+    if (json) 
+    {
+        if (b->count == 0) 
+        {
+            memcpy(b->data, json_open, sizeof(json_open) - 1);
+            start = sizeof(json_open) - 1;
+        }
+        else if (start < cap) 
+        {
+            b->data[start++] = ',';
+        }
+    }
+    if (start >= cap) 
+    {
+        return false;
+    }
+    size_t len = render_reading(b->data + start, cap - start, sample, spec, timestamp_ms);
+    if (len == 0) 
+    {
+        return false;
+    }
+    b->len = start + len;
+    b->count++;
+    return true;
+}
+
+/**
+ * @brief Copies a batch into a pool frame and empties it.
+ *
+ * @return The frame, or NULL if the pool is exhausted and the batch was lost.
+ */
+static ws_frame_t *batch_flush(reading_batch_t *b, const ws_subscription_t *spec)
+{
+    ws_frame_t *frame = frame_pool_acquire();
+    if (frame) 
+    {
+        memcpy(frame->data, b->data, b->len);
+        frame->len = b->len;
+        if (spec->encoding == WS_ENCODING_JSON) 
+        {
+            frame->data[frame->len++] = ']';
+            frame->data[frame->len++] = '}';
+        }
+    }
+    b->count = 0;
+    b->len = 0;
+    return frame;
+}
+
+/**
+ * @brief Renders a sample, all sensors in one frame, once per subscription
+ * that has clients. The cost grows with the number of sensors and distinct
+ * subscriptions, not of clients.
+ *
+ * A subscription with every = N gets every Nth reading this task renders; a
+ * batched one gets a frame once it holds batch readings, or earlier if the
+ * next one would not fit.
+ *
+ * @return Frames chained through frame->next, or NULL.
+ */
+static ws_frame_t *render_frames(websocket_context_t *_context, const sensor_sample_t *sample)
+{
+    int64_t timestamp_ms = uptime_to_unix_ms(sample->timestamp_ms);
+    uint32_t reading = _context->readings++;
+    ws_frame_t *head = NULL;
+
+    for (int id = 0; id < CONFIG_WS_MAX_SUBSCRIPTIONS; id++) 
+    {
+        ws_subscription_t spec;
+        uint32_t generation;
+        if (!subscription_read(id, &spec, &generation))
+            continue;
+
+        reading_batch_t *b = &s_batches[id];
+        if (b->generation != generation) 
+        {
+            // The entry was reused for another spec
+            b->generation = generation;
+            b->count = 0;
+            b->len = 0;
+        }
+        if (reading % spec.every != 0)
+            continue;
+
+        ws_frame_t *frame;
+        if (spec.batch <= 1) 
+        {
+            frame = frame_pool_acquire();
+            if (frame) 
+            {
+                frame->len = render_reading(frame->data, sizeof(frame->data), sample, &spec, timestamp_ms);
+                if (frame->len == 0) 
+                {
+                    ESP_LOGE(TAG, "reading does not fit in a frame");
+                    frame_unref(frame);
+                    continue;
+                }
+            }
+        }
+        else if (batch_append(b, sample, &spec, timestamp_ms)) 
+        {
+            if (b->count < spec.batch)
+                continue;
+            frame = batch_flush(b, &spec);
+        }
+        else if (b->count > 0) 
+        {
+            // Send the readings that fit and start the next batch with this one
+            frame = batch_flush(b, &spec);
+            batch_append(b, sample, &spec, timestamp_ms);
+        }
+        else 
+        {
+            ESP_LOGE(TAG, "reading does not fit in a frame");
+            continue;
+        }
+
+        if (!frame) 
+        {
+            frame_pool_stats_t stats;
+            frame_pool_get_stats(&stats);
+            ESP_LOGW(TAG, "frame pool exhausted (%" PRIu32 " times), dropping reading", stats.exhausted);
+            break;
+        }
+
+        frame->encoding = spec.encoding;
+        frame->subscription = id;
+        frame->generation = generation;
+        frame->read_us = sample->timestamp_ms * 1000;
+        frame->ctx = _context;
+        frame->next = head;
+        head = frame;
+    }
+    return head;
+}
+
+// Last reading rendered into /metrics, broadcast task only
+static sensor_sample_t s_last_sample;
+
+static void render_metrics(websocket_context_t *_context, const sensor_sample_t *sample)
+{
+    metrics_server_stats_t server = 
+    {
+        .clients = client_registry_count(WS_ENCODING_JSON) + client_registry_count(WS_ENCODING_BINARY),
+        .slow_disconnects = _context->slow_disconnects
+    };
+    TRACE_BEGIN("metrics_render");
+    metrics_render(sample, &server);
+    TRACE_END("metrics_render");
+}
+
+/**
+ * @brief Task that broadcasts every published reading to all WebSocket clients.
+ *
+ * The sensor task owns the SPS30; this task subscribes to the sensor bus,
+ * copies each reading out of the bus ring and, once the copy is known to be
+ * whole, renders it once per subscription that has clients into pooled frame
+ * buffers. The frames are handed to the httpd
+ * task, which queues them for every registered client. After start-up the
+ * loop does not allocate.
+ *
+ * /metrics is rendered with every reading and, when none arrives for
+ * METRICS_REFRESH_MS (a sensor outage or a long sampling period), from the
+ * last one with the current sensor status, so counters, heap and status
+ * stay current.
+ *
+ * @param pvParameters context.
+ */
+void broadcast_task(void *pvParameters)
+{
+    websocket_context_t *_context = (websocket_context_t*)pvParameters;
+    sensor_bus_sub_t *sub;
+
+    if (sensor_bus_subscribe(&sub) != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "no sensor bus subscription left, nothing will be broadcast");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    for (;;) 
+    {
+        if (!sensor_bus_wait(sub, pdMS_TO_TICKS(METRICS_REFRESH_MS))) 
+        {
+            if (s_last_sample.count > 0) 
+            {
+                sensor_sched_report_t sched;
+                sensor_task_get_sched_report(&sched);
+                for (int s = 0; s < s_last_sample.count; s++) 
+                {
+                    s_last_sample.sensors[s].status = sched.sensors[s].status;
+                }
+                render_metrics(_context, &s_last_sample);
+            }
+            continue;
+        }
+
+        const sensor_sample_t *sample;
+        while ((sample = sensor_bus_read_begin(sub)) != NULL) 
+        {
+            bench_record_sample();
+            sensor_sample_t copy = *sample;
+            if (!sensor_bus_read_end(sub)) 
+            {
+                // Overwritten while copying; the copy may be torn
+                continue;
+            }
+
+            // Rendering counts the reading and adds it to batches, so only
+            // a validated copy is rendered
+            int64_t render_start_us = esp_timer_get_time();
+            ws_frame_t *head = render_frames(_context, &copy);
+            bench_record_render(render_start_us);
+
+            s_last_sample = copy;
+            render_metrics(_context, &s_last_sample);
+
+            if (head) 
+            {
+                TRACE_ASYNC_BEGIN("queue_work", (uintptr_t)head);
+                esp_err_t r = httpd_queue_work(_context->server, broadcast_work_cb, head);
+                if (r != ESP_OK) 
+                {
+                    ESP_LOGW(TAG, "httpd_queue_work failed: 0x%x", r);
+                    TRACE_ASYNC_END("queue_work", (uintptr_t)head);
+                    release_frames(head);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * WebSocket commands: {"action":"<name>", ...} dispatches to the entry of
+ * ws_actions with that name. The command fields point into the receive
+ * buffer and are only valid during the call.
+ */
+typedef void (*ws_action_fn)(websocket_context_t *_context, httpd_req_t *req, const ws_command_t *cmd);
+
+/**
+ * @brief Reads an optional whole-number field into *out.
+ *
+ * @return false if the field is there but not a whole number in [min, max].
+ */
+static bool command_uint16(const ws_command_t *cmd, const char *key, uint16_t min, uint16_t max, uint16_t *out)
+{
+    const ws_command_field_t *f = ws_command_field(cmd, key);
+    if (!f)
+    {
+        return true;
+    }
+    if (f->type != WS_JSON_NUMBER || f->num < min || f->num > max || f->num != (uint16_t)f->num)
+    {
+        return false;
+    }
+    *out = (uint16_t)f->num;
+    return true;
+}
+
+static void action_register_client(websocket_context_t *_context, httpd_req_t *req, const ws_command_t *cmd)
+{
+    ws_encoding_t encoding = WS_ENCODING_JSON;
+    const char *encoding_str = ws_command_string(cmd, "encoding");
+    if (encoding_str && strcmp(encoding_str, "binary") == 0)
+    {
+        encoding = WS_ENCODING_BINARY;
+    }
+
+    ws_subscription_t spec = subscription_default(encoding);
+    if (!command_uint16(cmd, "channels", 1, WS_CHANNELS_ALL, &spec.channels)
+        || !command_uint16(cmd, "every", 1, WS_SUBSCRIPTION_MAX_EVERY, &spec.every)
+        || !command_uint16(cmd, "batch", 1, WS_SUBSCRIPTION_MAX_BATCH, &spec.batch))
+    {
+        send_response_to_client(req, "registerClient", "error", "Invalid subscription.");
+        return;
+    }
+
+    client_queue_policy_t policy = CLIENT_QUEUE_DEFAULT_POLICY;
+    const char *queue_str = ws_command_string(cmd, "queue");
+    if (queue_str) 
+    {
+        if (strcmp(queue_str, "drop") == 0)
+            policy = CLIENT_QUEUE_DROP;
+        else if (strcmp(queue_str, "coalesce") == 0)
+            policy = CLIENT_QUEUE_COALESCE;
+    }
+
+    esp_err_t err = add_client(_context, httpd_req_to_sockfd(req), CLIENT_TRANSPORT_WS, &spec, policy, NULL);
+    if (err == ESP_OK) 
+    {
+        const char *name = encoding == WS_ENCODING_BINARY ? "binary" : "json";
+        char message[128];
+        if (subscription_is_default(&spec))
+        {
+            snprintf(message, sizeof(message), "Client registered successfully, encoding %s.", name);
+        }
+        else
+        {
+            snprintf(message, sizeof(message),
+                     "Client registered successfully, encoding %s, channels %u, every %u, batch %u.",
+                     name, spec.channels, spec.every, spec.batch);
+        }
+        send_response_to_client(req, "registerClient", "success", message);
+    } else 
+    {
+        send_response_to_client(req, "registerClient", "error",
+            err == ESP_ERR_NO_MEM ? "Client list is full." : "Too many different subscriptions.");
+    }
+}
+
+static void action_close_connection(websocket_context_t *_context, httpd_req_t *req, const ws_command_t *cmd)
+{
+    int client_fd = httpd_req_to_sockfd(req);
+    remove_client(_context, client_fd);
+    send_response_to_client(req, "closeConnection", "success", "Connection will be closed.");
+    // The session will be closed after this handler returns
+    httpd_sess_trigger_close(req->handle, client_fd);
+}
+
+static void action_fan_clean(websocket_context_t *_context, httpd_req_t *req, const ws_command_t *cmd)
+{
+    submit_command(req, "fanClean", CMD_FAN_CLEAN);
+}
+
+static void action_sleep(websocket_context_t *_context, httpd_req_t *req, const ws_command_t *cmd)
+{
+    // {"action":"sleep","enabled":false} wakes the sensors
+    const ws_command_field_t *enabled = ws_command_field(cmd, "enabled");
+    submit_command(req, "sleep", enabled && enabled->type == WS_JSON_FALSE ? CMD_WAKE : CMD_SLEEP);
+}
+
+static void action_wake(websocket_context_t *_context, httpd_req_t *req, const ws_command_t *cmd)
+{
+    submit_command(req, "wake", CMD_WAKE);
+}
+
+static const struct
+{
+    const char *action;
+    ws_action_fn handler;
+} ws_actions[] = 
+{
+    { "registerClient",  action_register_client },
+    { "closeConnection", action_close_connection },
+    { "fanClean",        action_fan_clean },
+    { "sleep",           action_sleep },
+    { "wake",            action_wake },
+};
+
+//     if (req->method == HTTP_GET) {
+//         ESP_LOGI(TAG, "Handshake done, new connection was opened");
+//         return ESP_OK;
+//     }
+
+//     websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+
+//     int client_fd = httpd_req_to_sockfd(req);
+//     if (add_client(_context, client_fd) != ESP_OK) 
+//     {
+//         // If we can't add the client, close the connection
+//         httpd_sess_trigger_close(req->handle, client_fd);
+//         return ESP_OK;
+//     }
+
+static esp_err_t ws_handler(httpd_req_t *req) 
+{
+    if (req->method == HTTP_GET) 
+    {
+        if (!conn_budget_admit(req, CONN_CLASS_STREAM)) 
+        {
+            // Failing the handshake handler closes the session
+            ESP_LOGW(TAG, "stream limit (%d) reached, closing fd=%d",
+                     conn_budget_capacity(CONN_CLASS_STREAM), httpd_req_to_sockfd(req));
+            return ESP_FAIL;
+        }
+        ESP_LOGI(TAG, "Handshake done, new connection was opened");
+        return ESP_OK;
+    }
+
+    websocket_context_t *_context = (websocket_context_t *)req->user_ctx;
+
+    int client_fd = httpd_req_to_sockfd(req);
+    httpd_ws_frame_t ws_pkt;
+    memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+    ws_pkt.type = HTTPD_WS_TYPE_TEXT;
     
-    for (int i = 0; i < MAX_WEBSOCKET_CLIENTS; ++i) 
+    /* Set max_len = 0 to get the frame len */
+    esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
+    if (ret != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "httpd_ws_recv_frame failed to get frame len with %d", ret);
+        remove_client(_context, client_fd);
+        return ret;
+    }
+
+    if (ws_pkt.type == HTTPD_WS_TYPE_CLOSE) 
+    {
+        remove_client(_context, client_fd);
+        return ESP_OK;
+    }
+    if (ws_pkt.len == 0) 
+    {
+        return ESP_OK;
+    }
+    if (ws_pkt.len > WS_COMMAND_MAX_LEN) 
+    {
+        // Rejected unread; the rest of the frame would desync the session
+        ESP_LOGW(TAG, "fd=%d sent a %u byte frame, closing", client_fd, (unsigned)ws_pkt.len);
+        send_response_to_client(req, "parse", "error", "Frame too large.");
+        remove_client(_context, client_fd);
+        httpd_sess_trigger_close(req->handle, client_fd);
+        return ESP_OK;
+    }
+
+    /* Frames are read one at a time on the httpd task, so one buffer serves every session */
+    ws_pkt.payload = (uint8_t *)_context->rx;
+    ret = httpd_ws_recv_frame(req, &ws_pkt, ws_pkt.len);
+    if (ret != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "httpd_ws_recv_frame failed with %d", ret);
+        remove_client(_context, client_fd);
+        return ret;
+    }
+    ESP_LOGD(TAG, "Got packet with message: %.*s", (int)ws_pkt.len, _context->rx);
+
+    ws_command_t cmd;
+    ws_command_result_t parsed = ws_pkt.type == HTTPD_WS_TYPE_TEXT
+        ? ws_command_parse(_context->rx, ws_pkt.len, &cmd) : WS_COMMAND_MALFORMED;
+    if (parsed != WS_COMMAND_OK) 
+    {
+        send_response_to_client(req, "parse", "error",
+            parsed == WS_COMMAND_TOO_MANY_FIELDS ? "Too many fields." : "Invalid JSON format.");
+        return ESP_OK;
+    }
+
+    const char *action_str = ws_command_string(&cmd, "action");
+    if (action_str) 
     {
-        _context->clients[i].fd = -1;
+        ESP_LOGD(TAG, "Received action: %s from fd: %d", action_str, client_fd);
+        for (size_t i = 0; i < sizeof(ws_actions) / sizeof(ws_actions[0]); i++) 
+        {
+            if (strcmp(action_str, ws_actions[i].action) == 0) 
+            {
+                ws_actions[i].handler(_context, req, &cmd);
+                return ESP_OK;
+            }
+        }
+        send_response_to_client(req, action_str, "error", "Unknown action.");
     }
+    return ESP_OK;
+}
+
+/*
+ * Every URI handler runs through route_handler(), which tells the socket
+ * budget when it returns; until then the session counts as busy and is not
+ * evicted. Registration only, before the server takes requests.
+ */
+typedef struct
+{
+    esp_err_t (*handler)(httpd_req_t *req);
+    websocket_context_t *context;
+} http_route_t;
+
+static http_route_t s_routes[HTTP_MAX_ROUTES];
+static int s_route_count;
+
+static esp_err_t route_handler(httpd_req_t *req)
+{
+    const http_route_t *r = (const http_route_t *)req->user_ctx;
+
+    req->user_ctx = r->context;
+    esp_err_t err = r->handler(req);
+    conn_budget_done(req);
+    return err;
+}
+
+/**
+ * @brief user_ctx of a route_handler() registration for handler.
+ */
+static http_route_t *route(esp_err_t (*handler)(httpd_req_t *req), websocket_context_t *_context)
+{
+    assert(s_route_count < HTTP_MAX_ROUTES);
+    http_route_t *r = &s_routes[s_route_count++];
+    r->handler = handler;
+    r->context = _context;
+    return r;
+}
+
+esp_err_t websocket_server_start(const char *base_path) 
+{
+    WEBSOCKET_CHECK(base_path, "wrong base path", err);
+    websocket_context_t *_context = calloc(1, sizeof(websocket_context_t));
+    WEBSOCKET_CHECK(_context, "No memory for sunrise server context", err);
+    strlcpy(_context->base_path, base_path, sizeof(_context->base_path));
     
     _context->lock = xSemaphoreCreateMutex();
     
@@ -506,6 +2602,39 @@ esp_err_t websocket_server_start(const char *base_path)
     httpd_handle_t server = NULL;
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
+    config.server_port = CONFIG_WEB_SERVER_PORT;
+    // Every WebSocket or event stream client holds a socket for as long as it is connected
+    config.max_open_sockets = CONFIG_WS_MAX_CLIENTS + HTTP_RESERVED_SOCKETS;
+    if (config.max_open_sockets > HTTPD_SOCKET_LIMIT) 
+    {
+        config.max_open_sockets = HTTPD_SOCKET_LIMIT;
+    }
+    // conn_budget evicts idle sessions itself; httpd's LRU purge could pick a stream
+    config.lru_purge_enable = false;
+    config.open_fn = conn_budget_open;
+    config.close_fn = session_close;
+    // One per API endpoint, the WebSocket and the catch-all for assets
+    config.max_uri_handlers = HTTP_MAX_ROUTES;
+    conn_budget_init(config.max_open_sockets);
+    client_registry_init(conn_budget_capacity(CONN_CLASS_STREAM));
+
+    esp_timer_create_args_t drain_timer_args = {
+        .callback = drain_timer_cb,
+        .arg = _context,
+        .name = "ws_drain",
+    };
+    WEBSOCKET_CHECK(esp_timer_create(&drain_timer_args, &_context->drain_timer) == ESP_OK,
+                    "esp_timer_create failed", err_start);
+
+#if CONFIG_WEB_ASSET_BUNDLE
+    if (asset_bundle_init() != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "web assets unavailable, flash the www partition");
+    }
+#else
+    asset_cache_init(_context->base_path);
+#endif
+    WEBSOCKET_CHECK(metrics_init() == ESP_OK, "No memory for metrics", err_start);
 
     ESP_LOGI(TAG, "Starting HTTP Server");
     WEBSOCKET_CHECK(httpd_start(&server, &config) == ESP_OK, "Start server failed", err_start);
@@ -531,13 +2660,96 @@ esp_err_t websocket_server_start(const char *base_path)
     // httpd_register_uri_handler(server, &system_ping_get_uri);
 
         
+    httpd_uri_t history_get_uri = 
+    {
+        .uri = "/api/history",
+        .method = HTTP_GET,
+        .handler = route_handler,
+        .user_ctx = route(history_get_handler, _context)
+    };
+    httpd_register_uri_handler(server, &history_get_uri);
+
+    httpd_uri_t datalog_get_uri = 
+    {
+        .uri = "/api/datalog",
+        .method = HTTP_GET,
+        .handler = route_handler,
+        .user_ctx = route(datalog_get_handler, _context)
+    };
+    httpd_register_uri_handler(server, &datalog_get_uri);
+
+    httpd_uri_t metrics_get_uri = 
+    {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = route_handler,
+        .user_ctx = route(metrics_handler, _context)
+    };
+    httpd_register_uri_handler(server, &metrics_get_uri);
+
+#if CONFIG_TRACE_ENABLE
+    httpd_uri_t trace_get_uri = 
+    {
+        .uri = "/api/trace",
+        .method = HTTP_GET,
+        .handler = route_handler,
+        .user_ctx = route(trace_get_handler, _context)
+    };
+    httpd_register_uri_handler(server, &trace_get_uri);
+#endif
+
+    httpd_uri_t clients_get_uri = 
+    {
+        .uri = "/api/clients",
+        .method = HTTP_GET,
+        .handler = route_handler,
+        .user_ctx = route(clients_get_handler, _context)
+    };
+    httpd_register_uri_handler(server, &clients_get_uri);
+
+    httpd_uri_t sampling_get_uri = 
+    {
+        .uri = "/api/sampling",
+        .method = HTTP_GET,
+        .handler = route_handler,
+        .user_ctx = route(sampling_get_handler, _context)
+    };
+    httpd_register_uri_handler(server, &sampling_get_uri);
+
+    httpd_uri_t sampling_post_uri = 
+    {
+        .uri = "/api/sampling",
+        .method = HTTP_POST,
+        .handler = route_handler,
+        .user_ctx = route(sampling_post_handler, _context)
+    };
+    httpd_register_uri_handler(server, &sampling_post_uri);
+
+    httpd_uri_t stats_get_uri = 
+    {
+        .uri = "/api/stats",
+        .method = HTTP_GET,
+        .handler = route_handler,
+        .user_ctx = route(stats_get_handler, _context)
+    };
+    httpd_register_uri_handler(server, &stats_get_uri);
+
+    httpd_uri_t stream_get_uri = 
+    {
+        .uri = "/api/stream",
+        .method = HTTP_GET,
+        .handler = route_handler,
+        .user_ctx = route(stream_get_handler, _context)
+    };
+    httpd_register_uri_handler(server, &stream_get_uri);
+
     // Register WebSocket handler
     httpd_uri_t ws_uri = 
     {
         .uri = "/ws",
         .method = HTTP_GET,
-        .handler = ws_handler,
-        .user_ctx = _context,
+        .handler = route_handler,
+        .user_ctx = route(ws_handler, _context),
         .is_websocket = true
     };
     httpd_register_uri_handler(server, &ws_uri);
@@ -547,20 +2759,15 @@ esp_err_t websocket_server_start(const char *base_path)
     {
         .uri = "/*",
         .method = HTTP_GET,
-        .handler = send_file,
-        .user_ctx = _context
+        .handler = route_handler,
+        .user_ctx = route(send_file, _context)
     };
     httpd_register_uri_handler(server, &common_get_uri);
 
-    int16_t error = sps30_init();
-    if (error != NO_ERROR) 
-    {
-        printf("error executing sps30_init(): %i\n", error);
-        return error;
-    }
+    esp_event_handler_register(SENSOR_EVENT, SENSOR_COMMAND_STATUS, command_status_handler, _context);
 
     BaseType_t ok = xTaskCreatePinnedToCore(
-        broadcast_task, "broadcast_task", 4096, _context, 5, &_context->task, tskNO_AFFINITY);
+        broadcast_task, "broadcast_task", 6144, _context, 5, &_context->task, tskNO_AFFINITY);
         
     if (ok != pdPASS) 
     {
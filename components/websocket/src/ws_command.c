@@ -0,0 +1,329 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "ws_command.h"
+
+typedef struct
+{
+    char *p;
+    char *end;
+} cursor_t;
+
+static void skip_ws(cursor_t *c)
+{
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\t' || *c->p == '\n' || *c->p == '\r'))
+    {
+        c->p++;
+    }
+}
+
+static int hex_digit(char ch)
+{
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+/**
+ * Unescape the string starting after the opening quote into the same place
+ * and NUL-terminate it over the closing quote (or earlier). The unescaped
+ * form is never longer than the escaped one.
+ */
+static char *parse_string(cursor_t *c)
+{
+    char *start = c->p;
+    char *out = c->p;
+
+    while (c->p < c->end)
+    {
+        char ch = *c->p++;
+        if (ch == '"')
+        {
+            *out = '\0';
+            return start;
+        }
+        if ((unsigned char)ch < 0x20)
+        {
+            return NULL;
+        }
+        if (ch != '\\')
+        {
+            *out++ = ch;
+            continue;
+        }
+        if (c->p == c->end)
+        {
+            return NULL;
+        }
+        switch (*c->p++)
+        {
+        case '"':  *out++ = '"'; break;
+        case '\\': *out++ = '\\'; break;
+        case '/':  *out++ = '/'; break;
+        case 'b':  *out++ = '\b'; break;
+        case 'f':  *out++ = '\f'; break;
+        case 'n':  *out++ = '\n'; break;
+        case 'r':  *out++ = '\r'; break;
+        case 't':  *out++ = '\t'; break;
+        case 'u':
+        {
+            if (c->end - c->p < 4)
+            {
+                return NULL;
+            }
+            unsigned cp = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                int d = hex_digit(*c->p++);
+                if (d < 0) return NULL;
+                cp = cp << 4 | d;
+            }
+            // Commands are ASCII; the Basic Multilingual Plane is plenty
+            if (cp == 0 || (cp >= 0xD800 && cp <= 0xDFFF))
+            {
+                return NULL;
+            }
+            if (cp < 0x80)
+            {
+                *out++ = (char)cp;
+            }
+            else if (cp < 0x800)
+            {
+                *out++ = (char)(0xC0 | cp >> 6);
+                *out++ = (char)(0x80 | (cp & 0x3F));
+            }
+            else
+            {
+                *out++ = (char)(0xE0 | cp >> 12);
+                *out++ = (char)(0x80 | (cp >> 6 & 0x3F));
+                *out++ = (char)(0x80 | (cp & 0x3F));
+            }
+            break;
+        }
+        default:
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static bool parse_number(cursor_t *c, double *out)
+{
+    bool negative = false;
+    double value = 0;
+    int digits = 0;
+
+    if (c->p < c->end && *c->p == '-')
+    {
+        negative = true;
+        c->p++;
+    }
+    while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+    {
+        value = value * 10 + (*c->p++ - '0');
+        digits++;
+    }
+    if (c->p < c->end && *c->p == '.')
+    {
+        double scale = 0.1;
+        c->p++;
+        while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+        {
+            value += (*c->p++ - '0') * scale;
+            scale *= 0.1;
+            digits++;
+        }
+    }
+    if (digits == 0)
+    {
+        return false;
+    }
+    if (c->p < c->end && (*c->p == 'e' || *c->p == 'E'))
+    {
+        bool exp_negative = false;
+        int exp = 0;
+        c->p++;
+        if (c->p < c->end && (*c->p == '+' || *c->p == '-'))
+        {
+            exp_negative = *c->p++ == '-';
+        }
+        if (c->p == c->end || *c->p < '0' || *c->p > '9')
+        {
+            return false;
+        }
+        while (c->p < c->end && *c->p >= '0' && *c->p <= '9')
+        {
+            if (exp < 400) exp = exp * 10 + (*c->p - '0');
+            c->p++;
+        }
+        while (exp-- > 0)
+        {
+            value = exp_negative ? value / 10 : value * 10;
+        }
+    }
+    *out = negative ? -value : value;
+    return true;
+}
+
+static bool parse_literal(cursor_t *c, const char *word)
+{
+    size_t n = strlen(word);
+    if ((size_t)(c->end - c->p) < n || memcmp(c->p, word, n) != 0)
+    {
+        return false;
+    }
+    c->p += n;
+    return true;
+}
+
+ws_command_result_t ws_command_parse(char *buf, size_t len, ws_command_t *out)
+{
+    cursor_t c = { .p = buf, .end = buf + len };
+
+    out->count = 0;
+    skip_ws(&c);
+    if (c.p == c.end || *c.p++ != '{')
+    {
+        return WS_COMMAND_MALFORMED;
+    }
+    skip_ws(&c);
+    if (c.p < c.end && *c.p == '}')
+    {
+        c.p++;
+        goto done;
+    }
+
+    for (;;)
+    {
+        if (out->count == WS_COMMAND_MAX_FIELDS)
+        {
+            return WS_COMMAND_TOO_MANY_FIELDS;
+        }
+        ws_command_field_t *f = &out->fields[out->count];
+
+        skip_ws(&c);
+        if (c.p == c.end || *c.p++ != '"' || !(f->key = parse_string(&c)))
+        {
+            return WS_COMMAND_MALFORMED;
+        }
+        skip_ws(&c);
+        if (c.p == c.end || *c.p++ != ':')
+        {
+            return WS_COMMAND_MALFORMED;
+        }
+        skip_ws(&c);
+        if (c.p == c.end)
+        {
+            return WS_COMMAND_MALFORMED;
+        }
+
+        f->str = NULL;
+        f->num = 0;
+        if (*c.p == '"')
+        {
+            c.p++;
+            f->type = WS_JSON_STRING;
+            if (!(f->str = parse_string(&c))) return WS_COMMAND_MALFORMED;
+        }
+        else if (*c.p == '-' || (*c.p >= '0' && *c.p <= '9'))
+        {
+            f->type = WS_JSON_NUMBER;
+            if (!parse_number(&c, &f->num)) return WS_COMMAND_MALFORMED;
+        }
+        else if (parse_literal(&c, "true"))
+        {
+            f->type = WS_JSON_TRUE;
+        }
+        else if (parse_literal(&c, "false"))
+        {
+            f->type = WS_JSON_FALSE;
+        }
+        else if (parse_literal(&c, "null"))
+        {
+            f->type = WS_JSON_NULL;
+        }
+        else
+        {
+            return WS_COMMAND_MALFORMED;   // nested objects and arrays included
+        }
+        out->count++;
+
+        skip_ws(&c);
+        if (c.p == c.end)
+        {
+            return WS_COMMAND_MALFORMED;
+        }
+        char sep = *c.p++;
+        if (sep == '}')
+        {
+            break;
+        }
+        if (sep != ',')
+        {
+            return WS_COMMAND_MALFORMED;
+        }
+    }
+
+done:
+    skip_ws(&c);
+    return c.p == c.end ? WS_COMMAND_OK : WS_COMMAND_MALFORMED;
+}
+
+const ws_command_field_t *ws_command_field(const ws_command_t *cmd, const char *key)
+{
+    for (int i = 0; i < cmd->count; i++)
+    {
+        if (strcmp(cmd->fields[i].key, key) == 0)
+        {
+            return &cmd->fields[i];
+        }
+    }
+    return NULL;
+}
+
+const char *ws_command_string(const ws_command_t *cmd, const char *key)
+{
+    const ws_command_field_t *f = ws_command_field(cmd, key);
+    return f && f->type == WS_JSON_STRING ? f->str : NULL;
+}
+
+size_t ws_json_escape(char *out, size_t size, const char *s)
+{
+    size_t n = 0;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    for (; *s; s++)
+    {
+        unsigned char ch = (unsigned char)*s;
+        char esc[7];
+        size_t len;
+
+        if (ch == '"' || ch == '\\')
+        {
+            esc[0] = '\\';
+            esc[1] = (char)ch;
+            len = 2;
+        }
+        else if (ch < 0x20)
+        {
+            len = (size_t)snprintf(esc, sizeof(esc), "\\u%04x", ch);
+        }
+        else
+        {
+            esc[0] = (char)ch;
+            len = 1;
+        }
+        if (n + len >= size)
+        {
+            break;
+        }
+        memcpy(out + n, esc, len);
+        n += len;
+    }
+    out[n] = '\0';
+    return n;
+}
@@ -0,0 +1,70 @@
+/*
+ * In-place parser for the JSON commands clients send over the WebSocket.
+ *
+ * Commands are flat objects such as {"action":"registerClient","encoding":
+ * "binary"}. The parser tokenizes the receive buffer itself: strings are
+ * unescaped and NUL-terminated where they are, numbers are converted without
+ * strtod, and nothing is allocated. Nested objects and arrays are rejected.
+ *
+ * Plain C with no IDF dependencies, so tools/ws_command_bench.c can build it
+ * on the host.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define WS_COMMAND_MAX_FIELDS 8
+
+typedef enum
+{
+    WS_JSON_STRING,
+    WS_JSON_NUMBER,
+    WS_JSON_TRUE,
+    WS_JSON_FALSE,
+    WS_JSON_NULL
+} ws_json_type_t;
+
+typedef struct
+{
+    const char *key;        // NUL-terminated, in the parsed buffer
+    ws_json_type_t type;
+    const char *str;        // WS_JSON_STRING only, NUL-terminated, in the parsed buffer
+    double num;             // WS_JSON_NUMBER only
+} ws_command_field_t;
+
+typedef struct
+{
+    int count;
+    ws_command_field_t fields[WS_COMMAND_MAX_FIELDS];
+} ws_command_t;
+
+typedef enum
+{
+    WS_COMMAND_OK,
+    WS_COMMAND_MALFORMED,       // not a flat JSON object
+    WS_COMMAND_TOO_MANY_FIELDS
+} ws_command_result_t;
+
+/**
+ * @brief Parse a command in place. buf is modified; the fields point into it.
+ */
+ws_command_result_t ws_command_parse(char *buf, size_t len, ws_command_t *out);
+
+/**
+ * @brief The field with the given key, or NULL.
+ */
+const ws_command_field_t *ws_command_field(const ws_command_t *cmd, const char *key);
+
+/**
+ * @brief Value of a string field, or NULL if it is missing or not a string.
+ */
+const char *ws_command_string(const ws_command_t *cmd, const char *key);
+
+/**
+ * @brief Write s as the contents of a JSON string (no quotes), cut to fit.
+ *
+ * @return Length written, excluding the terminating NUL.
+ */
+size_t ws_json_escape(char *out, size_t size, const char *s);
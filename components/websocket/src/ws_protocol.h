@@ -0,0 +1,82 @@
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include "sensor_channels.h"
+
+/**
+ * Wire encodings a client can ask for in registerClient:
+ *   {"action":"registerClient","encoding":"json"|"binary"}
+ * JSON is the default when no encoding is given.
+ */
+typedef enum
+{
+    WS_ENCODING_JSON = 0,
+    WS_ENCODING_BINARY,
+    WS_ENCODING_COUNT
+} ws_encoding_t;
+
+#define WS_BINARY_VERSION 1
+
+/**
+ * Binary reading, sent as a HTTPD_WS_TYPE_BINARY frame. A frame holds one
+ * record per sensor, sensor 0 first.
+ *
+ * Packed little-endian record; the page decodes it with a DataView in
+ * channels.js, generated from the same channel table. Bump
+ * WS_BINARY_VERSION whenever the layout changes, a new channel included.
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t version;        // WS_BINARY_VERSION
+    uint8_t status;         // 0 = OK, 1 = sensor communication error
+    uint16_t sensor_id;     // was reserved (0) before multi-sensor support
+    int64_t timestamp_ms;   // Unix time of the reading in ms
+    float values[SENSOR_CHANNEL_COUNT];   // SENSOR_CHANNELS in wire order
+} ws_binary_reading_t;
+
+// tools/gen_channels.py writes the same sizes into channels.js
+#define WS_BINARY_READING_HEADER_LEN 12
+#define WS_BINARY_ROLLUP_HEADER_LEN 16
+
+static_assert(sizeof(ws_binary_reading_t) == WS_BINARY_READING_HEADER_LEN + 4 * SENSOR_CHANNEL_COUNT,
+              "binary reading layout changed");
+static_assert(SENSOR_CHANNEL_COUNT <= 16, "channel masks are 16 bits");
+
+#define WS_BINARY_SUBSET_VERSION 2
+
+/**
+ * Binary reading of a client that subscribed to some of the channels: this
+ * header, then one float for each bit set in channels, lowest bit first.
+ * Clients that take all channels keep getting ws_binary_reading_t; the
+ * version byte tells the two apart.
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t version;        // WS_BINARY_SUBSET_VERSION
+    uint8_t status;         // 0 = OK, 1 = sensor communication error
+    uint16_t sensor_id;
+    int64_t timestamp_ms;   // Unix time of the reading in ms
+    uint16_t channels;      // bit n set = values[n] of ws_binary_reading_t follows
+} ws_binary_subset_t;
+
+static_assert(sizeof(ws_binary_subset_t) == 14, "binary subset layout changed");
+
+/**
+ * Rollup record of /api/history?format=bin for the minute and hour tiers.
+ * The second tier is sent as a sequence of ws_binary_reading_t.
+ */
+typedef struct __attribute__((packed))
+{
+    uint8_t version;        // WS_BINARY_VERSION
+    uint8_t sensor_id;      // was reserved (0) before multi-sensor support
+    uint16_t count;         // samples in the bucket
+    uint32_t interval_s;    // bucket width
+    int64_t timestamp_ms;   // Unix time of the bucket start in ms
+    float mean[SENSOR_CHANNEL_COUNT];
+    float min[SENSOR_CHANNEL_COUNT];
+    float max[SENSOR_CHANNEL_COUNT];
+} ws_binary_rollup_t;
+
+static_assert(sizeof(ws_binary_rollup_t) == WS_BINARY_ROLLUP_HEADER_LEN + 12 * SENSOR_CHANNEL_COUNT,
+              "binary rollup layout changed");
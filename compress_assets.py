@@ -1,21 +1,100 @@
 #!/usr/bin/env python3
-import argparse, gzip, os, shutil
+import argparse, gzip, io, os, shutil, struct
 from pathlib import Path
 
 DEFAULT_EXTS = {".html", ".htm", ".css", ".js", ".svg", ".txt", ".json", ".ico", ".woff", ".woff2"}
 
+# Must match set_content_type_from_file() in components/websocket/src/websocket.c
+MIME_TYPES = {
+    ".html": "text/html",
+    ".htm": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+    ".png": "image/png",
+    ".ico": "image/x-icon",
+    ".svg": "text/xml",
+    ".json": "application/json",
+}
+
+# Bundle layout, must match asset_bundle.h
+BUNDLE_MAGIC = 0x42575757  # "WWWB"
+BUNDLE_VERSION = 1
+BUNDLE_HEADER = struct.Struct("<IHHII")            # magic, version, count, total_len, reserved
+BUNDLE_ENTRY = struct.Struct("<64s28s20sIIII")     # path, type, etag, offset, length, flags, reserved
+BUNDLE_FLAG_GZIP = 1
+BUNDLE_ALIGN = 4
+
 def gz_file(src: Path, dst: Path):
     with open(src, "rb") as fin, gzip.GzipFile(filename=src.name, mode="wb", fileobj=open(dst, "wb"), compresslevel=9, mtime=0) as gz:
         shutil.copyfileobj(fin, gz)
 
+def gz_bytes(data: bytes, name: str) -> bytes:
+    out = io.BytesIO()
+    with gzip.GzipFile(filename=name, mode="wb", fileobj=out, compresslevel=9, mtime=0) as gz:
+        gz.write(data)
+    return out.getvalue()
+
+def fnv1a64(data: bytes) -> int:
+    h = 0xcbf29ce484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+def write_bundle(root: Path, out: Path, exts, max_size):
+    """Pack every file under root into one image with a path-sorted index."""
+    assets = []
+    for path in sorted(root.rglob("*")):
+        rel = path.relative_to(root)
+        if not path.is_file() or any(part.startswith(".") for part in rel.parts):
+            continue
+        data = path.read_bytes()
+        flags = 0
+        if data[:2] == b"\x1f\x8b":
+            flags = BUNDLE_FLAG_GZIP          # already compressed by a previous run
+        elif path.suffix.lower() in exts:
+            data = gz_bytes(data, path.name)
+            flags = BUNDLE_FLAG_GZIP
+        uri = "/" + rel.as_posix()
+        if len(uri.encode()) >= 64:
+            raise SystemExit(f"path too long for the bundle index: {uri}")
+        mime = MIME_TYPES.get(path.suffix.lower(), "text/plain")
+        etag = '"%016x"' % fnv1a64(data)
+        assets.append((uri.encode(), mime.encode(), etag.encode(), data, flags))
+
+    # The device looks paths up with a binary search, so sort by raw bytes
+    assets.sort(key=lambda a: a[0])
+
+    offset = BUNDLE_HEADER.size + BUNDLE_ENTRY.size * len(assets)
+    index = b""
+    blobs = b""
+    for uri, mime, etag, data, flags in assets:
+        pad = (-offset) % BUNDLE_ALIGN
+        blobs += b"\0" * pad
+        offset += pad
+        index += BUNDLE_ENTRY.pack(uri, mime, etag, offset, len(data), flags, 0)
+        blobs += data
+        offset += len(data)
+
+    image = BUNDLE_HEADER.pack(BUNDLE_MAGIC, BUNDLE_VERSION, len(assets), offset, 0) + index + blobs
+    if max_size and len(image) > max_size:
+        raise SystemExit(f"bundle is {len(image)} bytes, partition holds {max_size}")
+    out.write_bytes(image)
+    print(f"Bundle done: {len(assets)} assets, {len(image)} bytes.")
+
 def main():
     ap = argparse.ArgumentParser()
     ap.add_argument("input_dir", help="Directory containing web assets")
     ap.add_argument("--keep-originals", action="store_true", help="Keep uncompressed alongside .gz")
     ap.add_argument("--exts", nargs="*", default=list(DEFAULT_EXTS), help="Extensions to gzip")
+    ap.add_argument("--bundle", metavar="OUT", help="Write one packed asset bundle to OUT instead of compressing in place")
+    ap.add_argument("--max-size", type=lambda s: int(s, 0), default=0, help="Fail if the bundle exceeds this size")
     args = ap.parse_args()
 
     root = Path(args.input_dir).resolve()
+    if args.bundle:
+        write_bundle(root, Path(args.bundle), {e.lower() for e in args.exts}, args.max_size)
+        return
+
     for path in root.rglob("*"):
         if path.is_file() and path.suffix.lower() in set(args.exts):
             gz_path = path.with_suffix(path.suffix + ".gz")
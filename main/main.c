@@ -9,23 +9,32 @@
 #include "sdkconfig.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "esp_chip_info.h"
-#include "esp_flash.h"
 #include "esp_system.h"
-#include "nvs_flash.h"
-#include "esp_netif.h"
-#include "esp_netif_sntp.h"
 #include "esp_event.h"
 #include "sensirion_common.h"
 #include "sensirion_uart_hal.h"
 #include "sps30_uart.h"
-#include "mdns.h"
 #include "esp_log.h"
+#include "websocket.h"
+#include "sensor_events.h"
+#include "sensor_bus.h"
+#include "history.h"
+#include "datalog.h"
+#include "bench.h"
+
+#if CONFIG_IDF_TARGET_LINUX
+#include <signal.h>
+#else
+#include "esp_chip_info.h"
+#include "esp_flash.h"
+#include "nvs_flash.h"
+#include "esp_netif.h"
+#include "esp_netif_sntp.h"
+#include "mdns.h"
 #include "esp_spiffs.h"
 #include "protocol_examples_common.h"
 #include "lwip/apps/netbiosns.h"
-#include "websocket.h"
-#include "sensor_events.h"
+#endif
 
 int sps30(void);
 
@@ -34,6 +43,7 @@ int sps30(void);
 
 static const char *TAG = "sps30 simple main";
 
+#if !CONFIG_IDF_TARGET_LINUX
 static void initialise_mdns(void)
 {
     mdns_init();
@@ -46,7 +56,7 @@ static void initialise_mdns(void)
         {"path", "/"}
     };
 
-    ESP_ERROR_CHECK(mdns_service_add("SimpleSps30-WebServer", "_http", "_tcp", 80, serviceTxtData,
+    ESP_ERROR_CHECK(mdns_service_add("SimpleSps30-WebServer", "_http", "_tcp", CONFIG_WEB_SERVER_PORT, serviceTxtData,
                                      sizeof(serviceTxtData) / sizeof(serviceTxtData[0])));
 }
 
@@ -92,7 +102,68 @@ static void time_init(void)
     setenv("TZ","EST5EDT,M3.2.0/2,M11.1.0/2",1); 
     tzset();
 }
+#endif
 
+/*
+ * History keeps every good reading the sensor task publishes, per sensor. The
+ * data log format has no sensor field, so it records sensor 0 only.
+ */
+static void record_task(void *arg)
+{
+    sensor_bus_sub_t *sub;
+    if (sensor_bus_subscribe(&sub) != ESP_OK) {
+        ESP_LOGE(TAG, "no sensor bus subscription left, readings are not recorded");
+        vTaskDelete(NULL);
+        return;
+    }
+
+    for (;;) {
+        if (!sensor_bus_wait(sub, portMAX_DELAY)) {
+            continue;
+        }
+        const sensor_sample_t *slot;
+        while ((slot = sensor_bus_read_begin(sub)) != NULL) {
+            // Copied: what history and the log stored cannot be taken back
+            // if the slot turns out to have been overwritten
+            sensor_sample_t sample = *slot;
+            if (!sensor_bus_read_end(sub)) {
+                continue;
+            }
+            for (int i = 0; i < sample.count; i++) {
+                const sensor_data_t *reading = &sample.sensors[i];
+                if (reading->status != SENSOR_OK) {
+                    continue;
+                }
+                history_append(reading, &sample.derived[i]);
+                if (reading->sensor_id == 0) {
+                    datalog_append(reading);
+                }
+            }
+        }
+    }
+}
+
+#if CONFIG_IDF_TARGET_LINUX
+/*
+ * Host build: no Wi-Fi, mDNS or SPIFFS. The SPS30 is simulated behind the UART
+ * HAL and the web assets are served from the build directory.
+ */
+void app_main(void)
+{
+    ESP_LOGI(TAG, "Initializing (host build)");
+
+    // A client closing its socket mid-send must not kill the process
+    signal(SIGPIPE, SIG_IGN);
+
+    ESP_ERROR_CHECK(sensor_events_init());
+    ESP_ERROR_CHECK(history_init());
+    ESP_ERROR_CHECK(datalog_init());
+    xTaskCreate(record_task, "record_task", 4096, NULL, 5, NULL);
+    bench_init();
+    ESP_ERROR_CHECK(websocket_server_start(HOST_WEB_ROOT));
+    ESP_ERROR_CHECK(sensor_task_start());
+}
+#else
 void app_main(void)
 {
     ESP_LOGI(TAG, "Initializing");
@@ -105,14 +176,25 @@ void app_main(void)
     netbiosns_set_name(CONFIG_MDNS_HOST_NAME);
 
     ESP_ERROR_CHECK(example_connect());
+#if !CONFIG_WEB_ASSET_BUNDLE
     ESP_ERROR_CHECK(init_fs());
+#endif
 
     ESP_ERROR_CHECK(sensor_events_init());
     ESP_LOGI(TAG, "Event system initialized");
+    ESP_ERROR_CHECK(history_init());
+    if (datalog_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Data log unavailable, readings are not persisted");
+    }
+    xTaskCreate(record_task, "record_task", 4096, NULL, 5, NULL);
+    bench_init();
 
     time_init();
     ESP_ERROR_CHECK(websocket_server_start(CONFIG_WEB_MOUNT_POINT));
+    // Sole owner of the SPS30; everything else subscribes to its events
+    ESP_ERROR_CHECK(sensor_task_start());
 }
+#endif
 
 int sps30(void) 
 {
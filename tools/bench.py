@@ -0,0 +1,205 @@
+#!/usr/bin/env python3
+"""End-to-end benchmark driver for the linux host build.
+
+Starts the host build of the app (simulated SPS30 behind the UART HAL), opens
+N WebSocket clients that register for broadcasts, and collects for a while:
+
+  * client side: frames/s and bytes/s received per client
+  * app side: the "BENCH" lines logged by the bench component (samples/s,
+    sensor-to-socket latency percentiles, fanout and frame rendering time,
+    sample size, heap, allocations, per-command UART latency and response
+    size as uart_<cmd>_us_avg/_max and uart_<cmd>_rx_bytes, and sched_missed,
+    sched_duplicates and sched_jitter_us_max for how well the readers track
+    the sensor's 1 s clock)
+
+Build the app first with CONFIG_BENCH_ENABLE=y:
+
+    idf.py --preview set-target linux
+    idf.py build
+    python tools/bench.py --clients 1 8 32 --duration 30
+"""
+import argparse
+import base64
+import json
+import os
+import re
+import socket
+import struct
+import subprocess
+import sys
+import threading
+import time
+
+BENCH_RE = re.compile(r'BENCH (.*)$')
+
+
+class WsClient(threading.Thread):
+    """Minimal RFC 6455 client: handshake, masked text frames out, count frames in."""
+
+    def __init__(self, host, port, register_msg):
+        super().__init__(daemon=True)
+        self.host = host
+        self.port = port
+        self.register_msg = register_msg
+        self.frames = 0
+        self.bytes = 0
+        self.stop = threading.Event()
+        self.error = None
+
+    def _send_text(self, sock, text):
+        payload = text.encode()
+        mask = os.urandom(4)
+        header = bytes([0x81])
+        if len(payload) < 126:
+            header += bytes([0x80 | len(payload)])
+        else:
+            header += bytes([0x80 | 126]) + struct.pack('>H', len(payload))
+        masked = bytes(b ^ mask[i % 4] for i, b in enumerate(payload))
+        sock.sendall(header + mask + masked)
+
+    def _recv_exact(self, sock, n):
+        buf = b''
+        while len(buf) < n:
+            chunk = sock.recv(n - len(buf))
+            if not chunk:
+                raise ConnectionError('closed by server')
+            buf += chunk
+        return buf
+
+    def run(self):
+        try:
+            sock = socket.create_connection((self.host, self.port), timeout=5)
+            key = base64.b64encode(os.urandom(16)).decode()
+            sock.sendall((f'GET /ws HTTP/1.1\r\nHost: {self.host}:{self.port}\r\n'
+                          'Upgrade: websocket\r\nConnection: Upgrade\r\n'
+                          f'Sec-WebSocket-Key: {key}\r\nSec-WebSocket-Version: 13\r\n\r\n').encode())
+            response = b''
+            while b'\r\n\r\n' not in response:
+                response += self._recv_exact(sock, 1)
+            if b' 101 ' not in response.split(b'\r\n')[0]:
+                raise ConnectionError('handshake failed')
+            self._send_text(sock, self.register_msg)
+            sock.settimeout(1)
+            while not self.stop.is_set():
+                try:
+                    head = self._recv_exact(sock, 2)
+                except socket.timeout:
+                    continue
+                length = head[1] & 0x7F
+                if length == 126:
+                    length = struct.unpack('>H', self._recv_exact(sock, 2))[0]
+                elif length == 127:
+                    length = struct.unpack('>Q', self._recv_exact(sock, 8))[0]
+                payload = self._recv_exact(sock, length)
+                opcode = head[0] & 0x0F
+                if opcode == 0x8:
+                    break
+                if b'response_for' in payload:
+                    continue
+                self.frames += 1
+                self.bytes += length
+            sock.close()
+        except Exception as e:  # noqa: BLE001 - report any client failure
+            self.error = e
+
+
+def wait_for_port(host, port, timeout):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection((host, port), timeout=0.5).close()
+            return True
+        except OSError:
+            time.sleep(0.2)
+    return False
+
+
+def parse_bench_line(line):
+    m = BENCH_RE.search(line)
+    if not m:
+        return None
+    fields = {}
+    for kv in m.group(1).split():
+        k, _, v = kv.partition('=')
+        try:
+            fields[k] = float(v)
+        except ValueError:
+            pass
+    return fields
+
+
+def run_once(args, clients):
+    app = subprocess.Popen([args.elf], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                           text=True, bufsize=1)
+    reports = []
+
+    def pump():
+        for line in app.stdout:
+            if args.verbose:
+                sys.stdout.write(line)
+            fields = parse_bench_line(line)
+            if fields:
+                reports.append(fields)
+
+    threading.Thread(target=pump, daemon=True).start()
+    try:
+        if not wait_for_port(args.host, args.port, 15):
+            raise RuntimeError('app did not open its HTTP port')
+        ws = [WsClient(args.host, args.port, args.register) for _ in range(clients)]
+        for c in ws:
+            c.start()
+        # Skip the first report, it covers start-up
+        time.sleep(args.warmup)
+        reports.clear()
+        start = time.time()
+        base = [(c.frames, c.bytes) for c in ws]
+        time.sleep(args.duration)
+        elapsed = time.time() - start
+        for c in ws:
+            c.stop.set()
+        errors = [c.error for c in ws if c.error]
+        rx = [((c.frames - f0) / elapsed, (c.bytes - b0) / elapsed) for c, (f0, b0) in zip(ws, base)]
+    finally:
+        app.terminate()
+        app.wait(5)
+
+    summary = {'clients': clients, 'client_errors': len(errors)}
+    if rx:
+        summary['client_frames_per_s_min'] = min(r[0] for r in rx)
+        summary['client_bytes_per_s_avg'] = sum(r[1] for r in rx) / len(rx)
+    if reports:
+        # UART command fields only appear in windows that ran the command
+        for key in sorted({k for r in reports for k in r}):
+            values = [r[key] for r in reports if key in r]
+            if key.endswith('_max') or key.endswith('_p99') or key == 'heap_peak':
+                summary[key] = max(values)
+            else:
+                summary[key] = sum(values) / len(values)
+    return summary
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument('--elf', default='build/sps30-web.elf', help='Host build of the app')
+    ap.add_argument('--host', default='127.0.0.1')
+    ap.add_argument('--port', type=int, default=8080, help='CONFIG_WEB_SERVER_PORT')
+    ap.add_argument('--clients', type=int, nargs='+', default=[1, 8, 32], help='Client counts to sweep')
+    ap.add_argument('--duration', type=float, default=30, help='Measurement time per run (s)')
+    ap.add_argument('--warmup', type=float, default=12, help='Time before measuring (s)')
+    ap.add_argument('--register', default='{"action":"registerClient"}', help='Registration message')
+    ap.add_argument('--json', action='store_true', help='Print results as JSON')
+    ap.add_argument('--verbose', action='store_true', help='Echo app output')
+    args = ap.parse_args()
+
+    results = [run_once(args, n) for n in args.clients]
+    if args.json:
+        print(json.dumps(results, indent=2))
+        return
+    keys = sorted({k for r in results for k in r if k != 'clients'})
+    print(f"{'metric':<28}" + ''.join(f'{r["clients"]:>14}' for r in results))
+    for k in keys:
+        print(f'{k:<28}' + ''.join(f'{r.get(k, float("nan")):>14.2f}' for r in results))
+
+
+if __name__ == '__main__':
+    main()
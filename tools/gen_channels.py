@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Generates the page's channels.js from the channel table in C.
+
+Reads the SENSOR_CHANNELS and SENSOR_CHANNEL_GROUPS rows of
+components/sensor_events/include/sensor_channels.h and the binary header
+sizes of components/websocket/src/ws_protocol.h, and writes a script with the
+channel list for the charts and table and unrolled decoders for the binary
+records (used by the page's decoder worker). The build runs it when copying www/ (main/CMakeLists.txt):
+
+    python tools/gen_channels.py sensor_channels.h ws_protocol.h build/web_build/channels.js
+"""
+import argparse
+import json
+import re
+from pathlib import Path
+
+ROW = re.compile(r"^\s*([XG])\((.*)\)\s*\\?\s*$")
+DEFINE = re.compile(r"^#define\s+(WS_BINARY_\w+_HEADER_LEN)\s+(\d+)")
+
+CHANNEL_COLUMNS = ("name", "field", "key", "group", "size", "label", "unit", "decimals", "raw_decimals")
+GROUP_COLUMNS = ("name", "metric", "metric_unit", "unit", "help")
+
+
+def split_args(text):
+    """Splits macro arguments on top-level commas; strings have no commas."""
+    args = [a.strip() for a in text.split(",")]
+    return [json.loads(a) if a.startswith('"') else a for a in args]
+
+
+def parse_rows(path):
+    channels, groups = [], []
+    in_table = None
+    for line in Path(path).read_text(encoding="utf-8").splitlines():
+        if line.startswith("#define SENSOR_CHANNELS(X)"):
+            in_table = "X"
+            continue
+        if line.startswith("#define SENSOR_CHANNEL_GROUPS(G)"):
+            in_table = "G"
+            continue
+        m = ROW.match(line)
+        if not in_table or not m or m.group(1) != in_table:
+            in_table = None
+            continue
+        args = split_args(m.group(2))
+        if in_table == "X":
+            channels.append(dict(zip(CHANNEL_COLUMNS, args)))
+        else:
+            groups.append(dict(zip(GROUP_COLUMNS, args)))
+        if not line.rstrip().endswith("\\"):
+            in_table = None
+    if not channels or not groups:
+        raise SystemExit(f"{path}: no SENSOR_CHANNELS / SENSOR_CHANNEL_GROUPS rows")
+    return channels, groups
+
+
+def parse_header_lens(path):
+    lens = {}
+    for line in Path(path).read_text(encoding="utf-8").splitlines():
+        m = DEFINE.match(line)
+        if m:
+            lens[m.group(1)] = int(m.group(2))
+    return lens["WS_BINARY_READING_HEADER_LEN"], lens["WS_BINARY_ROLLUP_HEADER_LEN"]
+
+
+def render(channels, groups, reading_header, rollup_header):
+    count = len(channels)
+    out = [
+        "// Generated by tools/gen_channels.py from sensor_channels.h and ws_protocol.h; do not edit.",
+        "",
+        "// Channel groups: one chart each where the page has a canvas for it",
+        "const CHANNEL_GROUPS = [",
+    ]
+    for g in groups:
+        out.append(f"    {{ name: {json.dumps(g['name'].lower())}, unit: {json.dumps(g['unit'], ensure_ascii=False)} }},")
+    out += [
+        "];",
+        "",
+        "// Channels in wire order (values[n] of a binary record, bit n of a channel mask)",
+        "const CHANNELS = [",
+    ]
+    for c in channels:
+        fields = {
+            "key": c["key"],
+            "group": c["group"].lower(),
+            "size": c["size"],
+            "label": c["label"],
+            "unit": c["unit"],
+        }
+        body = ", ".join(f"{k}: {json.dumps(v, ensure_ascii=False)}" for k, v in fields.items())
+        out.append(f"    {{ {body} }},")
+    out += [
+        "];",
+        "",
+        "// Record sizes of ws_binary_reading_t and ws_binary_rollup_t",
+        f"const BINARY_READING_SIZE = {reading_header + 4 * count};",
+        f"const BINARY_ROLLUP_SIZE = {rollup_header + 12 * count};",
+        "",
+        "// Little-endian floats of a ws_binary_reading_t into values[base...], wire order",
+        "function decodeReadingChannels(view, values, base) {",
+    ]
+    for i, c in enumerate(channels):
+        out.append(f"    values[base + {i}] = view.getFloat32({reading_header + 4 * i}, true); // {c['key']}")
+    out += [
+        "}",
+        "",
+        "// The means of a ws_binary_rollup_t into values[base...]",
+        "function decodeRollupChannels(view, values, base) {",
+    ]
+    for i, c in enumerate(channels):
+        out.append(f"    values[base + {i}] = view.getFloat32({rollup_header + 4 * i}, true); // {c['key']}")
+    out += ["}", ""]
+    return "\n".join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("channels_h", help="sensor_channels.h")
+    parser.add_argument("protocol_h", help="ws_protocol.h")
+    parser.add_argument("output", help="channels.js to write")
+    args = parser.parse_args()
+
+    channels, groups = parse_rows(args.channels_h)
+    reading_header, rollup_header = parse_header_lens(args.protocol_h)
+    Path(args.output).write_text(render(channels, groups, reading_header, rollup_header), encoding="utf-8")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,65 @@
+/*
+ * Host microbenchmark of the WebSocket command parser (ws_command.c).
+ *
+ *   cc -O2 -Icomponents/websocket/src tools/ws_command_bench.c \
+ *      components/websocket/src/ws_command.c -o ws_command_bench
+ *   ./ws_command_bench [iterations]
+ *
+ * Each iteration copies a command into a receive buffer, as httpd_ws_recv_frame
+ * does, parses it and looks up the action, cycling through the messages the
+ * web page and tools/bench.py send plus a malformed one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ws_command.h"
+
+static const char *messages[] =
+{
+    "{\"action\":\"registerClient\"}",
+    "{\"action\":\"registerClient\",\"encoding\":\"binary\",\"queue\":\"drop\"}",
+    "{ \"action\" : \"sleep\", \"enabled\" : false }",
+    "{\"action\":\"fanClean\"}",
+    "{\"action\":\"closeConnection\",\"reason\":\"tab \\\"closed\\\"\\u0021\"}",
+    "{\"action\":\"registerClient\",\"encoding\":[\"binary\"]}",
+};
+#define MESSAGE_COUNT (sizeof(messages) / sizeof(messages[0]))
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+    size_t lengths[MESSAGE_COUNT];
+    char rx[257];
+    ws_command_t cmd;
+    unsigned long ok = 0, actions = 0;
+
+    for (size_t i = 0; i < MESSAGE_COUNT; i++)
+    {
+        lengths[i] = strlen(messages[i]);
+    }
+
+    double start = now_s();
+    for (long i = 0; i < iterations; i++)
+    {
+        size_t m = (size_t)i % MESSAGE_COUNT;
+        memcpy(rx, messages[m], lengths[m]);
+        if (ws_command_parse(rx, lengths[m], &cmd) == WS_COMMAND_OK)
+        {
+            ok++;
+            actions += ws_command_string(&cmd, "action") != NULL;
+        }
+    }
+    double elapsed = now_s() - start;
+
+    printf("commands=%ld parsed=%lu actions=%lu commands_per_s=%.0f ns_per_command=%.1f\n",
+           iterations, ok, actions, iterations / elapsed, elapsed * 1e9 / iterations);
+    return 0;
+}
@@ -1,37 +1,87 @@
 let ws = null;
-let massChart, numberChart;
-let maxDataPoints = 60; // Keep last 60 seconds of data
-
-// Data storage (timestamps and readings)
-let data = {
-    timestamps: [],
-    mc_1p0: [],
-    mc_2p5: [],
-    mc_4p0: [],
-    mc_10p0: [],
-    nc_0p5: [],
-    nc_1p0: [],
-    nc_2p5: [],
-    nc_4p0: [],
-    nc_10p0: [],
-    typical_particle_size: []
-};
-
-// Chart color schemes
-const massColors = {
-    mc_1p0: 'rgba(255, 107, 107, 1)',
-    mc_2p5: 'rgba(255, 165, 0, 1)',
-    mc_4p0: 'rgba(100, 200, 255, 1)',
-    mc_10p0: 'rgba(75, 192, 192, 1)'
-};
-
-const numberColors = {
-    nc_0p5: 'rgba(255, 107, 107, 1)',
-    nc_1p0: 'rgba(255, 165, 0, 1)',
-    nc_2p5: 'rgba(100, 200, 255, 1)',
-    nc_4p0: 'rgba(153, 102, 255, 1)',
-    nc_10p0: 'rgba(75, 192, 192, 1)'
-};
+let decoder = null; // Web Worker decoding binary frames and history (decoder.js)
+let charts = []; // One per channel group with a canvas: { chart, channels, points }
+let maxDataPoints = 24 * 3600; // Keep the last 24 h of 1 s data
+let maxWeekPoints = 7 * 24 * 60; // Last week of 1 min buckets
+let view = 'day'; // Which data set the charts show: 'day' or 'week'
+let historyLoaded = false;
+let historyGeneration = 0; // Ignores history that arrives after a reconnect
+let pendingBlocks = []; // Live readings received while history loads
+let redrawPending = false;
+let chartsDirty = false;
+let latestReading = null; // Shown in the table at the next redraw
+
+// CHANNELS, CHANNEL_GROUPS, the record sizes and the channel decoders come
+// from channels.js, generated from sensor_channels.h by the build
+
+/**
+ * Fixed-capacity ring of readings: one Float64Array of timestamps and one
+ * Float32Array per channel. Appending is O(1); once full, the oldest
+ * reading is overwritten.
+ */
+class ReadingRing {
+    constructor(capacity) {
+        this.capacity = capacity;
+        this.length = 0;
+        this.head = 0; // Next slot to write
+        this.timestamps = new Float64Array(capacity);
+        this.values = CHANNELS.map(() => new Float32Array(capacity));
+    }
+
+    clear() {
+        this.length = 0;
+        this.head = 0;
+    }
+
+    // Slot of the i-th oldest reading
+    slot(i) {
+        const s = this.head - this.length + i;
+        return s < 0 ? s + this.capacity : s;
+    }
+
+    lastTimestamp() {
+        return this.length > 0 ? this.timestamps[this.slot(this.length - 1)] : 0;
+    }
+
+    // values[base...] holds CHANNELS.length floats in wire order
+    push(timestamp, values, base) {
+        const s = this.head;
+        this.timestamps[s] = timestamp;
+        for (let c = 0; c < this.values.length; c++) {
+            this.values[c][s] = values[base + c];
+        }
+        this.head = s + 1 === this.capacity ? 0 : s + 1;
+        if (this.length < this.capacity) {
+            this.length++;
+        }
+    }
+
+    pushBlock(block) {
+        for (let i = 0; i < block.count; i++) {
+            this.push(block.timestamps[i], block.values, i * CHANNELS.length);
+        }
+    }
+}
+
+// Data storage: 1 s readings, live and from /api/history
+const data = new ReadingRing(maxDataPoints);
+
+// Minute rollups of the last week (means), filled from /api/history and
+// then from the live readings
+const weekData = new ReadingRing(maxWeekPoints);
+
+// Open minute of live readings, added to weekData when the minute is over
+const openMinute = { start: 0, count: 0, sums: new Float64Array(CHANNELS.length), means: new Float32Array(CHANNELS.length) };
+
+// Line colors, in channel order within a chart
+const chartColors = [
+    'rgba(255, 107, 107, 1)',
+    'rgba(255, 165, 0, 1)',
+    'rgba(100, 200, 255, 1)',
+    'rgba(153, 102, 255, 1)',
+    'rgba(75, 192, 192, 1)',
+    'rgba(255, 206, 86, 1)'
+];
 
 // Initialize charts on page load
 window.addEventListener('DOMContentLoaded', () => {
@@ -39,88 +89,81 @@ window.addEventListener('DOMContentLoaded', () => {
     populateTable();
 });
 
+function formatTime(ms) {
+    const time = new Date(ms);
+    return view === 'week' ? time.toLocaleString() : time.toLocaleTimeString();
+}
+
 function initCharts() {
-    const massCtx = document.getElementById('massChart').getContext('2d');
-    massChart = new Chart(massCtx, {
-        type: 'line',
-        data: {
-            labels: data.timestamps,
-            datasets: [
-                createDataset('PM1.0', 'mc_1p0', massColors.mc_1p0),
-                createDataset('PM2.5', 'mc_2p5', massColors.mc_2p5),
-                createDataset('PM4.0', 'mc_4p0', massColors.mc_4p0),
-                createDataset('PM10.0', 'mc_10p0', massColors.mc_10p0)
-            ]
-        },
-        options: {
-            responsive: true,
-            maintainAspectRatio: true,
-            interaction: {
-                mode: 'index',
-                intersect: false
-            },
-            plugins: {
-                legend: {
-                    position: 'top',
-                }
-            },
-            scales: {
-                y: {
-                    beginAtZero: true,
-                    title: {
-                        display: true,
-                        text: 'µg/m³'
-                    }
-                }
-            }
+    CHANNEL_GROUPS.forEach(group => {
+        const canvas = document.getElementById(`${group.name}Chart`);
+        if (!canvas) {
+            return;
         }
-    });
-
-    const numberCtx = document.getElementById('numberChart').getContext('2d');
-    numberChart = new Chart(numberCtx, {
-        type: 'line',
-        data: {
-            labels: data.timestamps,
-            datasets: [
-                createDataset('PM0.5', 'nc_0p5', numberColors.nc_0p5),
-                createDataset('PM1.0', 'nc_1p0', numberColors.nc_1p0),
-                createDataset('PM2.5', 'nc_2p5', numberColors.nc_2p5),
-                createDataset('PM4.0', 'nc_4p0', numberColors.nc_4p0),
-                createDataset('PM10.0', 'nc_10p0', numberColors.nc_10p0)
-            ]
-        },
-        options: {
-            responsive: true,
-            maintainAspectRatio: true,
-            interaction: {
-                mode: 'index',
-                intersect: false
-            },
-            plugins: {
-                legend: {
-                    position: 'top',
-                }
+        // Wire indexes of the channels in this chart
+        const channels = [];
+        CHANNELS.forEach((channel, c) => {
+            if (channel.group === group.name) {
+                channels.push(c);
+            }
+        });
+        const chart = new Chart(canvas.getContext('2d'), {
+            type: 'line',
+            data: {
+                datasets: channels.map((c, i) =>
+                    createDataset(`PM${CHANNELS[c].size}`, chartColors[i % chartColors.length]))
             },
-            scales: {
-                y: {
-                    beginAtZero: true,
-                    title: {
-                        display: true,
-                        text: '#/cm³'
+            options: {
+                responsive: true,
+                maintainAspectRatio: true,
+                animation: false,
+                // Points are decimated {x, y} objects already in time order
+                parsing: false,
+                normalized: true,
+                spanGaps: true,
+                interaction: {
+                    mode: 'index',
+                    intersect: false
+                },
+                plugins: {
+                    legend: {
+                        position: 'top',
+                    },
+                    tooltip: {
+                        callbacks: {
+                            title: items => items.length > 0 ? formatTime(items[0].parsed.x) : ''
+                        }
+                    }
+                },
+                scales: {
+                    x: {
+                        type: 'linear',
+                        ticks: {
+                            maxTicksLimit: 8,
+                            callback: value => formatTime(value)
+                        }
+                    },
+                    y: {
+                        beginAtZero: true,
+                        title: {
+                            display: true,
+                            text: group.unit
+                        }
                     }
                 }
             }
-        }
+        });
+        charts.push({ chart, channels, points: channels.map(() => []) });
     });
 }
 
-function createDataset(label, key, color) {
+function createDataset(label, color) {
     return {
         label: label,
-        data: data[key],
+        data: [],
         borderColor: color,
         backgroundColor: color.replace('1)', '0.1)'),
-        tension: 0.3,
+        tension: 0,
         fill: false,
         pointRadius: 0,
         pointHoverRadius: 6,
@@ -128,43 +171,75 @@ function createDataset(label, key, color) {
     };
 }
 
+function startDecoder() {
+    if (decoder) {
+        return;
+    }
+    decoder = new Worker('decoder.js');
+    decoder.onmessage = (event) => {
+        const message = event.data;
+        if (message.type === 'live') {
+            addBlock(message.block);
+        } else if (message.type === 'history' && message.generation === historyGeneration) {
+            finishHistory(message.second, message.minute);
+        }
+    };
+    decoder.onerror = (error) => {
+        console.error('Decoder error:', error.message);
+    };
+}
+
 function connectToServer() {
     // Build WebSocket URL based on current page location
     const protocol = window.location.protocol === 'https:' ? 'wss:' : 'ws:';
     const url = `${protocol}//${window.location.host}/ws`;
 
     console.log('Connecting to:', url);
+    startDecoder();
     ws = new WebSocket(url);
+    ws.binaryType = 'arraybuffer';
 
     ws.onopen = () => {
         console.log('Connected to server');
         updateConnectionStatus(true);
         document.getElementById('connect-btn').disabled = true;
         document.getElementById('disconnect-btn').disabled = false;
+        setCommandButtons(true);
 
-        // Register client to receive broadcasts
-        ws.send(JSON.stringify({ action: 'registerClient' }));
+        // Register client to receive broadcasts as compact binary frames
+        ws.send(JSON.stringify({ action: 'registerClient', encoding: 'binary' }));
+        loadHistory();
     };
 
     ws.onmessage = (event) => {
         try {
+            if (event.data instanceof ArrayBuffer) {
+                // Decoded by the worker; the buffer is handed over, not copied
+                decoder.postMessage({ type: 'frame', buffer: event.data }, [event.data]);
+                return;
+            }
+
             const message = JSON.parse(event.data);
 
-            // Handle registration response
-            if (message.response_for === 'registerClient') {
-                console.log('Registration response:', message.status, message.message);
+            // Handle action responses
+            if (message.response_for !== undefined) {
+                console.log(message.response_for, 'response:', message.status, message.message);
+                if (message.status === 'error' && message.response_for !== 'registerClient') {
+                    showCommandStatus(`${message.response_for}: ${message.message}`);
+                }
                 return;
             }
 
-            // Handle sensor data broadcast
+            // Handle command progress, pushed to every client
+            if (message.command !== undefined) {
+                const c = message.command;
+                showCommandStatus(`${c.type} #${c.handle}: ${c.state}` + (c.error ? ` (${c.error})` : ''));
+                return;
+            }
+
+            // Handle a JSON sensor data broadcast
             if (message.status !== undefined) {
-                if (message.status === 'OK') {
-                    addDataPoint(message);
-                } else {
-                    console.warn('Sensor reading error:', message.status);
-                    // Still update with zero values to show connection is alive
-                    addDataPoint(message);
-                }
+                addBlock(jsonBlock(message));
             }
         } catch (e) {
             console.error('Error parsing message:', e);
@@ -181,106 +256,285 @@ function connectToServer() {
         updateConnectionStatus(false);
         document.getElementById('connect-btn').disabled = false;
         document.getElementById('disconnect-btn').disabled = true;
+        setCommandButtons(false);
     };
 }
 
+/**
+ * Queue a sensor command; its progress arrives as {"command":{...}} messages.
+ */
+function sendCommand(action) {
+    if (ws && ws.readyState === WebSocket.OPEN) {
+        ws.send(JSON.stringify({ action }));
+    }
+}
+
+function setCommandButtons(enabled) {
+    for (const id of ['fan-clean-btn', 'sleep-btn', 'wake-btn']) {
+        document.getElementById(id).disabled = !enabled;
+    }
+}
+
+function showCommandStatus(text) {
+    document.getElementById('command-status').textContent = text;
+}
+
+/**
+ * A JSON reading in the block shape the decoder worker posts.
+ */
+function jsonBlock(message) {
+    const values = new Float32Array(CHANNELS.length);
+    CHANNELS.forEach((channel, c) => {
+        values[c] = message[channel.key] || 0;
+    });
+    return {
+        count: 1,
+        timestamps: new Float64Array([message.timestamp_ms || Date.now()]),
+        status: new Uint8Array([message.status === 'OK' ? 0 : 1]),
+        values
+    };
+}
+
+/**
+ * Prefill the charts with the device history: the last 1 s readings it
+ * keeps and the last week at 1 min, fetched and decoded by the worker.
+ * Live readings that arrive meanwhile are queued and appended afterwards.
+ */
+function loadHistory() {
+    historyLoaded = false;
+    pendingBlocks = [];
+    data.clear();
+    weekData.clear();
+    decoder.postMessage({ type: 'history', generation: ++historyGeneration });
+}
+
+/**
+ * Adds an OK 1 s reading to the open minute. Once a reading of a later
+ * minute arrives, the mean of the open one becomes a week point, like the
+ * device's minute buckets (timestamped at the start of the minute).
+ *
+ * @return true if weekData got a new point
+ */
+function accumulateMinute(timestamp, values, base, status) {
+    if (status !== 0) {
+        return false;
+    }
+    const start = Math.floor(timestamp / 60000) * 60000;
+    let closed = false;
+    if (start !== openMinute.start) {
+        if (openMinute.count > 0 && openMinute.start > weekData.lastTimestamp()) {
+            for (let c = 0; c < CHANNELS.length; c++) {
+                openMinute.means[c] = openMinute.sums[c] / openMinute.count;
+            }
+            weekData.push(openMinute.start, openMinute.means, 0);
+            closed = true;
+        }
+        openMinute.start = start;
+        openMinute.count = 0;
+        openMinute.sums.fill(0);
+    }
+    for (let c = 0; c < CHANNELS.length; c++) {
+        openMinute.sums[c] += values[base + c];
+    }
+    openMinute.count++;
+    return closed;
+}
+
+function finishHistory(second, minute) {
+    if (second) {
+        data.pushBlock(second);
+    }
+    if (minute) {
+        weekData.pushBlock(minute);
+    }
+
+    // Seed the open minute with the 1 s history the minute tier does not
+    // cover yet
+    openMinute.start = 0;
+    openMinute.count = 0;
+    const weekLast = weekData.lastTimestamp();
+    for (let i = 0; second && i < second.count; i++) {
+        if (second.timestamps[i] >= weekLast + 60000) {
+            accumulateMinute(second.timestamps[i], second.values, i * CHANNELS.length, second.status[i]);
+        }
+    }
+
+    // History timestamps are whole seconds; a queued reading from the same
+    // second is already part of it
+    const last = data.lastTimestamp();
+    historyLoaded = true;
+    pendingBlocks.forEach(block => {
+        for (let i = 0; i < block.count; i++) {
+            if (block.timestamps[i] >= last + 950) {
+                data.push(block.timestamps[i], block.values, i * CHANNELS.length);
+                accumulateMinute(block.timestamps[i], block.values, i * CHANNELS.length, block.status[i]);
+            }
+        }
+    });
+    pendingBlocks = [];
+    chartsDirty = true;
+    scheduleRedraw();
+}
+
+function setView(newView) {
+    view = newView;
+    chartsDirty = true;
+    scheduleRedraw();
+}
+
 function disconnectFromServer() {
     if (ws) {
         ws.close();
     }
 }
 
-function addDataPoint(reading) {
-    const now = new Date().toLocaleTimeString();
-    
-    // Add timestamp and data
-    data.timestamps.push(now);
-    data.mc_1p0.push(reading.mc_1p0 || 0);
-    data.mc_2p5.push(reading.mc_2p5 || 0);
-    data.mc_4p0.push(reading.mc_4p0 || 0);
-    data.mc_10p0.push(reading.mc_10p0 || 0);
-    data.nc_0p5.push(reading.nc_0p5 || 0);
-    data.nc_1p0.push(reading.nc_1p0 || 0);
-    data.nc_2p5.push(reading.nc_2p5 || 0);
-    data.nc_4p0.push(reading.nc_4p0 || 0);
-    data.nc_10p0.push(reading.nc_10p0 || 0);
-    data.typical_particle_size.push(reading.typical_particle_size || 0);
-
-    // Keep only last maxDataPoints
-    if (data.timestamps.length > maxDataPoints) {
-        data.timestamps.shift();
-        data.mc_1p0.shift();
-        data.mc_2p5.shift();
-        data.mc_4p0.shift();
-        data.mc_10p0.shift();
-        data.nc_0p5.shift();
-        data.nc_1p0.shift();
-        data.nc_2p5.shift();
-        data.nc_4p0.shift();
-        data.nc_10p0.shift();
-        data.typical_particle_size.shift();
+function addBlock(block) {
+    const last = block.count - 1;
+    if (last < 0) {
+        return;
     }
+    if (block.status[last] !== 0) {
+        console.warn('Sensor reading error');
+    }
+    latestReading = block.values.subarray(last * CHANNELS.length, block.count * CHANNELS.length);
+
+    if (!historyLoaded) {
+        pendingBlocks.push(block);
+    } else {
+        data.pushBlock(block);
+        let weekChanged = false;
+        for (let i = 0; i < block.count; i++) {
+            weekChanged = accumulateMinute(block.timestamps[i], block.values, i * CHANNELS.length, block.status[i])
+                || weekChanged;
+        }
+        chartsDirty = chartsDirty || view === 'day' || weekChanged;
+    }
+    scheduleRedraw();
+}
+
+/**
+ * Coalesces table and chart updates into one per animation frame; readings
+ * arriving in between (or while the tab is hidden) are drawn together.
+ */
+function scheduleRedraw() {
+    if (!redrawPending) {
+        redrawPending = true;
+        requestAnimationFrame(redraw);
+    }
+}
+
+function redraw() {
+    redrawPending = false;
+    if (latestReading) {
+        updateTable(latestReading);
+        latestReading = null;
+    }
+    if (chartsDirty) {
+        chartsDirty = false;
+        updateCharts();
+    }
+}
+
+/**
+ * Min-max decimation of one channel of a ring into points: per bucket of
+ * readings the lowest and the highest, in time order, so peaks survive.
+ * Point objects are reused from one redraw to the next.
+ */
+function decimate(ring, channel, buckets, points) {
+    const times = ring.timestamps;
+    const values = ring.values[channel];
+    const n = ring.length;
+    let count = 0;
 
-    updateCharts();
-    updateTable(reading);
+    const emit = (s) => {
+        let p = points[count];
+        if (!p) {
+            p = points[count] = { x: 0, y: 0 };
+        }
+        p.x = times[s];
+        p.y = values[s];
+        count++;
+    };
+
+    // Slot of the oldest reading; slots past the end wrap to the start
+    const first = ring.slot(0);
+    const capacity = ring.capacity;
+
+    if (n <= buckets * 2) {
+        for (let i = 0, s = first; i < n; i++, s = s + 1 === capacity ? 0 : s + 1) {
+            emit(s);
+        }
+    } else {
+        const per = n / buckets;
+        let s = first;
+        for (let b = 0, i = 0; b < buckets; b++) {
+            const end = Math.floor((b + 1) * per);
+            let minSlot = s;
+            let maxSlot = s;
+            let min = values[s];
+            let max = min;
+            for (i++, s = s + 1 === capacity ? 0 : s + 1; i < end; i++, s = s + 1 === capacity ? 0 : s + 1) {
+                const y = values[s];
+                if (y < min) {
+                    min = y;
+                    minSlot = s;
+                } else if (y > max) {
+                    max = y;
+                    maxSlot = s;
+                }
+            }
+            if (minSlot === maxSlot) {
+                emit(minSlot);
+            } else if (times[minSlot] < times[maxSlot]) {
+                emit(minSlot);
+                emit(maxSlot);
+            } else {
+                emit(maxSlot);
+                emit(minSlot);
+            }
+        }
+    }
+    points.length = count;
+    return points;
 }
 
 function updateCharts() {
-    massChart.data.labels = data.timestamps;
-    massChart.data.datasets[0].data = data.mc_1p0;
-    massChart.data.datasets[1].data = data.mc_2p5;
-    massChart.data.datasets[2].data = data.mc_4p0;
-    massChart.data.datasets[3].data = data.mc_10p0;
-    massChart.update();
-
-    numberChart.data.labels = data.timestamps;
-    numberChart.data.datasets[0].data = data.nc_0p5;
-    numberChart.data.datasets[1].data = data.nc_1p0;
-    numberChart.data.datasets[2].data = data.nc_2p5;
-    numberChart.data.datasets[3].data = data.nc_4p0;
-    numberChart.data.datasets[4].data = data.nc_10p0;
-    numberChart.update();
+    const shown = view === 'week' ? weekData : data;
+
+    charts.forEach(({ chart, channels, points }) => {
+        // About one bucket per pixel column
+        const buckets = Math.max(100, Math.floor(chart.width || 600));
+        channels.forEach((c, i) => {
+            chart.data.datasets[i].data = decimate(shown, c, buckets, points[i]);
+        });
+        const x = chart.options.scales.x;
+        x.min = shown.length > 0 ? shown.timestamps[shown.slot(0)] : undefined;
+        x.max = shown.length > 0 ? shown.lastTimestamp() : undefined;
+        chart.update('none');
+    });
 }
 
 function populateTable() {
     const tbody = document.getElementById('table-body');
     tbody.innerHTML = '';
 
-    const parameters = [
-        { key: 'mc_1p0', label: 'Mass Concentration PM1.0', unit: 'µg/m³' },
-        { key: 'mc_2p5', label: 'Mass Concentration PM2.5', unit: 'µg/m³' },
-        { key: 'mc_4p0', label: 'Mass Concentration PM4.0', unit: 'µg/m³' },
-        { key: 'mc_10p0', label: 'Mass Concentration PM10.0', unit: 'µg/m³' },
-        { key: 'nc_0p5', label: 'Number Concentration PM0.5', unit: '#/cm³' },
-        { key: 'nc_1p0', label: 'Number Concentration PM1.0', unit: '#/cm³' },
-        { key: 'nc_2p5', label: 'Number Concentration PM2.5', unit: '#/cm³' },
-        { key: 'nc_4p0', label: 'Number Concentration PM4.0', unit: '#/cm³' },
-        { key: 'nc_10p0', label: 'Number Concentration PM10.0', unit: '#/cm³' },
-        { key: 'typical_particle_size', label: 'Typical Particle Size', unit: 'µm' }
-    ];
-
-    parameters.forEach(param => {
+    CHANNELS.forEach(channel => {
         const row = document.createElement('tr');
         row.innerHTML = `
-            <td>${param.label}</td>
-            <td id="value-${param.key}">--</td>
-            <td>${param.unit}</td>
+            <td>${channel.label}</td>
+            <td id="value-${channel.key}">--</td>
+            <td>${channel.unit}</td>
         `;
         tbody.appendChild(row);
     });
 }
 
-function updateTable(reading) {
-    const parameters = [
-        'mc_1p0', 'mc_2p5', 'mc_4p0', 'mc_10p0',
-        'nc_0p5', 'nc_1p0', 'nc_2p5', 'nc_4p0', 'nc_10p0',
-        'typical_particle_size'
-    ];
-
-    parameters.forEach(param => {
-        const elem = document.getElementById(`value-${param}`);
-        if (elem && reading[param] !== undefined) {
-            elem.textContent = reading[param].toFixed(2);
+// values: CHANNELS.length floats in wire order
+function updateTable(values) {
+    CHANNELS.forEach((channel, c) => {
+        const elem = document.getElementById(`value-${channel.key}`);
+        if (elem) {
+            elem.textContent = values[c].toFixed(2);
         }
     });
 }
@@ -298,4 +552,4 @@ function updateConnectionStatus(connected) {
         statusDot.classList.add('disconnected');
         statusText.textContent = 'Disconnected';
     }
-}
\ No newline at end of file
+}
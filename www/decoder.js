@@ -0,0 +1,100 @@
+// Web Worker of app.js: decodes binary WebSocket frames and fetches and
+// decodes the history, so the page's thread only appends and draws.
+//
+// In:  { type: 'frame', buffer }        a binary frame (transferred)
+//      { type: 'history', generation }  load the second and minute tiers
+// Out: { type: 'live', block }
+//      { type: 'history', generation, second, minute }   blocks, or null
+//
+// A block holds count records column-wise: timestamps (Unix ms), status
+// (0 = OK) and values (CHANNELS.length floats per record, wire order). Its
+// arrays are transferred, not copied.
+importScripts('channels.js');
+
+// Must match WS_BINARY_VERSION in ws_protocol.h
+const BINARY_VERSION = 1;
+
+function createBlock(capacity) {
+    return {
+        count: 0,
+        timestamps: new Float64Array(capacity),
+        status: new Uint8Array(capacity),
+        values: new Float32Array(capacity * CHANNELS.length)
+    };
+}
+
+function transferables(block) {
+    return [block.timestamps.buffer, block.status.buffer, block.values.buffer];
+}
+
+/**
+ * Decode a ws_binary_reading_t (little-endian) at the given offset.
+ */
+function decodeReading(buffer, offset, block) {
+    const view = new DataView(buffer, offset, BINARY_READING_SIZE);
+    const version = view.getUint8(0);
+    if (version !== BINARY_VERSION) {
+        console.warn('Unsupported binary frame version:', version);
+        return;
+    }
+    const i = block.count++;
+    block.status[i] = view.getUint8(1);
+    block.timestamps[i] = Number(view.getBigInt64(4, true));
+    decodeReadingChannels(view, block.values, i * CHANNELS.length);
+}
+
+/**
+ * Decode a ws_binary_rollup_t; only the means are charted.
+ */
+function decodeRollup(buffer, offset, block) {
+    const view = new DataView(buffer, offset, BINARY_ROLLUP_SIZE);
+    const i = block.count++;
+    block.status[i] = 0;
+    block.timestamps[i] = Number(view.getBigInt64(8, true));
+    decodeRollupChannels(view, block.values, i * CHANNELS.length);
+}
+
+async function fetchHistory(tier, recordSize, decode) {
+    // The charts show sensor 0; other sensors have their own history
+    const response = await fetch(`/api/history?tier=${tier}&format=bin&sensor=0`);
+    if (!response.ok) {
+        throw new Error(`history ${tier}: HTTP ${response.status}`);
+    }
+    const buffer = await response.arrayBuffer();
+    const block = createBlock(Math.floor(buffer.byteLength / recordSize));
+    for (let offset = 0; offset + recordSize <= buffer.byteLength; offset += recordSize) {
+        decode(buffer, offset, block);
+    }
+    return block;
+}
+
+self.onmessage = async (event) => {
+    const message = event.data;
+
+    if (message.type === 'frame') {
+        // A frame holds one record per sensor, sensor 0 first
+        if (message.buffer.byteLength < BINARY_READING_SIZE) {
+            console.warn('Short binary frame:', message.buffer.byteLength);
+            return;
+        }
+        const block = createBlock(1);
+        decodeReading(message.buffer, 0, block);
+        if (block.count > 0) {
+            self.postMessage({ type: 'live', block }, transferables(block));
+        }
+        return;
+    }
+
+    if (message.type === 'history') {
+        // Frames keep being decoded while the fetches are pending
+        const result = { type: 'history', generation: message.generation, second: null, minute: null };
+        try {
+            result.second = await fetchHistory('second', BINARY_READING_SIZE, decodeReading);
+            result.minute = await fetchHistory('minute', BINARY_ROLLUP_SIZE, decodeRollup);
+        } catch (e) {
+            console.error('Error loading history:', e);
+        }
+        const blocks = [result.second, result.minute].filter(block => block);
+        self.postMessage(result, blocks.flatMap(transferables));
+    }
+};